@@ -0,0 +1,298 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "Accounts.h"
+#include "JsonReader.h"
+#include "WorkStealingPool.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "BalanceHistory.h"
+#include "TimerWheel.h"
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+vector<Accounts::Account> Accounts::read(const string& path, double default_threshold)
+{
+	ifstream f(path, ios::binary);
+	if (!f.is_open())
+		throw runtime_error("Failed to open file " + path);
+	ostringstream ss;
+	ss << f.rdbuf();
+	string text = ss.str();
+
+	vector<Account> res;
+	JsonReader r(text);
+	string_view key;
+	r.beginObject();
+	while (r.nextMember(key))
+	{
+		if (key != "accounts")
+		{
+			r.skipValue();
+			continue;
+		}
+		r.beginArray();
+		while (r.nextElement())
+		{
+			Account a;
+			a.threshold = default_threshold;
+			r.beginObject();
+			while (r.nextMember(key))
+			{
+				if (key == "name")
+					a.name = string(r.readString());
+				else if (key == "key")
+					a.key = string(r.readString());
+				else if (key == "secret")
+					a.secret = string(r.readString());
+				else if (key == "threshold")
+					a.threshold = r.readNumber();
+				else if (key == "balancelog")
+					a.balancelog = string(r.readString());
+				else if (key == "history")
+					a.history = string(r.readString());
+				else if (key == "orderlog")
+					a.orderlog = string(r.readString());
+				else if (key == "journal")
+					a.journal = string(r.readString());
+				else if (key == "coins")
+				{
+					r.beginArray();
+					while (r.nextElement())
+						a.coins.push_back(string(r.readString()));
+				}
+				else if (key == "parts")
+				{
+					r.beginArray();
+					while (r.nextElement())
+						a.parts.push_back(r.readNumber());
+				}
+				else
+					r.skipValue();
+			}
+			if (a.name.empty())
+				a.name = "account " + to_string(res.size() + 1);
+			if (a.key.empty() || a.secret.empty())
+				throw runtime_error(a.name + ": key and secret are required");
+			if (a.coins.size() != a.parts.size())
+				throw runtime_error(a.name + ": coins number differs from parts number");
+			res.push_back(a);
+		}
+	}
+	return res;
+}
+
+Accounts::Accounts(WexTradeApi& market, const vector<Account>& accounts, unsigned threads) :
+	m_market(market),
+	m_accounts(accounts),
+	m_portfolios(accounts.size()),
+	m_threads(threads)
+{
+	for (size_t i = 0; i < m_accounts.size(); ++i)
+	{
+		const Account& a = m_accounts[i];
+		m_trades.emplace_back(new WexTradeApi(a.key, a.secret, market));
+		if (!a.orderlog.empty())
+			m_trades[i]->set_log(a.orderlog);
+		m_portfolios[i].set_verbose(false);
+		for (size_t c = 0; c < a.coins.size(); ++c)
+			m_portfolios[i].addCoin(a.coins[c], a.parts[c]);
+	}
+}
+
+void Accounts::start(size_t i, Outcome& out, unsigned timeout)
+{
+	LOG_SCOPE(INFO, PORTFOLIO, "Accounts::start " + m_accounts[i].name);
+	WexTradeApi& trade = *m_trades[i];
+	// Recovered orders lock funds, the account is checked once they settle
+	out.orders = trade.recoverOrders(chrono::minutes(timeout));
+	if (out.orders.empty())
+		check(i, out);
+}
+
+void Accounts::check(size_t i, Outcome& out)
+{
+	LOG_SCOPE(INFO, PORTFOLIO, "Accounts::check " + m_accounts[i].name);
+	WexTradeApi& trade = *m_trades[i];
+	out.checked = true;
+	if (!out.orders.empty())
+		trade.refresh();
+	for (auto b : trade.nonZeroBalancesInBTC())
+		out.total += b.second;
+	if (!m_accounts[i].balancelog.empty())
+	{
+		ofstream fout(m_accounts[i].balancelog, ofstream::app);
+		if (!fout.is_open())
+			throw runtime_error("Failed to open file " + m_accounts[i].balancelog);
+		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+		double usd_price = trade.info("usd").lastPrice;
+		fout << ttp << "," << out.total << "," << out.total / usd_price << endl;
+	}
+	vector<TradeApi::Order> orders = m_portfolios[i].checkCurrentState(trade, m_accounts[i].threshold);
+	string account = Metrics::label("account", m_accounts[i].name);
+	Metrics::gauge("wex_portfolio_drift", account, m_portfolios[i].drift());
+	if (!m_accounts[i].history.empty())
+		BalanceHistory::append(m_accounts[i].history, BalanceHistory::snapshot(trade, m_portfolios[i].drift()));
+	vector<TradeApi::Order> now;
+	TradeApi::splitFunded(orders, coin_value(trade.balances(), CoinRegistry::btc), now, out.later);
+	if (!now.empty())
+	{
+		vector<TradeApi::OrderResult> placed = trade.placeOrders(now);
+		out.orders.insert(out.orders.end(), placed.begin(), placed.end());
+	}
+	Metrics::gauge("wex_open_orders", account, (double)out.orders.size());
+}
+
+vector<Accounts::Outcome> Accounts::run(unsigned timeout)
+{
+	LOG_SCOPE(INFO, PORTFOLIO, "Accounts::run");
+	vector<Outcome> res(m_accounts.size());
+	// The only request for public data of the whole run
+	m_market.tickers();
+
+	WorkStealingPool pool(m_threads);
+	// Runs f(i) for the accounts which have not failed yet and records the
+	// exception of an account as its error
+	auto for_each_account = [&](function<void(size_t)> f)
+	{
+		for (size_t i = 0; i < m_accounts.size(); ++i)
+		{
+			if (!res[i].error.empty())
+				continue;
+			pool.submit([&, f, i]()
+			{
+				try
+				{
+					f(i);
+				}
+				catch (const exception& e)
+				{
+					res[i].error = e.what();
+					LOG_WRITE(ERR, PORTFOLIO, m_accounts[i].name + ": " + e.what());
+				}
+			});
+		}
+		pool.wait();
+	};
+
+	for_each_account([&](size_t i) { start(i, res[i], timeout); });
+
+	typedef TimerWheel::Clock Clock;
+	// Checks the orders of an account and places what waits for them,
+	// returns the number still open. placed tells that new orders went out.
+	auto poll = [&](size_t i, bool& placed)
+	{
+		Outcome& out = res[i];
+		size_t n = m_trades[i]->checkOrders(out.orders);
+		if (!n && !out.checked)
+		{
+			check(i, out);
+			placed = true;
+			for (const TradeApi::OrderResult& r : out.orders)
+				n += r.id && !r.executed && !r.cancelled;
+		}
+		if (!out.later.empty() && TradeApi::sellsSettled(out.orders))
+		{
+			vector<TradeApi::OrderResult> more = m_trades[i]->placeOrders(out.later);
+			out.later.clear();
+			placed = true;
+			for (const TradeApi::OrderResult& r : more)
+				n += r.id && !r.executed;
+			out.orders.insert(out.orders.end(), more.begin(), more.end());
+		}
+		Metrics::gauge("wex_open_orders", Metrics::label("account", m_accounts[i].name), (double)n);
+		return n;
+	};
+	// Every account with open orders has its own timer, as every order has
+	// in execute(): a first check soon after the placement, then the
+	// interval doubles up to the longest poll of the market. Checks run on
+	// the pool and schedule the next one, the last is due at the timeout.
+	TimerWheel timers;
+	Clock::time_point deadline = Clock::now() + chrono::minutes(timeout);
+	size_t polling = 0;
+	mutex polling_mutex;
+	function<void(size_t, Clock::duration)> schedule = [&](size_t i, Clock::duration interval)
+	{
+		timers.schedule(min(Clock::now() + interval, deadline), [&, i, interval]()
+		{
+			pool.submit([&, i, interval]()
+			{
+				size_t n = 0;
+				bool placed = false;
+				try
+				{
+					n = poll(i, placed);
+				}
+				catch (const exception& e)
+				{
+					res[i].error = e.what();
+					LOG_WRITE(ERR, PORTFOLIO, m_accounts[i].name + ": " + e.what());
+				}
+				if (n && Clock::now() < deadline)
+				{
+					schedule(i, placed ? Clock::duration(m_market.first_poll()) :
+						min<Clock::duration>(interval * 2, m_market.max_poll()));
+					return;
+				}
+				lock_guard<mutex> lock(polling_mutex);
+				if (!--polling)
+					timers.stop();
+			});
+		});
+	};
+	for (size_t i = 0; i < m_accounts.size(); ++i)
+	{
+		if (res[i].error.empty() && (!res[i].orders.empty() || !res[i].later.empty()))
+		{
+			++polling;
+			schedule(i, m_market.first_poll());
+		}
+	}
+	if (polling)
+	{
+		timers.run();
+		pool.wait();
+	}
+
+	// Orders of failed accounts are cancelled too
+	for (size_t i = 0; i < m_accounts.size(); ++i)
+	{
+		if (!res[i].orders.empty())
+		{
+			pool.submit([&, i]()
+			{
+				try
+				{
+					m_trades[i]->cancelOrders(res[i].orders);
+					Metrics::gauge("wex_open_orders", Metrics::label("account", m_accounts[i].name), 0);
+				}
+				catch (const exception& e)
+				{
+					if (res[i].error.empty())
+						res[i].error = e.what();
+				}
+			});
+		}
+	}
+	pool.wait();
+	for (Outcome& out : res)
+	{
+		for (const TradeApi::Order& o : out.later)
+		{
+			TradeApi::OrderResult r;
+			r.order = o;
+			r.error = "Not placed, the sells did not fill in time";
+			out.orders.push_back(r);
+		}
+		out.later.clear();
+		if (out.error.empty() && !out.checked)
+			out.error = "Orders of an earlier run did not settle in time, not checked";
+	}
+	return res;
+}
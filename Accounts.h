@@ -0,0 +1,98 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "WexTradeApi.h"
+#include "Portfolio.h"
+
+// Rebalances many accounts in one run. Tickers and pair parameters are
+// fetched once through the market connection and shared by all accounts,
+// every account signs with its own key and nonce. Balances, checks and
+// orders of the accounts run concurrently on a worker pool, and a failure
+// of one account is recorded in its outcome without stopping the others.
+class Accounts
+{
+public:
+	struct Account
+	{
+		std::string name;
+		std::string key;
+		std::string secret;
+		std::vector<std::string> coins;
+		std::vector<double> parts;
+		double threshold;
+		std::string balancelog;
+		std::string history;
+		std::string orderlog;
+		std::string journal;
+
+		Account() : threshold(0.0) {}
+	};
+
+	struct Outcome
+	{
+		double total;           // BTC
+		std::vector<TradeApi::OrderResult> orders;
+		// Buys the BTC on the account can't pay for until the sells settle.
+		// Those left at the end are in orders with an error.
+		std::vector<TradeApi::Order> later;
+		// False while orders of an earlier run are still open
+		bool checked;
+		std::string error;
+
+		Outcome() : total(0.0), checked(false) {}
+	};
+
+	// Reads a JSON file of the form
+	// {"accounts": [{"name": "a", "key": "...", "secret": "...",
+	//   "coins": ["btc", "ltc"], "parts": [1, 1], "threshold": 0.05,
+	//   "balancelog": "a.csv", "history": "a.bal", "orderlog": "a.log",
+	//   "journal": "a.journal"}]}
+	// The threshold, the log files, the balance history and the journal are optional.
+	static std::vector<Account> read(const std::string& path, double default_threshold);
+
+	Accounts(WexTradeApi& market, const std::vector<Account>& accounts, unsigned threads);
+
+	size_t size() const
+	{
+		return m_accounts.size();
+	}
+
+	const Account& account(size_t i) const
+	{
+		return m_accounts[i];
+	}
+
+	// Connection of an account, to apply the client options
+	WexTradeApi& trade(size_t i)
+	{
+		return *m_trades[i];
+	}
+
+	void set_solver(std::shared_ptr<RebalanceSolver> solver)
+	{
+		for (Portfolio& p : m_portfolios)
+			p.set_solver(solver);
+	}
+
+	// Cancels the open orders of every account, or polls those of an
+	// earlier run recovered from its journal with the others until they
+	// settle, then places the orders of the check and polls them until they
+	// fill or timeout minutes pass. Buys paid with the BTC of sells are
+	// placed once the sells have settled.
+	// Returns an outcome per account.
+	std::vector<Outcome> run(unsigned timeout);
+
+private:
+	void start(size_t i, Outcome& out, unsigned timeout);
+	void check(size_t i, Outcome& out);
+
+	WexTradeApi& m_market;
+	std::vector<Account> m_accounts;
+	std::vector<std::unique_ptr<WexTradeApi>> m_trades;
+	std::vector<Portfolio> m_portfolios;
+	unsigned m_threads;
+};
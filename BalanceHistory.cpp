@@ -0,0 +1,278 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "BalanceHistory.h"
+#include <atomic>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/interprocess/sync/file_lock.hpp>
+#include <boost/interprocess/sync/scoped_lock.hpp>
+#include <boost/interprocess/exceptions.hpp>
+
+namespace bip = boost::interprocess;
+using namespace std;
+
+static const char magic[8] = { 'W', 'E', 'X', 'B', 'A', 'L', 'N', 0 };
+static const uint32_t version = 1;
+static const size_t name_size = 16;
+static const size_t header_size = 4096;
+static const size_t summary_size = 128;
+static const size_t column_size = BalanceHistory::rows_per_block * sizeof(double);
+// The time column, the fields of the record and the fields of every coin
+static const size_t columns = 1 + BalanceHistory::FIELDS +
+	BalanceHistory::max_coins * BalanceHistory::COIN_FIELDS;
+// Blocks start at page boundaries, so one can be mapped on its own
+static const size_t block_size = (summary_size + columns * column_size + 4095) / 4096 * 4096;
+
+struct BalanceHistory::Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t coins;
+	uint32_t block_rows;
+	uint32_t coin_slots;
+	int64_t last_time;
+	atomic<uint64_t> rows;
+	char names[BalanceHistory::max_coins][name_size];
+};
+
+// Of a full block, min, max and sum of every field
+struct BalanceHistory::Summary
+{
+	double min[FIELDS];
+	double max[FIELDS];
+	double sum[FIELDS];
+};
+
+static_assert(sizeof(atomic<uint64_t>) == sizeof(uint64_t), "the record count is a plain word in the file");
+
+static size_t field_column(BalanceHistory::Field field)
+{
+	return 1 + field;
+}
+
+static size_t coin_column(size_t coin, BalanceHistory::CoinField field)
+{
+	return 1 + BalanceHistory::FIELDS + coin * BalanceHistory::COIN_FIELDS + field;
+}
+
+BalanceHistory::Record BalanceHistory::snapshot(TradeApi& trade, double drift)
+{
+	const TradeApi::CoinValues& amounts = trade.balances();
+	const TradeApi::Tickers& t = trade.tickers();
+	Record r;
+	r.time = ::time(0);
+	r.drift = drift;
+	for (CoinId id = 0; id < amounts.size(); ++id)
+	{
+		if (amounts[id] == 0.0)
+			continue;
+		Coin c;
+		c.name = CoinRegistry::name(id);
+		c.amount = amounts[id];
+		c.price = (id == CoinRegistry::btc) ? 1.0 :
+			(coin_value(t.buyPrice, id) + coin_value(t.sellPrice, id)) / 2;
+		c.value = c.amount * c.price;
+		r.total_btc += c.value;
+		r.coins.push_back(c);
+	}
+	double usd_price = trade.info("usd").lastPrice;
+	r.total_usd = usd_price ? r.total_btc / usd_price : 0.0;
+	return r;
+}
+
+void BalanceHistory::append(const string& path, const Record& record)
+{
+	static_assert(sizeof(Header) <= header_size && sizeof(Summary) <= summary_size, "layout overflow");
+	{
+		// Appending creates the file without touching a present one
+		ofstream create(path, ios::binary | ios::app);
+		if (!create.is_open())
+			throw runtime_error("Failed to open balance history " + path);
+	}
+	bip::file_lock file_lock(path.c_str());
+	bip::scoped_lock<bip::file_lock> lock(file_lock);
+	if (filesystem::file_size(path) < header_size)
+		filesystem::resize_file(path, header_size);
+	bip::file_mapping file(path.c_str(), bip::read_write);
+	bip::mapped_region head(file, bip::read_write, 0, header_size);
+	Header* h = static_cast<Header*>(head.get_address());
+	if (!h->version)
+	{
+		memcpy(h->magic, magic, sizeof(magic));
+		h->version = version;
+		h->block_rows = rows_per_block;
+		h->coin_slots = max_coins;
+	}
+	else if (memcmp(h->magic, magic, sizeof(magic)) || h->version != version ||
+		h->block_rows != rows_per_block || h->coin_slots != max_coins)
+		throw runtime_error(path + " is not a balance history file");
+
+	vector<double> coin_fields(h->coins * COIN_FIELDS, 0.0);
+	for (const Coin& c : record.coins)
+	{
+		string name = c.name.substr(0, name_size - 1);
+		uint32_t slot = 0;
+		while (slot < h->coins && strncmp(h->names[slot], name.c_str(), name_size))
+			++slot;
+		if (slot == h->coins)
+		{
+			if (slot == max_coins)
+				throw runtime_error("Balance history " + path + " is full of other coins, " + name + " can't be added");
+			memset(h->names[slot], 0, name_size);
+			memcpy(h->names[slot], name.data(), name.size());
+			++h->coins;
+			coin_fields.resize(h->coins * COIN_FIELDS, 0.0);
+		}
+		coin_fields[slot * COIN_FIELDS + AMOUNT] = c.amount;
+		coin_fields[slot * COIN_FIELDS + VALUE] = c.value;
+		coin_fields[slot * COIN_FIELDS + PRICE] = c.price;
+	}
+
+	uint64_t row = h->rows.load(memory_order_relaxed);
+	size_t b = row / rows_per_block;
+	size_t i = row % rows_per_block;
+	size_t end = header_size + (b + 1) * block_size;
+	if (filesystem::file_size(path) < end)
+		filesystem::resize_file(path, end);
+	bip::mapped_region region(file, bip::read_write, header_size + b * block_size, block_size);
+	char* base = static_cast<char*>(region.get_address());
+	auto col = [base](size_t index)
+	{
+		return reinterpret_cast<double*>(base + summary_size + index * column_size);
+	};
+	int64_t time = row ? max(record.time, h->last_time) : record.time;
+	reinterpret_cast<int64_t*>(col(0))[i] = time;
+	col(field_column(TOTAL_BTC))[i] = record.total_btc;
+	col(field_column(TOTAL_USD))[i] = record.total_usd;
+	col(field_column(DRIFT))[i] = record.drift;
+	// Every coin slot is written, a crashed append may have left a value
+	for (size_t c = 0; c < h->coins; ++c)
+	{
+		for (size_t f = 0; f < COIN_FIELDS; ++f)
+			col(coin_column(c, (CoinField)f))[i] = coin_fields[c * COIN_FIELDS + f];
+	}
+	if (i + 1 == rows_per_block)
+	{
+		Summary* s = reinterpret_cast<Summary*>(base);
+		for (size_t f = 0; f < FIELDS; ++f)
+		{
+			const double* v = col(field_column((Field)f));
+			s->min[f] = *min_element(v, v + rows_per_block);
+			s->max[f] = *max_element(v, v + rows_per_block);
+			s->sum[f] = 0.0;
+			for (size_t j = 0; j < rows_per_block; ++j)
+				s->sum[f] += v[j];
+		}
+	}
+	region.flush();
+	h->last_time = time;
+	h->rows.store(row + 1, memory_order_release);
+	head.flush();
+}
+
+BalanceHistory::BalanceHistory(const string& path) :
+	m_rows(0)
+{
+	try
+	{
+		bip::file_mapping file(path.c_str(), bip::read_only);
+		bip::mapped_region region(file, bip::read_only);
+		m_file.swap(file);
+		m_region.swap(region);
+	}
+	catch (const bip::interprocess_exception& e)
+	{
+		throw runtime_error("Failed to open balance history " + path + ": " + e.what());
+	}
+	const Header* h = static_cast<const Header*>(m_region.get_address());
+	if (m_region.get_size() < header_size || memcmp(h->magic, magic, sizeof(magic)) ||
+		h->version != version || h->block_rows != rows_per_block ||
+		h->coin_slots != max_coins || h->coins > max_coins)
+		throw runtime_error(path + " is not a balance history file");
+	for (uint32_t c = 0; c < h->coins; ++c)
+		m_coins.push_back(string(h->names[c], strnlen(h->names[c], name_size)));
+	size_t blocks = (m_region.get_size() - header_size) / block_size;
+	m_rows = (size_t)min<uint64_t>(h->rows.load(memory_order_acquire), blocks * rows_per_block);
+}
+
+size_t BalanceHistory::find(const string& coin) const
+{
+	return std::find(m_coins.begin(), m_coins.end(), coin) - m_coins.begin();
+}
+
+const char* BalanceHistory::block(size_t index) const
+{
+	return static_cast<const char*>(m_region.get_address()) + header_size + index * block_size;
+}
+
+const BalanceHistory::Summary& BalanceHistory::summary(size_t index) const
+{
+	return *reinterpret_cast<const Summary*>(block(index));
+}
+
+const int64_t* BalanceHistory::times(size_t index) const
+{
+	return reinterpret_cast<const int64_t*>(block(index) + summary_size);
+}
+
+const double* BalanceHistory::column(size_t index, Field field) const
+{
+	return reinterpret_cast<const double*>(block(index) + summary_size + field_column(field) * column_size);
+}
+
+const double* BalanceHistory::column(size_t index, size_t coin, CoinField field) const
+{
+	return reinterpret_cast<const double*>(block(index) + summary_size + coin_column(coin, field) * column_size);
+}
+
+size_t BalanceHistory::lower_bound(int64_t t) const
+{
+	size_t lo = 0, hi = m_rows;
+	while (lo < hi)
+	{
+		size_t mid = lo + (hi - lo) / 2;
+		if (time(mid) < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+BalanceHistory::Stats BalanceHistory::stats(Field field, size_t from, size_t to) const
+{
+	Stats s;
+	to = min(to, m_rows);
+	auto add = [&s](size_t rows, double lo, double hi, double sum)
+	{
+		s.min = s.rows ? min(s.min, lo) : lo;
+		s.max = s.rows ? max(s.max, hi) : hi;
+		s.sum += sum;
+		s.rows += rows;
+	};
+	for (size_t row = from; row < to;)
+	{
+		size_t b = row / rows_per_block;
+		size_t i = row % rows_per_block;
+		size_t n = min(rows_per_block - i, to - row);
+		if (n == rows_per_block)
+		{
+			const Summary& sum = summary(b);
+			add(n, sum.min[field], sum.max[field], sum.sum[field]);
+		}
+		else
+		{
+			const double* v = column(b, field) + i;
+			double total = 0.0;
+			for (size_t j = 0; j < n; ++j)
+				total += v[j];
+			add(n, *min_element(v, v + n), *max_element(v, v + n), total);
+		}
+		row += n;
+	}
+	return s;
+}
@@ -0,0 +1,141 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "TradeApi.h"
+
+// Balance snapshots of the runs on an account, one record per run, in an
+// append-only binary file. Records are stored in blocks of rows_per_block
+// rows; inside a block every field is a column of its own, and a full
+// block keeps the min, max and sum of its totals and drift. Range queries
+// binary search the time column and read the summaries of whole blocks,
+// so they touch little more than the ends of the range.
+//
+// The file is a header page with the coin names and the number of
+// records, followed by the blocks. A record becomes visible with the
+// store of the new record count, after all its columns are written, so a
+// reader never sees half of one and a crashed append is simply redone.
+// Appends of several processes are serialized by a file lock.
+class BalanceHistory
+{
+public:
+	static const size_t rows_per_block = 1024;
+	static const size_t max_coins = 32;
+
+	struct Coin
+	{
+		std::string name;
+		double amount;
+		double value;           // BTC
+		double price;           // BTC, middle of buy and sell
+
+		Coin() : amount(0.0), value(0.0), price(0.0) {}
+	};
+
+	struct Record
+	{
+		int64_t time;           // unix time
+		double total_btc;
+		double total_usd;
+		double drift;           // largest deviation from the target part
+		std::vector<Coin> coins;
+
+		Record() : time(0), total_btc(0.0), total_usd(0.0), drift(0.0) {}
+	};
+
+	// The non-zero balances of the account at the current prices
+	static Record snapshot(TradeApi& trade, double drift);
+
+	// Appends the record, creating the file if there is none. A record
+	// older than the last one is stored with the time of the last one, so
+	// the time column stays sorted.
+	static void append(const std::string& path, const Record& record);
+
+	enum Field
+	{
+		TOTAL_BTC,
+		TOTAL_USD,
+		DRIFT,
+		FIELDS
+	};
+
+	enum CoinField
+	{
+		AMOUNT,
+		VALUE,
+		PRICE,
+		COIN_FIELDS
+	};
+
+	struct Stats
+	{
+		size_t rows;
+		double min;
+		double max;
+		double sum;
+
+		Stats() : rows(0), min(0.0), max(0.0), sum(0.0) {}
+		double avg() const
+		{
+			return rows ? sum / rows : 0.0;
+		}
+	};
+
+	// Maps the file for reading, records appended later are not seen
+	explicit BalanceHistory(const std::string& path);
+
+	size_t rows() const
+	{
+		return m_rows;
+	}
+
+	const std::vector<std::string>& coins() const
+	{
+		return m_coins;
+	}
+
+	// Index in coins(), coins().size() if the coin was never recorded
+	size_t find(const std::string& coin) const;
+
+	int64_t time(size_t row) const
+	{
+		return times(row / rows_per_block)[row % rows_per_block];
+	}
+
+	double get(Field field, size_t row) const
+	{
+		return column(row / rows_per_block, field)[row % rows_per_block];
+	}
+
+	double get(size_t coin, CoinField field, size_t row) const
+	{
+		return column(row / rows_per_block, coin, field)[row % rows_per_block];
+	}
+
+	// Columns of a block, rows_per_block values each
+	const int64_t* times(size_t block) const;
+	const double* column(size_t block, Field field) const;
+	const double* column(size_t block, size_t coin, CoinField field) const;
+
+	// First row at or after the time, rows() if there is none
+	size_t lower_bound(int64_t time) const;
+	// Of the rows [from, to)
+	Stats stats(Field field, size_t from, size_t to) const;
+
+private:
+	struct Header;
+	struct Summary;
+
+	const char* block(size_t index) const;
+	const Summary& summary(size_t block) const;
+
+	std::vector<std::string> m_coins;
+	size_t m_rows;
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+};
@@ -0,0 +1,83 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "CoinRegistry.h"
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+using namespace std;
+
+namespace
+{
+	struct Table
+	{
+		mutex lock;
+		unordered_map<string, CoinId> ids;
+		deque<string> names;        // elements never move
+		vector<CoinId> sorted;
+		atomic<size_t> count;
+
+		Table() : count(0)
+		{
+			add("btc");
+		}
+
+		CoinId add(const string& name)
+		{
+			CoinId id = (CoinId)names.size();
+			names.push_back(name);
+			ids[name] = id;
+			auto pos = lower_bound(sorted.begin(), sorted.end(), name,
+				[this](CoinId a, const string& b) { return names[a] < b; });
+			sorted.insert(pos, id);
+			count.store(names.size(), memory_order_release);
+			return id;
+		}
+	};
+
+	Table& table()
+	{
+		static Table t;
+		return t;
+	}
+}
+
+CoinId CoinRegistry::intern(const string& name)
+{
+	Table& t = table();
+	lock_guard<mutex> lock(t.lock);
+	auto it = t.ids.find(name);
+	if (it != t.ids.end())
+		return it->second;
+	return t.add(name);
+}
+
+CoinId CoinRegistry::find(const string& name)
+{
+	Table& t = table();
+	lock_guard<mutex> lock(t.lock);
+	auto it = t.ids.find(name);
+	return (it != t.ids.end()) ? it->second : none;
+}
+
+const string& CoinRegistry::name(CoinId id)
+{
+	static const string unknown;
+	Table& t = table();
+	lock_guard<mutex> lock(t.lock);
+	return (id < t.names.size()) ? t.names[id] : unknown;
+}
+
+size_t CoinRegistry::size()
+{
+	return table().count.load(memory_order_acquire);
+}
+
+vector<CoinId> CoinRegistry::byName()
+{
+	Table& t = table();
+	lock_guard<mutex> lock(t.lock);
+	return t.sorted;
+}
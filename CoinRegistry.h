@@ -0,0 +1,45 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+typedef uint32_t CoinId;
+
+// Process wide table of coin symbols. Every symbol gets a small dense id the
+// first time it is seen, normally while pair metadata is loaded, and keeps it
+// until exit, so per coin data can live in plain arrays indexed by the id.
+// BTC always has id 0. Safe to use from several threads.
+class CoinRegistry
+{
+public:
+	static constexpr CoinId btc = 0;
+	static constexpr CoinId none = ~CoinId(0);
+
+	static CoinId intern(const std::string& name);
+	// Id of a known symbol, none otherwise
+	static CoinId find(const std::string& name);
+	// The reference stays valid until exit
+	static const std::string& name(CoinId id);
+	static size_t size();
+	// All ids ordered by symbol, the order a std::map keyed by symbol has
+	static std::vector<CoinId> byName();
+};
+
+// Element of a per coin array, the array grows to fit the id
+template<class T>
+T& coin_slot(std::vector<T>& values, CoinId id)
+{
+	if (id >= values.size())
+		values.resize(id + 1);
+	return values[id];
+}
+
+// Element of a per coin array, zero for ids past its end
+template<class T>
+T coin_value(const std::vector<T>& values, CoinId id)
+{
+	return (id < values.size()) ? values[id] : T();
+}
@@ -0,0 +1,420 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "ConnectionPool.h"
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include "Metrics.h"
+#include "TraceEvents.h"
+#include <algorithm>
+#include <stdexcept>
+#ifndef _WIN32
+#include <sys/socket.h>
+#endif
+
+using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
+namespace ssl = boost::asio::ssl;       // from <boost/asio/ssl.hpp>
+namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+
+// Idle connections older than this are assumed to be closed by the server
+static const std::chrono::seconds idle_timeout(30);
+// How long resolved addresses are reused
+static const std::chrono::minutes dns_ttl(5);
+// Upper bound of kept alive connections
+static const size_t max_idle = 8;
+
+// Time of each step of a request: dns, connect, tls, write and server, the
+// wait from the written request to the read response
+static Histogram& phase(const char* name)
+{
+	return Metrics::histogram("wex_http_phase_seconds", std::string("phase=\"") + name + "\"");
+}
+
+static Histogram& dns_time = phase("dns");
+static Histogram& connect_time = phase("connect");
+static Histogram& tls_time = phase("tls");
+static Histogram& write_time = phase("write");
+static Histogram& server_time = phase("server");
+
+struct ConnectionPool::Connection
+{
+	ssl::stream<tcp::socket> stream;
+	boost::beast::flat_buffer buffer;
+	std::chrono::steady_clock::time_point used;
+	bool fresh;
+
+	Connection(boost::asio::io_context& ios, ssl::context& ctx) :
+		stream(ios, ctx), fresh(true) {}
+
+	tcp::socket& socket()
+	{
+		return stream.next_layer();
+	}
+
+	void close()
+	{
+		boost::system::error_code ec;
+		stream.next_layer().shutdown(tcp::socket::shutdown_both, ec);
+		stream.next_layer().close(ec);
+	}
+};
+
+static void
+load_root_certificates(ssl::context& ctx)
+{
+	std::string const cert =
+		/*  This is the DigiCert root certificate.
+
+		CN = DigiCert High Assurance EV Root CA
+		OU = www.digicert.com
+		O = DigiCert Inc
+		C = US
+
+		Valid to: Sunday, ?November ?9, ?2031 5:00:00 PM
+
+		Thumbprint(sha1):
+		5f b7 ee 06 33 e2 59 db ad 0c 4c 9a e6 d3 8f 1a 61 c7 dc 25
+		*/
+		"-----BEGIN CERTIFICATE-----\n"
+		"MIIDxTCCAq2gAwIBAgIQAqxcJmoLQJuPC3nyrkYldzANBgkqhkiG9w0BAQUFADBs\n"
+		"MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
+		"d3cuZGlnaWNlcnQuY29tMSswKQYDVQQDEyJEaWdpQ2VydCBIaWdoIEFzc3VyYW5j\n"
+		"ZSBFViBSb290IENBMB4XDTA2MTExMDAwMDAwMFoXDTMxMTExMDAwMDAwMFowbDEL\n"
+		"MAkGA1UEBhMCVVMxFTATBgNVBAoTDERpZ2lDZXJ0IEluYzEZMBcGA1UECxMQd3d3\n"
+		"LmRpZ2ljZXJ0LmNvbTErMCkGA1UEAxMiRGlnaUNlcnQgSGlnaCBBc3N1cmFuY2Ug\n"
+		"RVYgUm9vdCBDQTCCASIwDQYJKoZIhvcNAQEBBQADggEPADCCAQoCggEBAMbM5XPm\n"
+		"+9S75S0tMqbf5YE/yc0lSbZxKsPVlDRnogocsF9ppkCxxLeyj9CYpKlBWTrT3JTW\n"
+		"PNt0OKRKzE0lgvdKpVMSOO7zSW1xkX5jtqumX8OkhPhPYlG++MXs2ziS4wblCJEM\n"
+		"xChBVfvLWokVfnHoNb9Ncgk9vjo4UFt3MRuNs8ckRZqnrG0AFFoEt7oT61EKmEFB\n"
+		"Ik5lYYeBQVCmeVyJ3hlKV9Uu5l0cUyx+mM0aBhakaHPQNAQTXKFx01p8VdteZOE3\n"
+		"hzBWBOURtCmAEvF5OYiiAhF8J2a3iLd48soKqDirCmTCv2ZdlYTBoSUeh10aUAsg\n"
+		"EsxBu24LUTi4S8sCAwEAAaNjMGEwDgYDVR0PAQH/BAQDAgGGMA8GA1UdEwEB/wQF\n"
+		"MAMBAf8wHQYDVR0OBBYEFLE+w2kD+L9HAdSYJhoIAu9jZCvDMB8GA1UdIwQYMBaA\n"
+		"FLE+w2kD+L9HAdSYJhoIAu9jZCvDMA0GCSqGSIb3DQEBBQUAA4IBAQAcGgaX3Nec\n"
+		"nzyIZgYIVyHbIUf4KmeqvxgydkAQV8GK83rZEWWONfqe/EW1ntlMMUu4kehDLI6z\n"
+		"eM7b41N5cdblIZQB2lWHmiRk9opmzN6cN82oNLFpmyPInngiK3BD41VHMWEZ71jF\n"
+		"hS9OMPagMRYjyOfiZRYzy78aG6A9+MpeizGLYAiJLQwGXFK3xPkKmNEVX58Svnw2\n"
+		"Yzi9RKR/5CYrCsSXaQ3pjOLAEFe4yHYSkVXySGnYvCoCWw9E1CAx2/S6cCZdkGCe\n"
+		"vEsXCS+0yx5DaMkHJ8HSXPfqIbloEpw8nL+e/IBcm2PN7EeqJSdnoDfzAIJ9VNep\n"
+		"+OkuE6N36B9K\n"
+		"-----END CERTIFICATE-----\n"
+		/*  This is the GeoTrust root certificate.
+
+		CN = GeoTrust Global CA
+		O = GeoTrust Inc.
+		C = US
+		Valid to: Friday, ‎May ‎20, ‎2022 9:00:00 PM
+
+		Thumbprint(sha1):
+		‎de 28 f4 a4 ff e5 b9 2f a3 c5 03 d1 a3 49 a7 f9 96 2a 82 12
+		*/
+		"-----BEGIN CERTIFICATE-----\n"
+		"MIIDxTCCAq2gAwIBAgIQAqxcJmoLQJuPC3nyrkYldzANBgkqhkiG9w0BAQUFADBs\n"
+		"MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
+		"d3cuZGlnaWNlcnQuY29tMSswKQYDVQQDEyJEaWdpQ2VydCBIaWdoIEFzc3VyYW5j\n"
+		"ZSBFViBSb290IENBMB4XDTA2MTExMDAwMDAwMFoXDTMxMTExMDAwMDAwMFowbDEL\n"
+		"MAkGA1UEBhMCVVMxFTATBgNVBAoTDERpZ2lDZXJ0IEluYzEZMBcGA1UECxMQd3d3\n"
+		"LmRpZ2ljZXJ0LmNvbTErMCkGA1UEAxMiRGlnaUNlcnQgSGlnaCBBc3N1cmFuY2Ug\n"
+		"RVYgUm9vdCBDQTCCASIwDQYJKoZIhvcNAQEBBQADggEPADCCAQoCggEBAMbM5XPm\n"
+		"+9S75S0tMqbf5YE/yc0lSbZxKsPVlDRnogocsF9ppkCxxLeyj9CYpKlBWTrT3JTW\n"
+		"PNt0OKRKzE0lgvdKpVMSOO7zSW1xkX5jtqumX8OkhPhPYlG++MXs2ziS4wblCJEM\n"
+		"xChBVfvLWokVfnHoNb9Ncgk9vjo4UFt3MRuNs8ckRZqnrG0AFFoEt7oT61EKmEFB\n"
+		"Ik5lYYeBQVCmeVyJ3hlKV9Uu5l0cUyx+mM0aBhakaHPQNAQTXKFx01p8VdteZOE3\n"
+		"hzBWBOURtCmAEvF5OYiiAhF8J2a3iLd48soKqDirCmTCv2ZdlYTBoSUeh10aUAsg\n"
+		"EsxBu24LUTi4S8sCAwEAAaNjMGEwDgYDVR0PAQH/BAQDAgGGMA8GA1UdEwEB/wQF\n"
+		"MAMBAf8wHQYDVR0OBBYEFLE+w2kD+L9HAdSYJhoIAu9jZCvDMB8GA1UdIwQYMBaA\n"
+		"FLE+w2kD+L9HAdSYJhoIAu9jZCvDMA0GCSqGSIb3DQEBBQUAA4IBAQAcGgaX3Nec\n"
+		"nzyIZgYIVyHbIUf4KmeqvxgydkAQV8GK83rZEWWONfqe/EW1ntlMMUu4kehDLI6z\n"
+		"eM7b41N5cdblIZQB2lWHmiRk9opmzN6cN82oNLFpmyPInngiK3BD41VHMWEZ71jF\n"
+		"hS9OMPagMRYjyOfiZRYzy78aG6A9+MpeizGLYAiJLQwGXFK3xPkKmNEVX58Svnw2\n"
+		"Yzi9RKR/5CYrCsSXaQ3pjOLAEFe4yHYSkVXySGnYvCoCWw9E1CAx2/S6cCZdkGCe\n"
+		"vEsXCS+0yx5DaMkHJ8HSXPfqIbloEpw8nL+e/IBcm2PN7EeqJSdnoDfzAIJ9VNep\n"
+		"+OkuE6N36B9K\n"
+		"-----END CERTIFICATE-----\n"
+		;
+
+	boost::system::error_code ec;
+	ctx.add_certificate_authority(
+		boost::asio::buffer(cert.data(), cert.size()), ec);
+	if (ec)
+		throw boost::system::system_error{ ec };
+}
+
+ConnectionPool::ConnectionPool(const Endpoint& endpoint) :
+	m_endpoint(endpoint),
+	m_ctx(ssl::context::sslv23_client),
+	m_closed(false),
+	m_session(nullptr)
+{
+	if (m_endpoint.ca_file.empty())
+	{
+		// This holds the root certificate used for verification
+		load_root_certificates(m_ctx);
+	}
+	else
+	{
+		m_ctx.load_verify_file(m_endpoint.ca_file);
+		m_ctx.set_verify_mode(ssl::verify_peer);
+	}
+	SSL_CTX_set_session_cache_mode(m_ctx.native_handle(), SSL_SESS_CACHE_CLIENT);
+}
+
+ConnectionPool::~ConnectionPool()
+{
+	for (auto& conn : m_idle)
+		conn->close();
+	if (m_session)
+		SSL_SESSION_free(m_session);
+}
+
+tcp::resolver::results_type ConnectionPool::resolve()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_endpoints.empty() &&
+			std::chrono::steady_clock::now() - m_resolved < dns_ttl)
+			return m_endpoints;
+	}
+	// Look up the domain name
+	tcp::resolver resolver{ m_ios };
+	tcp::resolver::results_type endpoints;
+	{
+		TraceSpan span("net", "dns");
+		ScopedTimer timer(dns_time);
+		endpoints = resolver.resolve(m_endpoint.host, m_endpoint.port);
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_stats.lookups;
+	m_endpoints = endpoints;
+	m_resolved = std::chrono::steady_clock::now();
+	return endpoints;
+}
+
+static void throw_closed()
+{
+	throw std::runtime_error("Connection pool closed");
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::connect()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_closed)
+			throw_closed();
+	}
+	tcp::resolver::results_type endpoints = resolve();
+	std::unique_ptr<Connection> conn(new Connection(m_ios, m_ctx));
+
+	// Make the connection on the IP address we get from a lookup
+	boost::system::error_code ec;
+	{
+		TraceSpan span("net", "connect");
+		ScopedTimer timer(connect_time);
+		boost::asio::connect(conn->socket(), endpoints, ec);
+	}
+	if (ec)
+	{
+		// Cached addresses may be outdated, resolve again next time
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_endpoints = tcp::resolver::results_type();
+		throw boost::system::system_error{ ec };
+	}
+	conn->socket().set_option(tcp::no_delay(true));
+	if (!m_endpoint.tls)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.connects;
+		return conn;
+	}
+
+	SSL* ssl = conn->stream.native_handle();
+	SSL_set_tlsext_host_name(ssl, m_endpoint.host.c_str());
+	if (!m_endpoint.ca_file.empty())
+		SSL_set1_host(ssl, m_endpoint.host.c_str());
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_session)
+			SSL_set_session(ssl, m_session);
+	}
+
+	// Perform the SSL handshake
+	{
+		TraceSpan span("net", "tls");
+		ScopedTimer timer(tls_time);
+		conn->stream.handshake(ssl::stream_base::client);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_stats.connects;
+	if (SSL_session_reused(ssl))
+		++m_stats.resumed;
+	return conn;
+}
+
+std::unique_ptr<ConnectionPool::Connection> ConnectionPool::acquire(bool& reused)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_closed)
+			throw_closed();
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		while (!m_idle.empty())
+		{
+			std::unique_ptr<Connection> conn = std::move(m_idle.back());
+			m_idle.pop_back();
+			if (now - conn->used > idle_timeout)
+			{
+				conn->close();
+				continue;
+			}
+			++m_stats.reuses;
+			reused = true;
+			return conn;
+		}
+	}
+	reused = false;
+	return connect();
+}
+
+void ConnectionPool::release(std::unique_ptr<Connection> conn)
+{
+	conn->used = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (conn->fresh && m_endpoint.tls)
+	{
+		// Remember the session for resumption. TLS 1.3 tickets arrive after
+		// the handshake, so take it once the first response was read.
+		conn->fresh = false;
+		SSL_SESSION* session = SSL_get1_session(conn->stream.native_handle());
+		if (session)
+		{
+			if (m_session)
+				SSL_SESSION_free(m_session);
+			m_session = session;
+		}
+	}
+	if (m_idle.size() < max_idle && !m_closed)
+		m_idle.push_back(std::move(conn));
+	else
+		conn->close();
+}
+
+// Returns whether the request was written completely
+template<class Stream>
+static bool exchange(Stream& stream, boost::beast::flat_buffer& buffer,
+	ConnectionPool::Request& req, http::response<http::string_body>& res,
+	boost::system::error_code& ec)
+{
+	// Send the HTTP request to the remote host
+	{
+		TraceSpan span("net", "write");
+		ScopedTimer timer(write_time);
+		http::write(stream, req, ec);
+	}
+	if (ec)
+		return false;
+	// Receive the HTTP response
+	TraceSpan span("net", "server");
+	ScopedTimer timer(server_time);
+	http::read(stream, buffer, res, ec);
+	return true;
+}
+
+bool ConnectionPool::exchange(Connection& conn, Request& req,
+	http::response<http::string_body>& res, boost::system::error_code& ec)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_closed)
+		{
+			ec = boost::asio::error::operation_aborted;
+			return false;
+		}
+		m_busy.push_back(&conn);
+	}
+	bool written = m_endpoint.tls ?
+		::exchange(conn.stream, conn.buffer, req, res, ec) :
+		::exchange(conn.socket(), conn.buffer, req, res, ec);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_busy.erase(std::find(m_busy.begin(), m_busy.end(), &conn));
+	return written;
+}
+
+void ConnectionPool::close()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_closed = true;
+	for (auto& conn : m_idle)
+		conn->close();
+	m_idle.clear();
+	// Another thread reads these sockets, only the system call is safe
+	// to make on them: the blocked read returns
+	for (Connection* conn : m_busy)
+	{
+#ifdef _WIN32
+		::shutdown(conn->socket().native_handle(), SD_BOTH);
+#else
+		::shutdown(conn->socket().native_handle(), SHUT_RDWR);
+#endif
+	}
+}
+
+std::string ConnectionPool::perform(Request& req)
+{
+	bool resent;
+	return perform(req, true, resent);
+}
+
+std::string ConnectionPool::perform(Request& req, bool idempotent, bool& resent)
+{
+	req.set(http::field::host, m_endpoint.host);
+	req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
+	req.keep_alive(true);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++m_stats.requests;
+	}
+
+	TraceSpan span("net", "http", std::string_view(req.target().data(), req.target().size()));
+	bool reused = false;
+	std::unique_ptr<Connection> conn = acquire(reused);
+	http::response<http::string_body> res;
+	boost::system::error_code ec;
+	bool written = exchange(*conn, req, res, ec);
+	resent = false;
+	if (ec && reused && (idempotent || !written))
+	{
+		// The server has dropped the idle connection. A request it did not
+		// read in full was not executed, a read-only one may run twice.
+		conn->close();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_stats.reconnects;
+		}
+		++Metrics::counter("wex_retries_total", "kind=\"reconnect\"");
+		conn = connect();
+		res = http::response<http::string_body>();
+		resent = true;
+		exchange(*conn, req, res, ec);
+	}
+	if (ec)
+	{
+		conn->close();
+		++Metrics::counter("wex_errors_total", "kind=\"network\"");
+		throw boost::system::system_error{ ec };
+	}
+
+	if (res.keep_alive())
+		release(std::move(conn));
+	else
+		conn->close();
+	return std::move(res.body());
+}
+
+ConnectionPool::Stats ConnectionPool::stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
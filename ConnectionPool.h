@@ -0,0 +1,90 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+
+// Keeps HTTPS connections to a single host alive between requests.
+// All connections share one SSL context, DNS results are cached and the
+// last TLS session is offered for resumption when a new connection is opened.
+class ConnectionPool
+{
+public:
+	typedef boost::beast::http::request<boost::beast::http::string_body> Request;
+
+	struct Endpoint
+	{
+		std::string host;
+		std::string port;
+		bool tls;
+		// PEM bundle to verify the server with. When empty the built-in
+		// root certificates are used.
+		std::string ca_file;
+
+		Endpoint() : host("wex.nz"), port("443"), tls(true) {}
+	};
+
+	struct Stats
+	{
+		unsigned long long requests;
+		unsigned long long connects;
+		unsigned long long reuses;
+		unsigned long long reconnects;
+		unsigned long long resumed;
+		unsigned long long lookups;
+
+		Stats() : requests(0), connects(0), reuses(0), reconnects(0), resumed(0), lookups(0) {}
+	};
+
+	explicit ConnectionPool(const Endpoint& endpoint);
+	~ConnectionPool();
+
+	// Sends the request and returns the response body. Host, user agent and
+	// keep-alive fields are set by the pool. Safe to call from several threads.
+	std::string perform(Request& req);
+	// A request which fails on an idle connection the server has dropped is
+	// sent once more on a new one. One which is not idempotent is only sent
+	// again when its write failed, after a completed write the server may
+	// have executed it. resent tells whether a second copy went out.
+	std::string perform(Request& req, bool idempotent, bool& resent);
+
+	// Shuts the connections down, those in the middle of a request too, so
+	// the requests fail at once instead of waiting for the server, and
+	// fails the requests which follow. A connect in progress is not cut off.
+	void close();
+
+	Stats stats() const;
+
+private:
+	struct Connection;
+
+	std::unique_ptr<Connection> acquire(bool& reused);
+	void release(std::unique_ptr<Connection> conn);
+	std::unique_ptr<Connection> connect();
+	bool exchange(Connection& conn, Request& req,
+		boost::beast::http::response<boost::beast::http::string_body>& res,
+		boost::system::error_code& ec);
+	boost::asio::ip::tcp::resolver::results_type resolve();
+
+	Endpoint m_endpoint;
+	boost::asio::io_context m_ios;
+	boost::asio::ssl::context m_ctx;
+
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<Connection>> m_idle;
+	std::vector<Connection*> m_busy;    // in an exchange
+	bool m_closed;
+	boost::asio::ip::tcp::resolver::results_type m_endpoints;
+	std::chrono::steady_clock::time_point m_resolved;
+	SSL_SESSION* m_session;
+	Stats m_stats;
+};
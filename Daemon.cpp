@@ -0,0 +1,202 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "Daemon.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "BalanceHistory.h"
+#include <csignal>
+#include "TimerWheel.h"
+#include <functional>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void on_signal(int)
+{
+	stop_requested = 1;
+}
+
+// A stop signal is noticed this soon
+static const chrono::milliseconds signal_check(200);
+
+Daemon::Daemon(WexTradeApi& trade, Portfolio& portfolio, double threshold,
+	unsigned timeout, chrono::seconds interval) :
+	m_trade(trade),
+	m_portfolio(portfolio),
+	m_threshold(threshold),
+	m_timeout(timeout),
+	m_interval(interval),
+	m_poll(trade.first_poll())
+{
+}
+
+void Daemon::run()
+{
+	LOG_SCOPE(INFO, PORTFOLIO, "Daemon::run");
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	// Open orders of an earlier run are tracked like the own ones
+	if (m_trade.journaled())
+	{
+		m_orders = m_trade.recoverOrders(m_timeout);
+		m_placed = chrono::steady_clock::now();
+	}
+	// Cycles are tasks of a timer wheel. While orders are open the next
+	// cycle follows the poll schedule of execute(): a first check soon
+	// after the placement, then twice the wait up to the longest poll, but
+	// never later than the interval.
+	TimerWheel timers;
+	function<void()> tick = [&]()
+	{
+		try
+		{
+			cycle();
+		}
+		catch (const exception& e)
+		{
+			// A failed cycle is retried with fresh data on the next one
+			cerr << e.what() << endl;
+			LOG_WRITE(ERR, PORTFOLIO, e.what());
+		}
+		Metrics::gauge("wex_open_orders", "", (double)m_orders.size());
+		try
+		{
+			Metrics::flush();
+		}
+		catch (const exception& e)
+		{
+			LOG_WRITE(ERR, PORTFOLIO, e.what());
+		}
+		TimerWheel::Clock::duration wait = m_interval;
+		if (!m_orders.empty() || !m_later.empty())
+		{
+			wait = min<TimerWheel::Clock::duration>(m_poll, m_interval);
+			m_poll = min(m_poll * 2, m_trade.max_poll());
+		}
+		timers.after(wait, tick);
+	};
+	// The signal handler can't wake the wheel, a task looks for its flag
+	function<void()> watch = [&]()
+	{
+		if (stop_requested)
+			timers.stop();
+		else
+			timers.after(signal_check, watch);
+	};
+	timers.after(TimerWheel::Clock::duration::zero(), tick);
+	timers.after(signal_check, watch);
+	timers.run();
+	cout << "Stopping, cancel " << m_orders.size() << " open orders" << endl;
+	m_trade.cancelOrders(m_orders);
+	for (const TradeApi::OrderResult& r : m_orders)
+		report(r);
+	dropLater();
+}
+
+void Daemon::cycle()
+{
+	LOG_SCOPE(INFO, PORTFOLIO, "Daemon::cycle");
+	m_trade.refresh();
+	if (!m_orders.empty() || !m_later.empty())
+	{
+		m_trade.checkOrders(m_orders);
+		bool expired = chrono::steady_clock::now() - m_placed > m_timeout;
+		if (expired)
+			m_trade.cancelOrders(m_orders);
+		auto done = [this](const TradeApi::OrderResult& r)
+		{
+			if (r.executed || r.cancelled)
+				report(r);
+			return r.executed || r.cancelled;
+		};
+		m_orders.erase(remove_if(m_orders.begin(), m_orders.end(), done), m_orders.end());
+		if (expired)
+			dropLater();
+		else if (!m_later.empty() && TradeApi::sellsSettled(m_orders))
+		{
+			// The sells have paid for the buys
+			m_trade.refresh();
+			vector<TradeApi::Order> later;
+			later.swap(m_later);
+			place(later);
+		}
+		// Funds of open orders are locked, the drift can't be measured yet
+		if (!m_orders.empty() || !m_later.empty())
+			return;
+		m_trade.refresh();
+	}
+
+	vector<TradeApi::Order> orders = m_portfolio.checkCurrentState(m_trade, m_threshold);
+	Metrics::gauge("wex_portfolio_drift", "", m_portfolio.drift());
+	record();
+	if (orders.empty())
+		return;
+	m_placed = chrono::steady_clock::now();
+	m_poll = m_trade.first_poll();
+	vector<TradeApi::Order> now;
+	TradeApi::splitFunded(orders, coin_value(m_trade.balances(), CoinRegistry::btc), now, m_later);
+	place(now);
+}
+
+void Daemon::place(const vector<TradeApi::Order>& orders)
+{
+	if (orders.empty())
+		return;
+	m_poll = m_trade.first_poll();
+	cout << "Place " << orders.size() << " orders..." << endl;
+	for (const TradeApi::OrderResult& r : m_trade.placeOrders(orders))
+	{
+		if (r.id && !r.executed)
+			m_orders.push_back(r);
+		else
+			report(r);
+	}
+}
+
+// Reports the buys still waiting for the sells as not placed
+void Daemon::dropLater()
+{
+	for (const TradeApi::Order& o : m_later)
+	{
+		TradeApi::OrderResult r;
+		r.order = o;
+		r.error = "Not placed, the sells did not fill in time";
+		report(r);
+	}
+	m_later.clear();
+}
+
+// Adds the balances just checked to the balance log and history
+void Daemon::record()
+{
+	if (!m_balance_log.empty())
+	{
+		double total = 0.0;
+		for (auto b : m_trade.nonZeroBalancesInBTC())
+			total += b.second;
+		ofstream fout(m_balance_log, ofstream::app);
+		if (!fout.is_open())
+			throw runtime_error("Failed to open file " + m_balance_log);
+		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+		double usd_price = m_trade.info("usd").lastPrice;
+		fout << ttp << "," << total << "," << total / usd_price << endl;
+	}
+	if (!m_balance_history.empty())
+		BalanceHistory::append(m_balance_history, BalanceHistory::snapshot(m_trade, m_portfolio.drift()));
+}
+
+void Daemon::report(const TradeApi::OrderResult& r)
+{
+	cout << r.order.coin << ": ";
+	if (r.executed)
+		cout << "executed";
+	else if (r.cancelled)
+		cout << "cancelled";
+	if (!r.error.empty())
+		cout << "error [" << r.error << "]";
+	cout << endl;
+}
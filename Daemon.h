@@ -0,0 +1,55 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include "WexTradeApi.h"
+#include "Portfolio.h"
+
+// Keeps one trade connection and portfolio alive and rebalances whenever
+// the drift exceeds the threshold. Orders placed by the daemon are tracked
+// across cycles, other orders on the account are left alone.
+class Daemon
+{
+public:
+	Daemon(WexTradeApi& trade, Portfolio& portfolio, double threshold,
+		unsigned timeout, std::chrono::seconds interval);
+
+	// Files the balances are added to at every check, as by a single run
+	void set_balance_log(const std::string& path)
+	{
+		m_balance_log = path;
+	}
+
+	void set_balance_history(const std::string& path)
+	{
+		m_balance_history = path;
+	}
+
+	// Runs until SIGINT or SIGTERM, then cancels the orders still open
+	void run();
+
+private:
+	void cycle();
+	void place(const std::vector<TradeApi::Order>& orders);
+	void dropLater();
+	void record();
+	void report(const TradeApi::OrderResult& r);
+
+	WexTradeApi& m_trade;
+	Portfolio& m_portfolio;
+	double m_threshold;
+	std::chrono::minutes m_timeout;
+	std::chrono::seconds m_interval;
+	std::string m_balance_log;
+	std::string m_balance_history;
+
+	std::vector<TradeApi::OrderResult> m_orders;
+	// Buys the BTC on the account can't pay for until the sells settle
+	std::vector<TradeApi::Order> m_later;
+	std::chrono::steady_clock::time_point m_placed;
+	// Wait before the next check of the open orders
+	std::chrono::milliseconds m_poll;
+};
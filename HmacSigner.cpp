@@ -0,0 +1,82 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+
+// The SHA512_* calls are deprecated by OpenSSL 3 in favour of EVP, but
+// their context is a plain struct which is cloned by a copy, where an EVP
+// context would allocate on every duplication
+#define OPENSSL_SUPPRESS_DEPRECATED
+#include "HmacSigner.h"
+#include <openssl/crypto.h>
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+using namespace std;
+
+static const size_t block_size = SHA512_CBLOCK;
+
+// Two hex characters of every byte value
+static constexpr array<char, 512> make_hex_table()
+{
+	array<char, 512> t{};
+	const char digits[] = "0123456789abcdef";
+	for (size_t i = 0; i < 256; ++i)
+	{
+		t[2 * i] = digits[i >> 4];
+		t[2 * i + 1] = digits[i & 15];
+	}
+	return t;
+}
+
+static constexpr array<char, 512> hex_table = make_hex_table();
+
+HmacSigner::HmacSigner(const string& key)
+{
+	unsigned char k[block_size] = {};
+	if (key.size() > block_size)
+		SHA512((const unsigned char*)key.data(), key.size(), k);
+	else
+		memcpy(k, key.data(), key.size());
+	unsigned char pad[block_size];
+	for (size_t i = 0; i < block_size; ++i)
+		pad[i] = k[i] ^ 0x36;
+	SHA512_Init(&m_inner);
+	SHA512_Update(&m_inner, pad, block_size);
+	for (size_t i = 0; i < block_size; ++i)
+		pad[i] = k[i] ^ 0x5c;
+	SHA512_Init(&m_outer);
+	SHA512_Update(&m_outer, pad, block_size);
+	OPENSSL_cleanse(k, sizeof(k));
+	OPENSSL_cleanse(pad, sizeof(pad));
+}
+
+void HmacSigner::hex(const unsigned char* data, size_t size, char* out)
+{
+	for (size_t i = 0; i < size; ++i)
+		memcpy(out + 2 * i, &hex_table[2 * data[i]], 2);
+}
+
+void HmacSigner::sign(string_view body, char* out) const
+{
+	unsigned char digest[SHA512_DIGEST_LENGTH];
+	SHA512_CTX ctx = m_inner;
+	SHA512_Update(&ctx, body.data(), body.size());
+	SHA512_Final(digest, &ctx);
+	ctx = m_outer;
+	SHA512_Update(&ctx, digest, sizeof(digest));
+	SHA512_Final(digest, &ctx);
+	hex(digest, sizeof(digest), out);
+}
+
+string HmacSigner::sign(string_view body) const
+{
+	string res(hex_size, '\0');
+	sign(body, &res[0]);
+	return res;
+}
+
+void HmacSigner::sign(const string_view* bodies, size_t count, char* out) const
+{
+	for (size_t i = 0; i < count; ++i)
+		sign(bodies[i], out + i * hex_size);
+}
@@ -0,0 +1,34 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <openssl/sha.h>
+
+// HMAC-SHA512 of one key, as lowercase hex. The key pads are hashed once
+// in the constructor; a signature copies the two prepared hash states and
+// hashes only the message, so signing allocates nothing. Safe to use from
+// several threads at once.
+class HmacSigner
+{
+public:
+	static const size_t hex_size = 2 * SHA512_DIGEST_LENGTH;
+
+	explicit HmacSigner(const std::string& key);
+
+	// Writes hex_size characters to out, no terminating zero
+	void sign(std::string_view body, char* out) const;
+	std::string sign(std::string_view body) const;
+
+	// Signs count bodies, the signature of body i goes to out + i * hex_size
+	void sign(const std::string_view* bodies, size_t count, char* out) const;
+
+	// Lowercase hex of size bytes into 2 * size characters
+	static void hex(const unsigned char* data, size_t size, char* out);
+
+private:
+	SHA512_CTX m_inner;     // state after the key xor ipad block
+	SHA512_CTX m_outer;     // state after the key xor opad block
+};
@@ -0,0 +1,183 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <charconv>
+#include <stdexcept>
+
+// Pull parser reading JSON text in place. Keys and strings are returned as
+// views into the input, numbers are converted without copying, so walking a
+// document allocates nothing. Escape sequences are left undecoded.
+class JsonReader
+{
+public:
+	JsonReader(const char* begin, const char* end) : m_pos(begin), m_end(end) {}
+	explicit JsonReader(const std::string& text) :
+		m_pos(text.data()), m_end(text.data() + text.size()) {}
+
+	// First non blank character of the next value, 0 at the end of input
+	char peek()
+	{
+		skipBlanks();
+		return m_pos < m_end ? *m_pos : 0;
+	}
+
+	void beginObject()
+	{
+		expect('{');
+		m_first = true;
+	}
+
+	// Reads the next member name and the colon after it.
+	// Returns false and consumes the closing brace when the object ends.
+	bool nextMember(std::string_view& key)
+	{
+		if (peek() == '}')
+		{
+			++m_pos;
+			m_first = false;
+			return false;
+		}
+		if (!m_first)
+			expect(',');
+		key = readString();
+		expect(':');
+		return true;
+	}
+
+	void beginArray()
+	{
+		expect('[');
+		m_first = true;
+	}
+
+	// Returns false and consumes the closing bracket when the array ends
+	bool nextElement()
+	{
+		if (peek() == ']')
+		{
+			++m_pos;
+			m_first = false;
+			return false;
+		}
+		if (!m_first)
+			expect(',');
+		m_first = false;
+		return true;
+	}
+
+	std::string_view readString()
+	{
+		expect('"');
+		const char* start = m_pos;
+		while (m_pos < m_end && *m_pos != '"')
+		{
+			if (*m_pos == '\\')
+				++m_pos;
+			++m_pos;
+		}
+		if (m_pos >= m_end)
+			fail("unterminated string");
+		std::string_view res(start, m_pos - start);
+		++m_pos;
+		m_first = false;
+		return res;
+	}
+
+	// Accepts both plain and quoted numbers
+	double readNumber()
+	{
+		double res = 0.0;
+		readValue(res);
+		return res;
+	}
+
+	long long readInteger()
+	{
+		long long res = 0;
+		readValue(res);
+		return res;
+	}
+
+	// Skips the next value including everything nested in it
+	void skipValue()
+	{
+		char c = peek();
+		if (c == '"')
+		{
+			readString();
+			return;
+		}
+		if (c == '{' || c == '[')
+		{
+			unsigned depth = 0;
+			do
+			{
+				c = *m_pos;
+				if (c == '"')
+				{
+					readString();
+					continue;
+				}
+				if (c == '{' || c == '[')
+					++depth;
+				else if (c == '}' || c == ']')
+					--depth;
+				++m_pos;
+			} while (depth && m_pos < m_end);
+			if (depth)
+				fail("unterminated value");
+			m_first = false;
+			return;
+		}
+		while (m_pos < m_end && *m_pos != ',' && *m_pos != '}' && *m_pos != ']' &&
+			!isBlank(*m_pos))
+			++m_pos;
+		m_first = false;
+	}
+
+private:
+	template<class T>
+	void readValue(T& res)
+	{
+		bool quoted = peek() == '"';
+		if (quoted)
+			++m_pos;
+		std::from_chars_result r = std::from_chars(m_pos, m_end, res);
+		if (r.ec != std::errc())
+			fail("number expected");
+		m_pos = r.ptr;
+		if (quoted)
+			expect('"');
+		m_first = false;
+	}
+
+	static bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	void skipBlanks()
+	{
+		while (m_pos < m_end && isBlank(*m_pos))
+			++m_pos;
+	}
+
+	void expect(char c)
+	{
+		if (peek() != c)
+			fail(std::string("'") + c + "' expected");
+		++m_pos;
+	}
+
+	void fail(const std::string& what)
+	{
+		throw std::runtime_error("Invalid JSON: " + what);
+	}
+
+	const char* m_pos;
+	const char* m_end;
+	bool m_first = true;
+};
@@ -1,31 +1,401 @@
-#include "Log.h"
-#include <fstream>
-#include <cstdarg>
-#include <boost/format.hpp>
-
-const char* log_file = "polo.log";
-
-Log::Log(const std::string& label):
-	label_(label)
-{
-	std::ofstream f(log_file, std::ios_base::app | std::ofstream::out);
-	f << label_ << " opened" << std::endl;
-}
-
-
-Log::~Log()
-{
-	std::ofstream f(log_file, std::ios_base::app | std::ofstream::out);
-	f << label_ << " closed" << std::endl;
-}
-
-void Log::init()
-{
-	std::ofstream f(log_file, std::ios_base::trunc | std::ofstream::out);
-}
-
-void Log::write(const std::string& msg)
-{
-	std::ofstream f(log_file, std::ios_base::app | std::ofstream::out);
-	f << '\t' << msg << std::endl;
-}
+#include "Log.h"
+#include "RingBuffer.h"
+#include "TraceEvents.h"
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+const char* log_file = "polo.log";
+
+namespace
+{
+
+// Ends a record cut at its capacity
+const char truncated[] = " [truncated]";
+
+struct Record
+{
+	static const size_t capacity = 500;
+
+	unsigned file;
+	unsigned length;
+	char text[capacity];
+};
+
+struct File
+{
+	std::string path;
+	std::FILE* f;
+	int fd;             // of f, for the crash dump
+	size_t size;
+	std::string pending;
+	std::atomic<bool> truncate;
+
+	File() : f(nullptr), fd(-1), size(0), truncate(false) {}
+};
+
+static int descriptor(std::FILE* f)
+{
+	return f ? fileno(f) : -1;
+}
+
+static void open_file(File& file, const char* mode)
+{
+	file.f = std::fopen(file.path.c_str(), mode);
+	file.fd = descriptor(file.f);
+	file.size = 0;
+	if (file.f)
+	{
+		std::fseek(file.f, 0, SEEK_END);
+		file.size = std::ftell(file.f);
+	}
+}
+
+// Plain write(2), which may be called from a signal handler
+static void write_fd(int fd, const char* data, size_t size)
+{
+#ifdef _WIN32
+	_write(fd, data, (unsigned)size);
+#else
+	while (size)
+	{
+		ssize_t n = ::write(fd, data, size);
+		if (n <= 0)
+			return;
+		data += n;
+		size -= n;
+	}
+#endif
+}
+
+// Records are formatted by the calling thread into a lock-free ring and
+// written by a background thread in batches, one write per file and batch.
+class Backend
+{
+public:
+	// Files are kept in blocks allocated as the table grows, so the writer
+	// thread reads them without a lock while another file is added
+	static const unsigned block_size = 64;
+	static const unsigned max_blocks = 64;
+	static const unsigned max_files = block_size * max_blocks;
+
+	Backend() : m_count(0), m_stop(false), m_requested(0), m_written(0)
+	{
+		// The main log keeps slot 0 even when it can't be opened yet
+		m_blocks[0].reset(new File[block_size]);
+		file(0).path = log_file;
+		open_file(file(0), "ab");
+		m_count.store(1, std::memory_order_release);
+		m_thread = std::thread([this]() { run(); });
+		s_instance.store(this, std::memory_order_release);
+	}
+
+	~Backend()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		m_thread.join();
+		s_instance.store(nullptr, std::memory_order_release);
+		drain();
+		for (unsigned i = 0; i < m_count; ++i)
+			if (file(i).f)
+				std::fclose(file(i).f);
+	}
+
+	void configure(const Log::Config& config)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_config = config;
+	}
+
+	int open(const std::string& path, bool truncate)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		unsigned count = m_count.load(std::memory_order_relaxed);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			if (file(i).path == path)
+			{
+				if (truncate)
+					file(i).truncate.store(true);
+				return i;
+			}
+		}
+		if (count == max_files)
+			return -1;
+		std::unique_ptr<File[]>& block = m_blocks[count / block_size];
+		if (!block)
+			block.reset(new File[block_size]);
+		File& f = file(count);
+		f.path = path;
+		open_file(f, truncate ? "wb" : "ab");
+		// A file which can't be opened takes no slot
+		if (!f.f)
+			return -1;
+		m_count.store(count + 1, std::memory_order_release);
+		return count;
+	}
+
+	void push(unsigned file, const char* prefix, const std::string& text, const char* suffix)
+	{
+		size_t plen = std::strlen(prefix), slen = std::strlen(suffix);
+		while (!m_ring.push([&](Record& r)
+			{
+				size_t room = Record::capacity - plen - slen;
+				size_t len = text.size() <= room ? text.size() : room - (sizeof(truncated) - 1);
+				r.file = file;
+				char* p = r.text;
+				std::memcpy(p, prefix, plen);
+				p += plen;
+				std::memcpy(p, text.data(), len);
+				p += len;
+				if (len < text.size())
+				{
+					std::memcpy(p, truncated, sizeof(truncated) - 1);
+					p += sizeof(truncated) - 1;
+				}
+				std::memcpy(p, suffix, slen);
+				r.length = (unsigned)(p + slen - r.text);
+			}))
+		{
+			// The writer is behind, wake it up and wait for free space
+			m_wake.notify_one();
+			std::this_thread::yield();
+		}
+	}
+
+	void flush()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		unsigned long long ticket = ++m_requested;
+		m_wake.notify_all();
+		m_done.wait(lock, [&]() { return m_written >= ticket || m_stop; });
+	}
+
+	// Writes out everything queued so far. Only one thread drains at a time.
+	void drain()
+	{
+		while (m_draining.test_and_set(std::memory_order_acquire))
+			std::this_thread::yield();
+		Log::Config config;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			config = m_config;
+		}
+		unsigned count = m_count.load(std::memory_order_acquire);
+		for (unsigned i = 0; i < count; ++i)
+		{
+			File& f = file(i);
+			if (f.truncate.exchange(false) && f.f)
+			{
+				f.f = std::freopen(f.path.c_str(), "wb", f.f);
+				f.fd = descriptor(f.f);
+				f.size = 0;
+			}
+		}
+		while (m_ring.pop([&](const Record& r)
+			{
+				if (r.file < count)
+					file(r.file).pending.append(r.text, r.length);
+			}))
+			;
+		for (unsigned i = 0; i < count; ++i)
+			write(file(i), config);
+		m_draining.clear(std::memory_order_release);
+	}
+
+	// Writes the queued records to their files with write(2) and takes no
+	// lock and no memory, for the handler of a fatal signal. Gives up when
+	// the writer thread holds the ring, the records it took are lost.
+	static void dump()
+	{
+		Backend* b = s_instance.load(std::memory_order_acquire);
+		if (!b || b->m_draining.test_and_set(std::memory_order_acquire))
+			return;
+		unsigned count = b->m_count.load(std::memory_order_acquire);
+		while (b->m_ring.pop([&](const Record& r)
+			{
+				if (r.file < count && b->file(r.file).fd >= 0)
+					write_fd(b->file(r.file).fd, r.text, r.length);
+			}))
+			;
+		b->m_draining.clear(std::memory_order_release);
+	}
+
+private:
+	void run()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (!m_stop)
+		{
+			if (m_written == m_requested)
+				m_wake.wait_for(lock, std::chrono::milliseconds(m_config.flush_interval_ms));
+			// Everything queued before this flush request is drained below
+			unsigned long long ticket = m_requested;
+			lock.unlock();
+			drain();
+			lock.lock();
+			m_written = ticket;
+			m_done.notify_all();
+		}
+		m_done.notify_all();
+	}
+
+	void write(File& file, const Log::Config& config)
+	{
+		if (file.pending.empty())
+			return;
+		// A file which failed to open or to rotate is opened again with
+		// every batch, the records are dropped while it can't be
+		if (!file.f)
+			open_file(file, "ab");
+		if (file.f && config.max_file_size && file.size + file.pending.size() > config.max_file_size)
+			rotate(file, config);
+		if (!file.f)
+		{
+			file.pending.clear();
+			return;
+		}
+		std::fwrite(file.pending.data(), 1, file.pending.size(), file.f);
+		std::fflush(file.f);
+#ifndef _WIN32
+		if (config.sync)
+			fdatasync(fileno(file.f));
+#endif
+		file.size += file.pending.size();
+		file.pending.clear();
+	}
+
+	void rotate(File& file, const Log::Config& config)
+	{
+		std::fclose(file.f);
+		for (unsigned n = config.max_files; n > 1; --n)
+		{
+			std::string from = file.path + "." + std::to_string(n - 1);
+			std::string to = file.path + "." + std::to_string(n);
+			std::remove(to.c_str());
+			std::rename(from.c_str(), to.c_str());
+		}
+		if (config.max_files)
+		{
+			std::string to = file.path + ".1";
+			std::remove(to.c_str());
+			std::rename(file.path.c_str(), to.c_str());
+		}
+		open_file(file, "wb");
+	}
+
+	File& file(unsigned i)
+	{
+		return m_blocks[i / block_size][i % block_size];
+	}
+
+	static std::atomic<Backend*> s_instance;
+
+	RingBuffer<Record, 2048> m_ring;
+	std::unique_ptr<File[]> m_blocks[max_blocks];
+	std::atomic<unsigned> m_count;
+	std::atomic_flag m_draining = ATOMIC_FLAG_INIT;
+
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_done;
+	Log::Config m_config;
+	bool m_stop;
+	unsigned long long m_requested;
+	unsigned long long m_written;
+	std::thread m_thread;
+};
+
+std::atomic<Backend*> Backend::s_instance{ nullptr };
+
+Backend& backend()
+{
+	static Backend instance;
+	return instance;
+}
+
+}
+
+Log::Log(const std::string& label):
+	label_(label),
+	span_(nullptr)
+{
+	backend().push(0, "", label_, " opened\n");
+}
+
+Log::Log(const std::string& label, Category category):
+	label_(label),
+	span_(nullptr)
+{
+	if (TraceEvents::enabled())
+	{
+		switch (category)
+		{
+		case API: span_ = "api"; break;
+		case ORDERS: span_ = "orders"; break;
+		case NET: span_ = "net"; break;
+		case SIGN: span_ = "sign"; break;
+		case PORTFOLIO: span_ = "portfolio"; break;
+		}
+		start_ = std::chrono::steady_clock::now();
+	}
+	backend().push(0, "", label_, " opened\n");
+}
+
+Log::~Log()
+{
+	if (span_)
+		TraceEvents::complete(span_, label_, start_, std::chrono::steady_clock::now());
+	backend().push(0, "", label_, " closed\n");
+}
+
+void Log::init()
+{
+	backend().open(log_file, true);
+}
+
+void Log::configure(const Config& config)
+{
+	backend().configure(config);
+}
+
+void Log::write(const std::string& msg)
+{
+	backend().push(0, "\t", msg, "\n");
+}
+
+int Log::open(const std::string& path)
+{
+	return backend().open(path, false);
+}
+
+void Log::write(int file, const std::string& text)
+{
+	if (file >= 0)
+		backend().push(file, "", text, "");
+}
+
+void Log::flush()
+{
+	backend().flush();
+}
+
+void Log::flush_on_crash()
+{
+	Backend::dump();
+}
@@ -1,16 +1,130 @@
-#pragma once
-
-#include <string>
-
-
-class Log
-{
-	std::string label_;
-public:
-	Log(const std::string& label);
-	~Log();
-
-	static void init();
-	static void write(const std::string& msg);
-};
-
+#pragma once
+
+#include <string>
+#include <chrono>
+
+// Trace points above this level are compiled out: 0 errors, 1 info, 2 debug, 3 trace
+#ifndef WEX_TRACE_LEVEL
+#define WEX_TRACE_LEVEL 1
+#endif
+// Bit mask of Log::Category values compiled in
+#ifndef WEX_TRACE_CATEGORIES
+#define WEX_TRACE_CATEGORIES 0xff
+#endif
+
+class Log
+{
+	std::string label_;
+	const char* span_;
+	std::chrono::steady_clock::time_point start_;
+public:
+	enum Level
+	{
+		ERR = 0,
+		INFO = 1,
+		DEBUG = 2,
+		TRACE = 3
+	};
+
+	enum Category
+	{
+		API = 1,        // TradeApi entry points
+		ORDERS = 2,     // order placement, polling and cancellation
+		NET = 4,        // HTTP requests
+		SIGN = 8,       // request bodies and signatures
+		PORTFOLIO = 16
+	};
+
+	struct Config
+	{
+		// Longest time a record waits in memory before it is written
+		unsigned flush_interval_ms;
+		// Sync files to disk after every written batch
+		bool sync;
+		// Rotate a file once it grows past this size, 0 disables rotation
+		size_t max_file_size;
+		// Number of rotated files kept as name.1 .. name.N
+		unsigned max_files;
+
+		Config() : flush_interval_ms(50), sync(false), max_file_size(0), max_files(3) {}
+	};
+
+	Log(const std::string& label);
+	// Also recorded as a span of the category when TraceEvents are enabled
+	Log(const std::string& label, Category category);
+	~Log();
+
+	static void init();
+	static void configure(const Config& config);
+	static void write(const std::string& msg);
+
+	// Opens an additional log file, records passed to write(file, text)
+	// are stored as is. Opening a path again returns the same file, -1
+	// when the file can't be opened.
+	static int open(const std::string& path);
+	static void write(int file, const std::string& text);
+
+	// Writes all queued records and waits until they reach the files
+	static void flush();
+	// Writes the queued records with nothing but write(2), for the handler
+	// of a fatal signal which the application installs. Records the writer
+	// thread is busy with at that moment are lost.
+	static void flush_on_crash();
+};
+
+// Trace point fixed at compile time. Disabled ones are empty classes whose
+// members ignore their argument, so the message is never built.
+template<Log::Level L, Log::Category C,
+	bool Enabled = (L <= WEX_TRACE_LEVEL) && ((C & WEX_TRACE_CATEGORIES) != 0)>
+class Trace
+{
+	Log log_;
+public:
+	static const bool enabled = true;
+
+	template<class F>
+	explicit Trace(F label) : log_(label(), C) {}
+
+	template<class F>
+	static void write(F msg)
+	{
+		Log::write(msg());
+	}
+
+	// For keys and signatures, which are only ever written by debug builds
+	template<class F>
+	static void secret(F msg)
+	{
+		static_assert(L >= Log::DEBUG, "secrets may only be traced at debug level or below");
+		Log::write(msg());
+	}
+};
+
+template<Log::Level L, Log::Category C>
+class Trace<L, C, false>
+{
+public:
+	static const bool enabled = false;
+
+	template<class F>
+	explicit Trace(F) {}
+
+	template<class F>
+	static void write(F) {}
+
+	template<class F>
+	static void secret(F)
+	{
+		static_assert(L >= Log::DEBUG, "secrets may only be traced at debug level or below");
+	}
+};
+
+#define LOG_CONCAT_(a, b) a##b
+#define LOG_CONCAT(a, b) LOG_CONCAT_(a, b)
+// Logs opening and closing of the enclosing scope
+#define LOG_SCOPE(level, category, label) \
+	Trace<Log::level, Log::category> LOG_CONCAT(log_scope_, __LINE__)([&]() { return std::string(label); })
+#define LOG_WRITE(level, category, msg) \
+	Trace<Log::level, Log::category>::write([&]() { return std::string(msg); })
+#define LOG_SECRET(level, category, msg) \
+	Trace<Log::level, Log::category>::secret([&]() { return std::string(msg); })
@@ -0,0 +1,142 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "MetadataCache.h"
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <boost/interprocess/exceptions.hpp>
+
+namespace bip = boost::interprocess;
+using namespace std;
+
+static const char magic[8] = { 'W', 'E', 'X', 'M', 'E', 'T', 'A', 0 };
+static const uint32_t version = 1;
+
+struct MetadataCache::Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t count;
+	int64_t saved;      // unix time
+};
+
+struct MetadataCache::Record
+{
+	char pair[24];      // pair name, the coin follows from it
+	char coin[16];
+	uint32_t decimal_places;
+	uint32_t reverted;
+	double min;
+	double max;
+	double fee;
+	double min_amount;
+};
+
+MetadataCache::MetadataCache(const string& path) :
+	m_path(path)
+{
+}
+
+bool MetadataCache::open()
+{
+	try
+	{
+		bip::file_mapping file(m_path.c_str(), bip::read_only);
+		bip::mapped_region region(file, bip::read_only);
+		if (region.get_size() < sizeof(Header))
+			return false;
+		const Header* h = static_cast<const Header*>(region.get_address());
+		if (memcmp(h->magic, magic, sizeof(magic)) || h->version != version ||
+			region.get_size() < sizeof(Header) + h->count * sizeof(Record))
+			return false;
+		m_file.swap(file);
+		m_region.swap(region);
+		return true;
+	}
+	catch (const bip::interprocess_exception&)
+	{
+		return false;
+	}
+}
+
+chrono::seconds MetadataCache::age() const
+{
+	const Header* h = static_cast<const Header*>(m_region.get_address());
+	chrono::system_clock::time_point saved = chrono::system_clock::from_time_t(h->saved);
+	return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now() - saved);
+}
+
+void MetadataCache::read(vector<TradeApi::PairParams>& params,
+	vector<string>& pairs) const
+{
+	const Header* h = static_cast<const Header*>(m_region.get_address());
+	const Record* r = reinterpret_cast<const Record*>(h + 1);
+	for (uint32_t i = 0; i < h->count; ++i, ++r)
+	{
+		TradeApi::PairParams& p = coin_slot(params, CoinRegistry::intern(r->coin));
+		p.decimal_places = r->decimal_places;
+		p.reverted = r->reverted != 0;
+		p.min = r->min;
+		p.max = r->max;
+		p.fee = r->fee;
+		p.min_amount = r->min_amount;
+		pairs.push_back(r->pair);
+	}
+}
+
+// Copies a name into a fixed field, names which do not fit are an error
+static void copy_name(char* dst, size_t size, const string& src)
+{
+	if (src.size() >= size)
+		throw runtime_error("Name too long for metadata cache: " + src);
+	memset(dst, 0, size);
+	memcpy(dst, src.data(), src.size());
+}
+
+void MetadataCache::save(const vector<TradeApi::PairParams>& params,
+	const vector<string>& pairs) const
+{
+	vector<Record> records;
+	for (const string& pair : pairs)
+	{
+		string coin = (pair.substr(0, 4) == "btc_") ? pair.substr(4) : pair.substr(0, pair.find('_'));
+		CoinId id = CoinRegistry::find(coin);
+		if (id >= params.size())
+			continue;
+		const TradeApi::PairParams& p = params[id];
+		Record r;
+		memset(&r, 0, sizeof(r));
+		copy_name(r.pair, sizeof(r.pair), pair);
+		copy_name(r.coin, sizeof(r.coin), coin);
+		r.decimal_places = p.decimal_places;
+		r.reverted = p.reverted;
+		r.min = p.min;
+		r.max = p.max;
+		r.fee = p.fee;
+		r.min_amount = p.min_amount;
+		records.push_back(r);
+	}
+	Header h;
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = version;
+	h.count = (uint32_t)records.size();
+	h.saved = (int64_t)chrono::system_clock::to_time_t(chrono::system_clock::now());
+
+	string tmp = m_path + ".tmp";
+	{
+		ofstream f(tmp, ios::binary | ios::trunc);
+		if (!f.is_open())
+			throw runtime_error("Failed to open file " + tmp);
+		f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		f.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+		if (!f)
+			throw runtime_error("Failed to write file " + tmp);
+	}
+#ifdef _WIN32
+	remove(m_path.c_str());
+#endif
+	if (rename(tmp.c_str(), m_path.c_str()))
+		throw runtime_error("Failed to rename " + tmp);
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include "TradeApi.h"
+
+// Binary snapshot of the exchange pair parameters. It is written after a
+// successful /api/3/info request and memory mapped by later runs, which
+// then neither download nor parse the pair list.
+class MetadataCache
+{
+public:
+	explicit MetadataCache(const std::string& path);
+
+	// Maps the snapshot. Returns false if it is missing, truncated or
+	// written by another format version.
+	bool open();
+
+	// Time since the mapped snapshot was written
+	std::chrono::seconds age() const;
+
+	// Parameters are stored at the CoinRegistry ids of the coins
+	void read(std::vector<TradeApi::PairParams>& params,
+		std::vector<std::string>& pairs) const;
+
+	// Writes a new snapshot to a temporary file and renames it over the old one
+	void save(const std::vector<TradeApi::PairParams>& params,
+		const std::vector<std::string>& pairs) const;
+
+private:
+	struct Header;
+	struct Record;
+
+	std::string m_path;
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+};
@@ -0,0 +1,286 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "Metrics.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+Histogram::Histogram() :
+	m_count(0), m_sum(0), m_max(0)
+{
+	for (auto& c : m_counts)
+		c.store(0, memory_order_relaxed);
+}
+
+size_t Histogram::index(uint64_t us)
+{
+	if (us < sub_buckets)
+		return (size_t)us;
+	unsigned msb = 63 - __builtin_clzll(us);
+	unsigned shift = msb - sub_bits;
+	size_t i = (shift + 1) * sub_buckets + (size_t)(us >> shift) - sub_buckets;
+	return min(i, buckets - 1);
+}
+
+uint64_t Histogram::upper(size_t i)
+{
+	if (i < sub_buckets)
+		return i;
+	unsigned shift = (unsigned)(i / sub_buckets) - 1;
+	uint64_t sub = i % sub_buckets + sub_buckets;
+	return ((sub + 1) << shift) - 1;
+}
+
+void Histogram::record(chrono::steady_clock::duration value)
+{
+	int64_t us = chrono::duration_cast<chrono::microseconds>(value).count();
+	uint64_t v = us > 0 ? (uint64_t)us : 0;
+	m_counts[index(v)].fetch_add(1, memory_order_relaxed);
+	m_count.fetch_add(1, memory_order_relaxed);
+	m_sum.fetch_add(v, memory_order_relaxed);
+	uint64_t max = m_max.load(memory_order_relaxed);
+	while (v > max && !m_max.compare_exchange_weak(max, v, memory_order_relaxed))
+		;
+}
+
+uint64_t Histogram::count() const
+{
+	return m_count.load(memory_order_relaxed);
+}
+
+chrono::microseconds Histogram::sum() const
+{
+	return chrono::microseconds(m_sum.load(memory_order_relaxed));
+}
+
+chrono::microseconds Histogram::max() const
+{
+	return chrono::microseconds(m_max.load(memory_order_relaxed));
+}
+
+chrono::microseconds Histogram::quantile(double q) const
+{
+	uint64_t total = count();
+	if (!total)
+		return chrono::microseconds(0);
+	uint64_t rank = std::max<uint64_t>(1, (uint64_t)ceil(q * total));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets; ++i)
+	{
+		seen += m_counts[i].load(memory_order_relaxed);
+		if (seen >= rank)
+			return chrono::microseconds(min(upper(i), (uint64_t)max().count()));
+	}
+	return max();
+}
+
+uint64_t Histogram::countBelow(chrono::microseconds limit) const
+{
+	uint64_t n = 0;
+	for (size_t i = 0; i < buckets && upper(i) <= (uint64_t)limit.count(); ++i)
+		n += m_counts[i].load(memory_order_relaxed);
+	return n;
+}
+
+namespace
+{
+	typedef pair<string, string> Key;   // name, labels
+
+	struct Registry
+	{
+		mutex lock;
+		map<Key, unique_ptr<Histogram>> histograms;
+		map<Key, unique_ptr<atomic<uint64_t>>> counters;
+		map<Key, double> gauges;
+		string textfile;
+	};
+
+	Registry& registry()
+	{
+		static Registry r;
+		return r;
+	}
+
+	string series(const Key& k, const string& suffix = string(), const string& extra = string())
+	{
+		string labels = k.second;
+		if (!extra.empty())
+			labels += (labels.empty() ? "" : ",") + extra;
+		return k.first + suffix + (labels.empty() ? "" : "{" + labels + "}");
+	}
+
+	// Bucket bounds of the exported histograms, in seconds
+	const double bounds[] = { 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+		0.25, 0.5, 1, 2.5, 5, 10, 30 };
+	const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+}
+
+Histogram& Metrics::histogram(const string& name, const string& labels)
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	unique_ptr<Histogram>& h = r.histograms[Key(name, labels)];
+	if (!h)
+		h.reset(new Histogram());
+	return *h;
+}
+
+atomic<uint64_t>& Metrics::counter(const string& name, const string& labels)
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	unique_ptr<atomic<uint64_t>>& c = r.counters[Key(name, labels)];
+	if (!c)
+		c.reset(new atomic<uint64_t>(0));
+	return *c;
+}
+
+void Metrics::gauge(const string& name, const string& labels, double value)
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	r.gauges[Key(name, labels)] = value;
+}
+
+string Metrics::label(const string& name, const string& value)
+{
+	string res = name + "=\"";
+	for (char c : value)
+	{
+		if (c == '"' || c == '\\')
+			res += '\\';
+		res += (c == '\n') ? ' ' : c;
+	}
+	return res + "\"";
+}
+
+void Metrics::set_textfile(const string& path)
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	r.textfile = path;
+}
+
+void Metrics::write(ostream& os)
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	os << setprecision(9);
+	string last;
+	for (const auto& h : r.histograms)
+	{
+		const Key& k = h.first;
+		const Histogram& hist = *h.second;
+		if (k.first != last)
+			os << "# TYPE " << k.first << " histogram" << endl;
+		for (double b : bounds)
+		{
+			ostringstream le;
+			le << "le=\"" << b << "\"";
+			chrono::microseconds limit((long long)llround(b * 1e6));
+			os << series(k, "_bucket", le.str()) << " " << hist.countBelow(limit) << endl;
+		}
+		os << series(k, "_bucket", "le=\"+Inf\"") << " " << hist.count() << endl;
+		os << series(k, "_sum") << " " << hist.sum().count() / 1e6 << endl;
+		os << series(k, "_count") << " " << hist.count() << endl;
+		last = k.first;
+	}
+	// Quantiles from the full resolution buckets, for alerts on the tail
+	last.clear();
+	for (const auto& h : r.histograms)
+	{
+		const Key& k = h.first;
+		if (k.first != last)
+			os << "# TYPE " << k.first << "_quantile gauge" << endl;
+		for (double q : quantiles)
+		{
+			ostringstream label;
+			label << "quantile=\"" << q << "\"";
+			os << series(k, "_quantile", label.str()) << " " << h.second->quantile(q).count() / 1e6 << endl;
+		}
+		last = k.first;
+	}
+	last.clear();
+	for (const auto& c : r.counters)
+	{
+		if (c.first.first != last)
+			os << "# TYPE " << c.first.first << " counter" << endl;
+		os << series(c.first) << " " << c.second->load() << endl;
+		last = c.first.first;
+	}
+	last.clear();
+	for (const auto& g : r.gauges)
+	{
+		if (g.first.first != last)
+			os << "# TYPE " << g.first.first << " gauge" << endl;
+		os << series(g.first) << " " << g.second << endl;
+		last = g.first.first;
+	}
+}
+
+void Metrics::flush()
+{
+	string path;
+	{
+		Registry& r = registry();
+		lock_guard<mutex> lock(r.lock);
+		path = r.textfile;
+	}
+	if (path.empty())
+		return;
+	string tmp = path + ".tmp";
+	{
+		ofstream f(tmp, ios::trunc);
+		if (!f.is_open())
+			throw runtime_error("Failed to open file " + tmp);
+		write(f);
+		if (!f)
+			throw runtime_error("Failed to write file " + tmp);
+	}
+	if (rename(tmp.c_str(), path.c_str()) != 0)
+		throw runtime_error("Failed to replace file " + path);
+}
+
+string Metrics::summary()
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	ostringstream os;
+	bool recorded = false;
+	for (const auto& h : r.histograms)
+		recorded = recorded || h.second->count();
+	if (recorded)
+	{
+		os << left << setw(52) << "Latency, ms" << right << setw(8) << "count"
+			<< setw(9) << "p50" << setw(9) << "p90" << setw(9) << "p99" << setw(9) << "p99.9"
+			<< setw(9) << "max" << endl;
+		os << fixed << setprecision(2);
+		for (const auto& h : r.histograms)
+		{
+			const Histogram& hist = *h.second;
+			if (!hist.count())
+				continue;
+			os << left << setw(52) << series(h.first) << right << setw(8) << hist.count();
+			for (double q : quantiles)
+				os << setw(9) << hist.quantile(q).count() / 1000.0;
+			os << setw(9) << hist.max().count() / 1000.0 << endl;
+		}
+	}
+	for (const auto& c : r.counters)
+	{
+		if (c.second->load())
+			os << left << setw(52) << series(c.first) << right << setw(8) << c.second->load() << endl;
+	}
+	os << defaultfloat << setprecision(6);
+	for (const auto& g : r.gauges)
+		os << left << setw(52) << series(g.first) << right << setw(8) << g.second << endl;
+	return os.str();
+}
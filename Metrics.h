@@ -0,0 +1,80 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Latency distribution with about 3% resolution from a microsecond to a
+// few days. Values up to 32 us have a bucket each, above that every power
+// of two is split into 32 linear buckets, as HdrHistogram does. Recording
+// is a few relaxed atomic additions, so any thread may record at any time.
+class Histogram
+{
+public:
+	Histogram();
+
+	void record(std::chrono::steady_clock::duration value);
+
+	uint64_t count() const;
+	std::chrono::microseconds sum() const;
+	std::chrono::microseconds max() const;
+	// Upper bound of the bucket holding the q-th quantile, 0 <= q <= 1
+	std::chrono::microseconds quantile(double q) const;
+	// Values recorded in buckets which end at or below limit
+	uint64_t countBelow(std::chrono::microseconds limit) const;
+
+private:
+	static const unsigned sub_bits = 5;
+	static const size_t sub_buckets = 1 << sub_bits;
+	static const size_t buckets = 38 * sub_buckets;
+
+	static size_t index(uint64_t us);
+	static uint64_t upper(size_t index);
+
+	std::atomic<uint64_t> m_counts[buckets];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_max;
+};
+
+// Process wide registry of histograms, counters and gauges in the
+// Prometheus data model. A metric is a name and a label set such as
+// method="Trade"; it is created on first use and lives until exit, so
+// callers may keep the returned reference.
+class Metrics
+{
+public:
+	static Histogram& histogram(const std::string& name, const std::string& labels = std::string());
+	static std::atomic<uint64_t>& counter(const std::string& name, const std::string& labels = std::string());
+	static void gauge(const std::string& name, const std::string& labels, double value);
+	// name="value" with the quotes and backslashes of value escaped
+	static std::string label(const std::string& name, const std::string& value);
+
+	// File flush() writes in the node exporter textfile format, empty for none
+	static void set_textfile(const std::string& path);
+	// Writes the textfile if one is set. The file is replaced by a rename,
+	// so the exporter never reads half of it.
+	static void flush();
+	static void write(std::ostream& os);
+
+	// Human readable table of the histograms and counters for the CLI
+	static std::string summary();
+};
+
+// Records the time from construction to destruction
+class ScopedTimer
+{
+public:
+	explicit ScopedTimer(Histogram& h) : m_histogram(h), m_start(std::chrono::steady_clock::now()) {}
+	~ScopedTimer()
+	{
+		m_histogram.record(std::chrono::steady_clock::now() - m_start);
+	}
+
+private:
+	Histogram& m_histogram;
+	std::chrono::steady_clock::time_point m_start;
+};
@@ -0,0 +1,105 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "NonceSequencer.h"
+#include <ctime>
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+
+namespace bip = boost::interprocess;
+using namespace std;
+
+// "WEXNONC1" little endian, the version is part of it
+static const uint64_t magic = 0x31434e4f4e584557ull;
+static const size_t slots = 255;
+// The exchange takes nonces up to 4294967294
+static const uint64_t max_nonce = 4294967294ull;
+
+struct NonceSequencer::Header
+{
+	atomic<uint64_t> magic;
+	uint64_t reserved;
+};
+
+// A key is claimed by storing the hash of it in an empty slot
+struct NonceSequencer::Slot
+{
+	atomic<uint64_t> key;
+	atomic<uint64_t> nonce;
+};
+
+static const size_t file_size = sizeof(uint64_t) * 2 * (slots + 1);
+
+// FNV-1a, zero marks an empty slot
+static uint64_t key_hash(const string& key)
+{
+	uint64_t h = 14695981039346656037ull;
+	for (unsigned char c : key)
+		h = (h ^ c) * 1099511628211ull;
+	return h ? h : 1;
+}
+
+NonceSequencer::NonceSequencer() :
+	m_local(0),
+	m_counter(&m_local)
+{
+	raise(time(0));
+}
+
+NonceSequencer::NonceSequencer(const string& path, const string& key) :
+	m_local(0),
+	m_counter(nullptr)
+{
+	static_assert(sizeof(Header) == 2 * sizeof(uint64_t) && sizeof(Slot) == 2 * sizeof(uint64_t),
+		"the file layout is two words per entry");
+	{
+		// Appending creates the file without touching a present one.
+		// Processes growing it at the same time agree on the size and
+		// the new bytes are zero.
+		ofstream create(path, ios::binary | ios::app);
+		if (!create.is_open())
+			throw runtime_error("Failed to open nonce file " + path);
+	}
+	if (filesystem::file_size(path) < file_size)
+		filesystem::resize_file(path, file_size);
+	bip::file_mapping file(path.c_str(), bip::read_write);
+	bip::mapped_region region(file, bip::read_write, 0, file_size);
+	Header* h = static_cast<Header*>(region.get_address());
+	uint64_t found = 0;
+	if (!h->magic.compare_exchange_strong(found, magic) && found != magic)
+		throw runtime_error(path + " is not a nonce file");
+	Slot* s = reinterpret_cast<Slot*>(h + 1);
+	uint64_t hash = key_hash(key);
+	for (size_t i = 0; i < slots && !m_counter; ++i)
+	{
+		uint64_t owner = 0;
+		if (s[i].key.compare_exchange_strong(owner, hash) || owner == hash)
+			m_counter = &s[i].nonce;
+	}
+	if (!m_counter)
+		throw runtime_error("No free key slot in nonce file " + path);
+	m_file.swap(file);
+	m_region.swap(region);
+	// Keys used before the file existed had nonces from the clock
+	raise(time(0));
+}
+
+uint32_t NonceSequencer::next()
+{
+	uint64_t nonce = m_counter->fetch_add(1) + 1;
+	if (nonce > max_nonce)
+		throw runtime_error("Nonces of the API key are used up, create a new key");
+	return (uint32_t)nonce;
+}
+
+void NonceSequencer::raise(uint64_t value)
+{
+	uint64_t current = m_counter->load();
+	while (current < value && !m_counter->compare_exchange_weak(current, value))
+		;
+}
+
+uint64_t NonceSequencer::last() const
+{
+	return m_counter->load();
+}
@@ -0,0 +1,48 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <atomic>
+#include <cstdint>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Nonces of private API calls. The exchange accepts a nonce only if it is
+// above every one used before with the key, so the last one is kept as an
+// atomic counter. With a file the counter lives in a shared memory map of
+// it: every thread and process mapping the file draws from the same
+// sequence, and a restart continues above the last nonce instead of the
+// clock. One file holds the counters of many keys.
+class NonceSequencer
+{
+public:
+	// Counter of this process only, starting at the current unix time
+	NonceSequencer();
+	// Counter of the key in the file, created when missing
+	NonceSequencer(const std::string& path, const std::string& key);
+
+	NonceSequencer(const NonceSequencer&) = delete;
+	NonceSequencer& operator=(const NonceSequencer&) = delete;
+
+	// A nonce above all nonces handed out before
+	uint32_t next();
+
+	// Makes next() return more than value, used when the exchange reports
+	// a higher nonce than ours
+	void raise(uint64_t value);
+
+	uint64_t last() const;
+
+private:
+	struct Header;
+	struct Slot;
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free,
+		"nonces are shared between processes through lock free atomics");
+
+	std::atomic<uint64_t> m_local;
+	std::atomic<uint64_t>* m_counter;
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+};
@@ -0,0 +1,49 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "OrderBook.h"
+#include <algorithm>
+
+using namespace std;
+
+void OrderBook::sorted(CoinId coin)
+{
+	Side& s = side(coin);
+	// The exchange sends sorted levels, only a reverted pair may arrive in
+	// the opposite order
+	auto ascending = [](const Level& a, const Level& b) { return a.price < b.price; };
+	auto descending = [](const Level& a, const Level& b) { return a.price > b.price; };
+	if (!is_sorted(s.asks.begin(), s.asks.end(), ascending))
+		sort(s.asks.begin(), s.asks.end(), ascending);
+	if (!is_sorted(s.bids.begin(), s.bids.end(), descending))
+		sort(s.bids.begin(), s.bids.end(), descending);
+	s.updated = chrono::steady_clock::now();
+}
+
+chrono::steady_clock::duration OrderBook::age(CoinId coin) const
+{
+	if (coin >= m_books.size() || m_books[coin].updated == chrono::steady_clock::time_point())
+		return chrono::steady_clock::duration::max();
+	return chrono::steady_clock::now() - m_books[coin].updated;
+}
+
+double OrderBook::sweep(CoinId coin, TradeApi::Operation action, double amount, double& vwap) const
+{
+	vwap = 0.0;
+	if (coin >= m_books.size() || amount <= 0.0)
+		return 0.0;
+	const vector<Level>& levels = (action == TradeApi::BUY) ? m_books[coin].asks : m_books[coin].bids;
+	double left = amount;
+	double cost = 0.0;
+	for (const Level& l : levels)
+	{
+		double take = min(left, l.amount);
+		cost += take * l.price;
+		left -= take;
+		if (left <= 0.0)
+		{
+			vwap = cost / amount;
+			return l.price;
+		}
+	}
+	return 0.0;
+}
@@ -0,0 +1,49 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <vector>
+#include <chrono>
+#include "TradeApi.h"
+
+// Depth of the coin/BTC markets. Each side of a coin is a flat array of
+// price levels sorted from the best price, in BTC per coin, so a sweep
+// walks contiguous memory. A refresh overwrites the levels in place and
+// keeps the capacity, so steady updates do not allocate.
+class OrderBook
+{
+public:
+	struct Level
+	{
+		double price;
+		double amount;
+	};
+
+	struct Side
+	{
+		std::vector<Level> asks;    // ascending
+		std::vector<Level> bids;    // descending
+		std::chrono::steady_clock::time_point updated;
+	};
+
+	// Levels of the coin to overwrite, the caller fills both sides and
+	// calls sorted() when done
+	Side& side(CoinId coin)
+	{
+		return coin_slot(m_books, coin);
+	}
+
+	// Restores the order of the levels and marks the coin as updated
+	void sorted(CoinId coin);
+
+	// Time since the last update, the maximum for coins never updated
+	std::chrono::steady_clock::duration age(CoinId coin) const;
+
+	// Limit price which fills the amount at once, taking levels from the
+	// best one: asks for a buy, bids for a sell. vwap receives the average
+	// price of the fill. Returns 0 when the book holds less than the amount.
+	double sweep(CoinId coin, TradeApi::Operation action, double amount, double& vwap) const;
+
+private:
+	std::vector<Side> m_books;
+};
@@ -0,0 +1,270 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "OrderJournal.h"
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <boost/crc.hpp>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+static const char magic[8] = { 'W', 'E', 'X', 'J', 'O', 'U', 'R', 0 };
+static const uint32_t version = 1;
+static const size_t header_size = 16;
+
+enum Event
+{
+	INTENT = 1,
+	PLACED,
+	REJECTED,
+	FILLED,
+	CANCELLED
+};
+
+struct OrderJournal::Record
+{
+	uint32_t crc;       // of the bytes after it
+	uint8_t event;
+	uint8_t action;
+	uint16_t reserved;
+	int64_t time;
+	uint64_t intent;
+	int64_t id;
+	double price;
+	double amount;
+	char coin[16];
+};
+
+static uint32_t checksum(const char* data, size_t size)
+{
+	boost::crc_32_type crc;
+	crc.process_bytes(data, size);
+	return crc.checksum();
+}
+
+// Coin names longer than the field are cut, they are only compared back
+static void copy_coin(char (&dst)[16], const string& coin)
+{
+	memcpy(dst, coin.data(), min(coin.size(), sizeof(dst)));
+}
+
+static void sync(std::FILE* f)
+{
+	fflush(f);
+#ifndef _WIN32
+	fdatasync(fileno(f));
+#endif
+}
+
+static std::FILE* create(const string& path, const char* mode)
+{
+	std::FILE* f = fopen(path.c_str(), mode);
+	if (!f)
+		throw runtime_error("Failed to open order journal " + path);
+	return f;
+}
+
+OrderJournal::OrderJournal(const string& path) :
+	m_path(path),
+	m_file(nullptr),
+	m_next_intent(1),
+	m_unconfirmed(0)
+{
+	static_assert(sizeof(Record) == 64, "a record is 64 bytes");
+	replay();
+	compact();
+}
+
+OrderJournal::~OrderJournal()
+{
+	try
+	{
+		commit();
+	}
+	catch (const exception&)
+	{
+	}
+	if (m_file)
+		fclose(m_file);
+}
+
+void OrderJournal::replay()
+{
+	std::FILE* f = fopen(m_path.c_str(), "rb");
+	if (!f)
+		return;
+	char header[header_size];
+	bool valid = fread(header, 1, header_size, f) == header_size;
+	if (valid && (memcmp(header, magic, sizeof(magic)) || memcmp(header + 8, &version, sizeof(version))))
+	{
+		fclose(f);
+		throw runtime_error(m_path + " is not an order journal");
+	}
+	map<uint64_t, bool> intents;    // answered or not
+	map<long long, Open> open;
+	Record r;
+	while (valid && fread(&r, sizeof(r), 1, f) == 1)
+	{
+		// A torn write at the end of a crashed run ends the journal
+		if (r.crc != checksum(reinterpret_cast<const char*>(&r) + sizeof(r.crc), sizeof(r) - sizeof(r.crc)))
+			break;
+		m_next_intent = max(m_next_intent, r.intent + 1);
+		switch (r.event)
+		{
+		case INTENT:
+			intents[r.intent] = false;
+			break;
+		case PLACED:
+			intents[r.intent] = true;
+			if (r.id)
+			{
+				Open& o = open[r.id];
+				o.id = r.id;
+				o.time = r.time;
+				o.order.coin = string(r.coin, strnlen(r.coin, sizeof(r.coin)));
+				o.order.action = (TradeApi::Operation)r.action;
+				o.order.price = r.price;
+				o.order.amount = r.amount;
+			}
+			break;
+		case REJECTED:
+			intents[r.intent] = true;
+			break;
+		case FILLED:
+		case CANCELLED:
+			open.erase(r.id);
+			break;
+		}
+	}
+	fclose(f);
+	for (const auto& i : intents)
+		m_unconfirmed += !i.second;
+	for (const auto& o : open)
+		m_recovered.push_back(o.second);
+}
+
+void OrderJournal::compact()
+{
+	// The open orders are written to a new file which replaces the journal,
+	// a crash in between leaves the old one
+	string tmp = m_path + ".tmp";
+	std::FILE* f = create(tmp, "wb");
+	char header[header_size] = {};
+	memcpy(header, magic, sizeof(magic));
+	memcpy(header + 8, &version, sizeof(version));
+	fwrite(header, 1, header_size, f);
+	m_file = f;
+	for (const Open& o : m_recovered)
+	{
+		Record r = Record();
+		r.event = PLACED;
+		r.action = (uint8_t)o.order.action;
+		r.time = o.time;
+		r.intent = m_next_intent++;
+		r.id = o.id;
+		r.price = o.order.price;
+		r.amount = o.order.amount;
+		copy_coin(r.coin, o.order.coin);
+		add(r);
+	}
+	commit();
+	sync(f);
+	if (ferror(f))
+		throw runtime_error("Failed to write order journal " + tmp);
+	fclose(f);
+	m_file = nullptr;
+#ifdef _WIN32
+	remove(m_path.c_str());
+#endif
+	if (rename(tmp.c_str(), m_path.c_str()))
+		throw runtime_error("Failed to rename " + tmp);
+	m_file = create(m_path, "ab");
+}
+
+void OrderJournal::add(const Record& record)
+{
+	Record r = record;
+	if (!r.time)
+		r.time = ::time(0);
+	r.crc = checksum(reinterpret_cast<const char*>(&r) + sizeof(r.crc), sizeof(r) - sizeof(r.crc));
+	m_pending.append(reinterpret_cast<const char*>(&r), sizeof(r));
+}
+
+uint64_t OrderJournal::intent(const TradeApi::Order& order)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Record r = Record();
+	r.event = INTENT;
+	r.action = (uint8_t)order.action;
+	r.intent = m_next_intent++;
+	r.price = order.price;
+	r.amount = order.amount;
+	copy_coin(r.coin, order.coin);
+	add(r);
+	m_intents[r.intent] = order;
+	return r.intent;
+}
+
+void OrderJournal::placed(uint64_t intent, long long id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Record r = Record();
+	r.event = PLACED;
+	r.intent = intent;
+	r.id = id;
+	// The record holds the order too, so it stands on its own
+	auto it = m_intents.find(intent);
+	if (it != m_intents.end())
+	{
+		r.action = (uint8_t)it->second.action;
+		r.price = it->second.price;
+		r.amount = it->second.amount;
+		copy_coin(r.coin, it->second.coin);
+		m_intents.erase(it);
+	}
+	add(r);
+}
+
+void OrderJournal::rejected(uint64_t intent)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Record r = Record();
+	r.event = REJECTED;
+	r.intent = intent;
+	m_intents.erase(intent);
+	add(r);
+}
+
+void OrderJournal::filled(long long id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Record r = Record();
+	r.event = FILLED;
+	r.id = id;
+	add(r);
+}
+
+void OrderJournal::cancelled(long long id)
+{
+	lock_guard<mutex> lock(m_mutex);
+	Record r = Record();
+	r.event = CANCELLED;
+	r.id = id;
+	add(r);
+}
+
+void OrderJournal::commit()
+{
+	lock_guard<mutex> lock(m_mutex);
+	if (m_pending.empty() || !m_file)
+		return;
+	size_t written = fwrite(m_pending.data(), 1, m_pending.size(), m_file);
+	sync(m_file);
+	bool failed = written != m_pending.size() || ferror(m_file);
+	m_pending.clear();
+	if (failed)
+		throw runtime_error("Failed to write order journal " + m_path);
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <cstdio>
+#include <cstdint>
+#include "TradeApi.h"
+
+// Write-ahead journal of the orders of one API key. The intent to place an
+// order is made durable before the request is sent, then its placement or
+// rejection, fill and cancel are recorded as they happen. Records are
+// buffered and reach the disk with one write and one fdatasync per
+// commit(), so a batch of orders costs a single sync.
+//
+// Records have a fixed size and a checksum. Opening replays the file up to
+// the first torn or damaged record, which rebuilds the orders an earlier
+// run left open, and then rewrites it with only those, so the journal
+// stays as small as the open orders.
+class OrderJournal
+{
+public:
+	// An order placed by an earlier run and not known to have finished
+	struct Open
+	{
+		long long id;
+		TradeApi::Order order;
+		int64_t time;       // unix time of the placement
+
+		Open() : id(0), time(0) {}
+	};
+
+	explicit OrderJournal(const std::string& path);
+	~OrderJournal();
+
+	OrderJournal(const OrderJournal&) = delete;
+	OrderJournal& operator=(const OrderJournal&) = delete;
+
+	const std::vector<Open>& recovered() const
+	{
+		return m_recovered;
+	}
+
+	// Intents of an earlier run with no recorded reply: the run stopped
+	// while they were sent, the orders may or may not exist
+	size_t unconfirmed() const
+	{
+		return m_unconfirmed;
+	}
+
+	// Records the intent and returns its number for the records that follow
+	uint64_t intent(const TradeApi::Order& order);
+	// An id of zero is an order which filled at once
+	void placed(uint64_t intent, long long id);
+	void rejected(uint64_t intent);
+	void filled(long long id);
+	void cancelled(long long id);
+
+	// Writes the buffered records and waits until they are on the disk
+	void commit();
+
+private:
+	struct Record;
+
+	void add(const Record& r);
+	void replay();
+	void compact();
+
+	std::string m_path;
+	std::FILE* m_file;
+	std::mutex m_mutex;
+	std::string m_pending;
+	uint64_t m_next_intent;
+	// Intents of this run, to record the order with its placement
+	std::map<uint64_t, TradeApi::Order> m_intents;
+
+	std::vector<Open> m_recovered;
+	size_t m_unconfirmed;
+};
@@ -1,94 +1,137 @@
-// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#include "Portfolio.h"
-#include <cmath>
-#include <iostream>
-
-using namespace std;
-
-void Portfolio::addCoin(const string& coinSymbol, double part)
-{
-	m_parts[coinSymbol] = part;
-}
-
-map<string, double> combineParts(const map<string, double>& src,
-	const map<string, double>& additional)
-{
-	map<string, double> res(src);
-	for (auto p : additional)
-	{
-		if (res.find(p.first) == res.end())
-			res[p.first] = 0.0;
-	}
-	return res;
-}
-
-vector<TradeApi::Order> Portfolio::checkCurrentState(TradeApi& trade, 
-	double threshold)
-{
-	m_completed = true;
-	map<string, double> current_parts = trade.nonZeroBalancesInBTC();
-    double maxBuy = current_parts["btc"];
-	current_parts = combineParts(current_parts, m_parts);
-	map<string, double> parts = combineParts(m_parts, current_parts);
-	double sum = 0.0;
-	for (auto p : parts)
-		sum += p.second;
-	double current_sum = 0.0;
-	for (auto p : current_parts)
-		current_sum += p.second;
-    double btcDiff = 0.0;
-    double maxPart = 0.0;
-    double maxValue = 0.0;
-    string maxCoin = "";
-	vector<TradeApi::Order> orders;
-	for (auto p : parts)
-	{
-		double diff = (current_parts[p.first] / current_sum) / (p.second / sum) - 1.0;
-		cout << p.first << ": " << diff << endl;
-        if (p.first == "btc")
-        {
-            btcDiff = diff;
-            continue;
-        }
-        if(abs(diff) > abs(maxPart))
-        {
-            maxPart = diff;
-            maxCoin = p.first;
-            maxValue = p.second;
-        }
-        if (std::abs(diff) < threshold)
-			continue;
-		TradeApi::CoinInfo ci = trade.info(p.first);
-		TradeApi::Order o;
-		o.coin = p.first;
-		o.action = (diff > 0) ? TradeApi::SELL : TradeApi::BUY;
-		o.price = (ci.buyPrice + ci.sellPrice) / 2;
-		//o.price = (o.action == TradeApi::SELL) ? ci.buyPrice : ci.sellPrice;
-		o.amount = abs(current_sum * (p.second / sum) - current_parts[p.first]) / o.price;
-		if (o.action == TradeApi::BUY)
-		{
-			double order_sum = o.price * o.amount;
-			if (order_sum > maxBuy)
-			{
-				m_completed = false;
-				continue;
-			}
-			maxBuy -= order_sum;
-		}
-		orders.push_back(o);
-	}
-    if(orders.empty() && std::abs(btcDiff) > threshold)
-    {
-        TradeApi::CoinInfo ci = trade.info(maxCoin);
-        TradeApi::Order o;
-        o.coin = maxCoin;
-        o.action = (maxPart > 0) ? TradeApi::SELL : TradeApi::BUY;
-        o.price = (ci.buyPrice + ci.sellPrice) / 2;
-        //o.price = (o.action == TradeApi::SELL) ? ci.buyPrice : ci.sellPrice;
-        o.amount = abs(current_sum * (maxValue / sum) - current_parts[maxCoin]) / o.price;
-
-        orders.push_back(o);
-    }
-	return orders;
-}
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "Portfolio.h"
+#include "TraceEvents.h"
+#include <cmath>
+#include <iostream>
+
+using namespace std;
+
+void Portfolio::addCoin(const string& coinSymbol, double part)
+{
+	addCoin(CoinRegistry::intern(coinSymbol), part);
+}
+
+void Portfolio::addCoin(CoinId coin, double part)
+{
+	coin_slot(m_parts, coin) = part;
+	coin_slot(m_member, coin) = 1;
+}
+
+vector<TradeApi::Order> Portfolio::checkCurrentState(TradeApi& trade, 
+	double threshold)
+{
+	TraceSpan span("portfolio", "checkCurrentState");
+	m_completed = true;
+	m_drift = 0.0;
+	const TradeApi::CoinValues& amounts = trade.balances();
+	const TradeApi::Tickers& tickers = trade.tickers();
+	// Coins are visited in symbol order, which decides what the BTC
+	// limit is spent on first and which coin wins a tie for the maximum
+	if (m_order.size() != CoinRegistry::size())
+		m_order = CoinRegistry::byName();
+
+	// A coin takes part if it is in the portfolio or on the account.
+	// BTC always does, it is what the buy orders are paid with.
+	TraceSpan values_span("portfolio", "values");
+	m_values.assign(m_order.size(), 0.0);
+	m_active.clear();
+	double maxBuy = coin_value(amounts, CoinRegistry::btc);
+	for (CoinId id : m_order)
+	{
+		double amount = coin_value(amounts, id);
+		if (id == CoinRegistry::btc)
+			m_values[id] = amount;
+		else if (amount != 0.0)
+			m_values[id] = amount * (coin_value(tickers.buyPrice, id) + coin_value(tickers.sellPrice, id)) / 2;
+		else if (!coin_value(m_member, id))
+			continue;
+		m_active.push_back(id);
+	}
+	double sum = 0.0;
+	double current_sum = 0.0;
+	for (CoinId id : m_active)
+	{
+		sum += coin_value(m_parts, id);
+		current_sum += m_values[id];
+	}
+	values_span.end();
+
+	if (m_solver)
+	{
+		TraceSpan solve_span("portfolio", "solve");
+		m_state.coins = m_active;
+		m_state.values = m_values;
+		m_state.targets.assign(m_values.size(), 0.0);
+		for (CoinId id : m_active)
+		{
+			m_state.targets[id] = current_sum * (coin_value(m_parts, id) / sum);
+			double diff = m_values[id] / m_state.targets[id] - 1.0;
+			if (m_state.targets[id] > 0.0)
+				m_drift = max(m_drift, abs(diff));
+			if (m_verbose)
+				cout << CoinRegistry::name(id) << ": " << diff << endl;
+		}
+		return m_solver->solve(trade, m_state, threshold, m_completed);
+	}
+
+	TraceSpan orders_span("portfolio", "orders");
+	double btcDiff = 0.0;
+	double maxPart = 0.0;
+	double maxValue = 0.0;
+	CoinId maxCoin = CoinRegistry::none;
+	vector<TradeApi::Order> orders;
+	for (CoinId id : m_active)
+	{
+		double part = coin_value(m_parts, id);
+		double diff = (m_values[id] / current_sum) / (part / sum) - 1.0;
+		if (part > 0.0)
+			m_drift = max(m_drift, abs(diff));
+		if (m_verbose)
+			cout << CoinRegistry::name(id) << ": " << diff << endl;
+		if (id == CoinRegistry::btc)
+		{
+			btcDiff = diff;
+			continue;
+		}
+		if (abs(diff) > abs(maxPart))
+		{
+			maxPart = diff;
+			maxCoin = id;
+			maxValue = part;
+		}
+		if (std::abs(diff) < threshold)
+			continue;
+		TradeApi::CoinInfo ci = trade.info(id);
+		TradeApi::Order o;
+		o.coin = ci.coin;
+		o.action = (diff > 0) ? TradeApi::SELL : TradeApi::BUY;
+		o.price = (ci.buyPrice + ci.sellPrice) / 2;
+		//o.price = (o.action == TradeApi::SELL) ? ci.buyPrice : ci.sellPrice;
+		o.amount = abs(current_sum * (part / sum) - m_values[id]) / o.price;
+		if (o.action == TradeApi::BUY)
+		{
+			double order_sum = o.price * o.amount;
+			if (order_sum > maxBuy)
+			{
+				m_completed = false;
+				continue;
+			}
+			maxBuy -= order_sum;
+		}
+		orders.push_back(o);
+	}
+	if (orders.empty() && std::abs(btcDiff) > threshold)
+	{
+		TradeApi::CoinInfo ci = trade.info(maxCoin);
+		TradeApi::Order o;
+		o.coin = ci.coin;
+		o.action = (maxPart > 0) ? TradeApi::SELL : TradeApi::BUY;
+		o.price = (ci.buyPrice + ci.sellPrice) / 2;
+		//o.price = (o.action == TradeApi::SELL) ? ci.buyPrice : ci.sellPrice;
+		o.amount = abs(current_sum * (maxValue / sum) - m_values[maxCoin]) / o.price;
+
+		orders.push_back(o);
+	}
+	return orders;
+}
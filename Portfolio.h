@@ -1,26 +1,60 @@
-// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#pragma once
-
-#include <string>
-#include <vector>
-#include <map>
-#include "TradeApi.h"
-
-class Portfolio
-{
-public:
-	void addCoin(const std::string& coinSymbol, double part);
-
-	std::vector<TradeApi::Order> checkCurrentState(TradeApi& trade, 
-		double threshold);
-
-	bool completed() const
-	{
-		return m_completed;
-	}
-protected:
-	std::map<std::string, double> m_parts;
-	bool m_completed;
-};
-
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "TradeApi.h"
+#include "RebalanceSolver.h"
+
+// Target weights of the coins. Weights, balances and prices are arrays
+// indexed by CoinId, so a check is a few passes over them in symbol order.
+class Portfolio
+{
+public:
+	Portfolio() : m_completed(true), m_verbose(true), m_drift(0.0) {}
+
+	void addCoin(const std::string& coinSymbol, double part);
+	void addCoin(CoinId coin, double part);
+
+	std::vector<TradeApi::Order> checkCurrentState(TradeApi& trade, 
+		double threshold);
+
+	bool completed() const
+	{
+		return m_completed;
+	}
+
+	// Largest relative deviation of a coin from its target at the last check,
+	// coins held without a target weight are not counted
+	double drift() const
+	{
+		return m_drift;
+	}
+
+	// Print the deviation of every coin while checking
+	void set_verbose(bool verbose)
+	{
+		m_verbose = verbose;
+	}
+
+	// Decides the orders instead of the built-in pass when set
+	void set_solver(std::shared_ptr<RebalanceSolver> solver)
+	{
+		m_solver = solver;
+	}
+protected:
+	TradeApi::CoinValues m_parts;
+	std::vector<char> m_member;
+	bool m_completed;
+	bool m_verbose;
+	double m_drift;
+	std::shared_ptr<RebalanceSolver> m_solver;
+
+	// Scratch space of checkCurrentState
+	std::vector<CoinId> m_order;
+	std::vector<CoinId> m_active;
+	TradeApi::CoinValues m_values;
+	RebalanceSolver::State m_state;
+};
@@ -0,0 +1,275 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "PortfolioBatch.h"
+#include "WorkStealingPool.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+typedef uint64_t Flag;
+
+static const Flag no_row = ~Flag(0);
+// Portfolios checked by one task
+static const size_t chunk = 1024;
+
+PortfolioBatch::PortfolioBatch(const vector<CoinId>& coins) :
+	m_size(0)
+{
+	vector<CoinId> all(coins);
+	if (find(all.begin(), all.end(), CoinRegistry::btc) == all.end())
+		all.push_back(CoinRegistry::btc);
+	for (CoinId id : CoinRegistry::byName())
+	{
+		if (find(all.begin(), all.end(), id) != all.end())
+			m_coins.push_back(id);
+	}
+	m_btc = row(CoinRegistry::btc);
+}
+
+size_t PortfolioBatch::row(CoinId coin) const
+{
+	return find(m_coins.begin(), m_coins.end(), coin) - m_coins.begin();
+}
+
+void PortfolioBatch::resize(size_t portfolios)
+{
+	m_size = portfolios;
+	size_t cells = m_coins.size() * portfolios;
+	m_parts.assign(cells, -1.0);
+	m_amounts.assign(cells, 0.0);
+	m_thresholds.assign(portfolios, 0.0);
+}
+
+CoinId PortfolioBatch::maxCoin(size_t portfolio) const
+{
+	Flag r = m_max_row[portfolio];
+	return (r == no_row) ? CoinRegistry::none : m_coins[r];
+}
+
+const string& PortfolioBatch::error(size_t portfolio) const
+{
+	// The only error of the check, thrown by TradeApi::info()
+	static const string none, invalid("Invalid coin");
+	return m_failed[portfolio] ? invalid : none;
+}
+
+vector<TradeApi::Order> PortfolioBatch::orders(size_t portfolio) const
+{
+	vector<TradeApi::Order> res;
+	if (m_failed[portfolio])
+		return res;
+	if (m_fallback[portfolio])
+	{
+		size_t r = m_max_row[portfolio];
+		TradeApi::Order o;
+		o.coin = CoinRegistry::name(m_coins[r]);
+		o.action = (m_max_drift[portfolio] > 0) ? TradeApi::SELL : TradeApi::BUY;
+		o.price = m_prices[r];
+		o.amount = m_fallback_amount[portfolio];
+		res.push_back(o);
+		return res;
+	}
+	for (size_t r = 0; r < m_coins.size(); ++r)
+	{
+		size_t i = r * m_size + portfolio;
+		if (!m_placed[i])
+			continue;
+		TradeApi::Order o;
+		o.coin = CoinRegistry::name(m_coins[r]);
+		o.action = (m_drift[i] > 0) ? TradeApi::SELL : TradeApi::BUY;
+		o.price = m_prices[r];
+		o.amount = m_order_amounts[i];
+		res.push_back(o);
+	}
+	return res;
+}
+
+// The passes over the portfolios of one coin. Each is a small loop over
+// restrict pointers which only selects values instead of branching, so the
+// compiler can vectorize it. The floating point operations are the ones of
+// Portfolio::checkCurrentState in the same order, so each portfolio gets bit
+// identical results.
+
+// Values in BTC and the sums. A coin which is neither in the portfolio nor
+// on the account adds zeros, which leaves the sums unchanged.
+static void add_values(size_t begin, size_t end, double price, Flag btc,
+	const double* __restrict part, const double* __restrict amount, double* __restrict value,
+	double* __restrict sum, double* __restrict current_sum)
+{
+	for (size_t p = begin; p < end; ++p)
+	{
+		double a = amount[p];
+		double pt = part[p];
+		double v = btc ? a : (a != 0.0 ? a * price : 0.0);
+		value[p] = v;
+		sum[p] += (pt >= 0.0) ? pt : 0.0;
+		current_sum[p] += v;
+	}
+}
+
+// Deviation of the coin, zero where it does not take part
+static void add_drift(size_t begin, size_t end,
+	const double* __restrict part, const double* __restrict amount, const double* __restrict value,
+	const double* __restrict sum, const double* __restrict current_sum, const Flag* __restrict failed,
+	double* __restrict drift, Flag* __restrict active)
+{
+	for (size_t p = begin; p < end; ++p)
+	{
+		double pt = part[p];
+		Flag member = pt >= 0.0;
+		Flag a = (member | (Flag)(amount[p] != 0.0)) & (failed[p] ^ 1);
+		double pe = member ? pt : 0.0;
+		double d = (value[p] / current_sum[p]) / (pe / sum[p]) - 1.0;
+		drift[p] = a ? d : 0.0;
+		active[p] = a;
+	}
+}
+
+static void update_max(size_t begin, size_t end, Flag row,
+	const double* __restrict part, const double* __restrict drift, const Flag* __restrict active,
+	double* __restrict max_drift, double* __restrict max_part, Flag* __restrict max_row)
+{
+	for (size_t p = begin; p < end; ++p)
+	{
+		double d = drift[p];
+		double pt = part[p];
+		double md = max_drift[p];
+		Flag is_max = active[p] & (Flag)(std::abs(d) > std::abs(md));
+		max_drift[p] = is_max ? d : md;
+		max_part[p] = is_max ? (pt >= 0.0 ? pt : 0.0) : max_part[p];
+		max_row[p] = is_max ? row : max_row[p];
+	}
+}
+
+// Orders for the coin, placed while the BTC left for buying is enough.
+// A coin without a price makes every order for it fail.
+static void place_orders(size_t begin, size_t end, double price,
+	const double* __restrict part, const double* __restrict value, const double* __restrict sum,
+	const double* __restrict current_sum, const double* __restrict threshold,
+	const double* __restrict drift, const Flag* __restrict active,
+	double* __restrict max_buy, double* __restrict order_amount, Flag* __restrict placed,
+	Flag* __restrict completed, Flag* __restrict has_orders, Flag* __restrict failed)
+{
+	Flag priced = price != 0.0;
+	for (size_t p = begin; p < end; ++p)
+	{
+		double d = drift[p];
+		double pt = part[p];
+		double pe = (pt >= 0.0) ? pt : 0.0;
+		Flag candidate = active[p] & (Flag)!(std::abs(d) < threshold[p]);
+		failed[p] |= candidate & (priced ^ 1);
+		Flag order = candidate & priced;
+		double amt = std::abs(current_sum[p] * (pe / sum[p]) - value[p]) / price;
+		double order_sum = price * amt;
+		Flag buy = !(d > 0);
+		double mb = max_buy[p];
+		Flag affordable = (buy ^ 1) | (Flag)!(order_sum > mb);
+		completed[p] &= (order & (affordable ^ 1)) ^ 1;
+		Flag place = order & affordable;
+		max_buy[p] = mb - ((place & buy) ? order_sum : 0.0);
+		order_amount[p] = amt;
+		placed[p] = place;
+		has_orders[p] |= place;
+	}
+}
+
+void PortfolioBatch::evaluate(const TradeApi::CoinValues& prices, WorkStealingPool* pool)
+{
+	size_t cells = m_coins.size() * m_size;
+	m_prices.resize(m_coins.size());
+	for (size_t r = 0; r < m_coins.size(); ++r)
+		m_prices[r] = coin_value(prices, m_coins[r]);
+	m_values.resize(cells);
+	m_drift.resize(cells);
+	m_order_amounts.resize(cells);
+	m_placed.resize(cells);
+	for (auto v : { &m_sum, &m_current_sum, &m_max_buy, &m_btc_drift, &m_max_drift,
+		&m_max_part, &m_fallback_amount })
+		v->resize(m_size);
+	for (auto v : { &m_max_row, &m_completed, &m_has_orders, &m_failed, &m_active, &m_fallback })
+		v->resize(m_size);
+
+	if (!pool || m_size <= chunk)
+	{
+		check(0, m_size);
+		return;
+	}
+	for (size_t begin = 0; begin < m_size; begin += chunk)
+	{
+		size_t end = min(begin + chunk, m_size);
+		pool->submit([this, begin, end]() { check(begin, end); });
+	}
+	pool->wait();
+}
+
+// Same steps as Portfolio::checkCurrentState, with the loop over coins
+// outside and the loop over portfolios inside
+void PortfolioBatch::check(size_t begin, size_t end)
+{
+	size_t n = m_size;
+	const double* btc_amount = &m_amounts[m_btc * n];
+	for (size_t p = begin; p < end; ++p)
+	{
+		m_sum[p] = 0.0;
+		m_current_sum[p] = 0.0;
+		m_max_buy[p] = btc_amount[p];
+		m_max_drift[p] = 0.0;
+		m_max_part[p] = 0.0;
+		m_max_row[p] = no_row;
+		m_completed[p] = 1;
+		m_has_orders[p] = 0;
+		m_failed[p] = 0;
+	}
+
+	for (size_t r = 0; r < m_coins.size(); ++r)
+	{
+		add_values(begin, end, m_prices[r], r == m_btc, &m_parts[r * n], &m_amounts[r * n],
+			&m_values[r * n], m_sum.data(), m_current_sum.data());
+	}
+
+	for (size_t r = 0; r < m_coins.size(); ++r)
+	{
+		size_t i = r * n;
+		if (r == m_btc)
+		{
+			// BTC always takes part and is only used for the fallback below
+			for (size_t p = begin; p < end; ++p)
+			{
+				double pt = m_parts[i + p];
+				double pe = (pt >= 0.0) ? pt : 0.0;
+				double d = (m_values[i + p] / m_current_sum[p]) / (pe / m_sum[p]) - 1.0;
+				m_drift[i + p] = d;
+				m_btc_drift[p] = d;
+				m_placed[i + p] = 0;
+			}
+			continue;
+		}
+		add_drift(begin, end, &m_parts[i], &m_amounts[i], &m_values[i], m_sum.data(),
+			m_current_sum.data(), m_failed.data(), &m_drift[i], m_active.data());
+		update_max(begin, end, r, &m_parts[i], &m_drift[i], m_active.data(),
+			m_max_drift.data(), m_max_part.data(), m_max_row.data());
+		place_orders(begin, end, m_prices[r], &m_parts[i], &m_values[i], m_sum.data(),
+			m_current_sum.data(), m_thresholds.data(), &m_drift[i], m_active.data(),
+			m_max_buy.data(), &m_order_amounts[i], &m_placed[i], m_completed.data(),
+			m_has_orders.data(), m_failed.data());
+	}
+
+	// Without other orders a BTC deviation is fixed with the coin that
+	// deviates most
+	for (size_t p = begin; p < end; ++p)
+	{
+		m_fallback[p] = 0;
+		if (m_failed[p] || m_has_orders[p] || !(std::abs(m_btc_drift[p]) > m_thresholds[p]))
+			continue;
+		Flag r = m_max_row[p];
+		if (r == no_row || m_prices[r] == 0.0)
+		{
+			m_failed[p] = 1;
+			continue;
+		}
+		m_fallback[p] = 1;
+		m_fallback_amount[p] = std::abs(m_current_sum[p] * (m_max_part[p] / m_sum[p]) -
+			m_values[r * n + p]) / m_prices[r];
+	}
+}
@@ -0,0 +1,128 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "TradeApi.h"
+#include "CoinRegistry.h"
+
+class WorkStealingPool;
+
+// Rebalance check for many portfolios over the same prices. Holdings and
+// target parts are matrices with one row per coin and one column per
+// portfolio, so every step of Portfolio::checkCurrentState becomes a loop
+// over contiguous arrays of all portfolios. The orders, completed() and
+// errors come out exactly as checkCurrentState would give them for each
+// portfolio on its own.
+class PortfolioBatch
+{
+public:
+	// The coins any portfolio may hold or target. BTC is added when missing.
+	explicit PortfolioBatch(const std::vector<CoinId>& coins);
+
+	void resize(size_t portfolios);
+
+	size_t size() const
+	{
+		return m_size;
+	}
+
+	// Coins in the order of the matrix rows, which is the symbol order
+	const std::vector<CoinId>& coins() const
+	{
+		return m_coins;
+	}
+
+	// Row of the coin, coins().size() if it is not in the batch
+	size_t row(CoinId coin) const;
+
+	// Target part of a coin in a portfolio. Negative means the coin is not
+	// in the portfolio, which is the default.
+	double& part(size_t row, size_t portfolio)
+	{
+		return m_parts[row * m_size + portfolio];
+	}
+
+	// Amount of the coin on the account of the portfolio
+	double& amount(size_t row, size_t portfolio)
+	{
+		return m_amounts[row * m_size + portfolio];
+	}
+
+	double& threshold(size_t portfolio)
+	{
+		return m_thresholds[portfolio];
+	}
+
+	// Runs the check for all portfolios. Prices are the middle of buy and
+	// sell in BTC indexed by CoinId, zero for a coin without a ticker.
+	// With a pool the portfolios are split into chunks checked in parallel.
+	void evaluate(const TradeApi::CoinValues& prices, WorkStealingPool* pool = nullptr);
+
+	// Results of the last evaluate()
+
+	// Relative deviation of the coin from its target part
+	double drift(size_t row, size_t portfolio) const
+	{
+		return m_drift[row * m_size + portfolio];
+	}
+
+	// Largest deviation among the coins other than BTC, and its coin.
+	// The coin is CoinRegistry::none when no coin deviates.
+	double maxDrift(size_t portfolio) const
+	{
+		return m_max_drift[portfolio];
+	}
+	CoinId maxCoin(size_t portfolio) const;
+
+	bool completed(size_t portfolio) const
+	{
+		return m_completed[portfolio] != 0;
+	}
+
+	// Text of the exception checkCurrentState would throw, empty if none
+	const std::string& error(size_t portfolio) const;
+
+	// Orders checkCurrentState would return
+	std::vector<TradeApi::Order> orders(size_t portfolio) const;
+
+private:
+	// Flags are as wide as a double so that loops mixing flags and doubles
+	// can be vectorized
+	typedef uint64_t Flag;
+
+	void check(size_t begin, size_t end);
+
+	std::vector<CoinId> m_coins;
+	size_t m_btc;
+	size_t m_size;
+
+	// Inputs, row per coin
+	std::vector<double> m_parts;
+	std::vector<double> m_amounts;
+	std::vector<double> m_thresholds;
+
+	// Per coin results
+	std::vector<double> m_prices;       // per row
+	std::vector<double> m_values;
+	std::vector<double> m_drift;
+	std::vector<double> m_order_amounts;
+	std::vector<Flag> m_placed;
+
+	// Per portfolio results
+	std::vector<double> m_sum;
+	std::vector<double> m_current_sum;
+	std::vector<double> m_max_buy;
+	std::vector<double> m_btc_drift;
+	std::vector<double> m_max_drift;
+	std::vector<double> m_max_part;     // target part of the coin with the maximum
+	std::vector<Flag> m_max_row;
+	std::vector<Flag> m_completed;
+	std::vector<Flag> m_has_orders;
+	std::vector<Flag> m_failed;
+	std::vector<Flag> m_active;         // of the coin being checked
+	std::vector<Flag> m_fallback;       // the single order to the maximum coin
+	std::vector<double> m_fallback_amount;
+};
@@ -0,0 +1,172 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "RebalanceSolver.h"
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+// Rounded down, the request rounds to the nearest and a sell of the whole
+// balance or a buy of the BTC left must not grow past it
+static void floor_amount(const TradeApi::PairParams& pp, TradeApi::Order& o)
+{
+	if (!pp.reverted)
+	{
+		double unit = std::pow(10.0, (double)pp.decimal_places);
+		o.amount = std::floor(o.amount * unit) / unit;
+	}
+}
+
+namespace
+{
+	struct Move
+	{
+		CoinId coin;
+		double delta;   // BTC value to add to the coin, negative to sell
+	};
+}
+
+vector<TradeApi::Order> MinTurnoverSolver::solve(TradeApi& trade, const State& s,
+	double threshold, bool& completed)
+{
+	completed = true;
+	auto off = [&](CoinId id, double value)
+	{
+		// Same test as the built-in pass, a coin without target is always off
+		double d = value / s.targets[id] - 1.0;
+		return value != s.targets[id] && !(std::abs(d) < threshold);
+	};
+
+	// Every coin beyond the threshold goes to its target
+	vector<Move> moves;
+	vector<Move> spare;     // coins within the threshold
+	double btc = s.values[CoinRegistry::btc];
+	for (CoinId id : s.coins)
+	{
+		if (id == CoinRegistry::btc)
+			continue;
+		Move m = { id, s.targets[id] - s.values[id] };
+		if (off(id, s.values[id]))
+		{
+			moves.push_back(m);
+			btc -= m.delta;
+		}
+		else if (m.delta != 0.0)
+			spare.push_back(m);
+	}
+
+	// Then the fewest coins that bring BTC within the threshold. A coin helps
+	// when trading it moves BTC the right way, and it is traded no further
+	// than its own target or the one of BTC.
+	double btc_target = s.targets[CoinRegistry::btc];
+	if (off(CoinRegistry::btc, btc))
+	{
+		double need = btc_target - btc;
+		double required = std::abs(need) - threshold * btc_target;
+		spare.erase(remove_if(spare.begin(), spare.end(),
+			[&](const Move& m) { return (m.delta < 0) != (need > 0); }), spare.end());
+		sort(spare.begin(), spare.end(), [](const Move& a, const Move& b)
+		{
+			return std::abs(a.delta) > std::abs(b.delta);
+		});
+		// A single coin is enough when the largest one is, take the lowest fee
+		// among those which are
+		size_t single = spare.size();
+		for (size_t i = 0; i < spare.size() && std::abs(spare[i].delta) >= required; ++i)
+		{
+			if (single == spare.size() ||
+				trade.pairParams(spare[i].coin).fee < trade.pairParams(spare[single].coin).fee)
+				single = i;
+		}
+		if (single < spare.size())
+			spare = vector<Move>(1, spare[single]);
+		double left = std::abs(need);
+		for (size_t i = 0; i < spare.size() && required > 0.0; ++i)
+		{
+			Move m = spare[i];
+			double size = min(std::abs(m.delta), left);
+			m.delta = (m.delta < 0) ? -size : size;
+			moves.push_back(m);
+			required -= size;
+			left -= size;
+		}
+		if (required > 0.0)
+			completed = false;
+	}
+
+	// Orders within the pair limits. The BTC the sells bring pays for the buys.
+	vector<TradeApi::Order> sells, buys;
+	double funds = s.values[CoinRegistry::btc];
+	double cost = 0.0;
+	for (const Move& m : moves)
+	{
+		TradeApi::CoinInfo ci = trade.info(m.coin);
+		TradeApi::PairParams pp = trade.pairParams(m.coin);
+		double fee = pp.fee / 100.0;
+		TradeApi::Order o;
+		o.coin = ci.coin;
+		o.price = (ci.buyPrice + ci.sellPrice) / 2;
+		if (m.delta < 0)
+		{
+			o.action = TradeApi::SELL;
+			o.amount = min(-m.delta / o.price, coin_value(trade.balances(), m.coin));
+		}
+		else
+		{
+			o.action = TradeApi::BUY;
+			// The fee is taken from the bought coin
+			o.amount = m.delta / o.price / (1.0 - fee);
+		}
+		floor_amount(pp, o);
+		double pair_price = pp.reverted ? 1.0 / o.price : o.price;
+		double pair_amount = pp.reverted ? o.amount * o.price : o.amount;
+		if ((pp.min > 0.0 && pair_price < pp.min) || (pp.max > 0.0 && pair_price > pp.max) ||
+			pair_amount < pp.min_amount || o.amount <= 0.0)
+		{
+			completed = false;
+			continue;
+		}
+		if (o.action == TradeApi::SELL)
+		{
+			funds += o.amount * o.price * (1.0 - fee);
+			sells.push_back(o);
+		}
+		else
+		{
+			cost += o.amount * o.price;
+			buys.push_back(o);
+		}
+	}
+
+	// Buys share the BTC when it falls short, which only the fees and the
+	// limits above can cause
+	if (cost > funds)
+	{
+		double scale = max(funds, 0.0) / cost;
+		completed = false;
+		size_t n = 0;
+		for (size_t i = 0; i < buys.size(); ++i)
+		{
+			buys[i].amount *= scale;
+			TradeApi::PairParams pp = trade.pairParams(CoinRegistry::find(buys[i].coin));
+			floor_amount(pp, buys[i]);
+			double pair_amount = pp.reverted ? buys[i].amount * buys[i].price : buys[i].amount;
+			if (pair_amount >= pp.min_amount && buys[i].amount > 0.0)
+				buys[n++] = buys[i];
+		}
+		buys.resize(n);
+	}
+
+	sells.insert(sells.end(), buys.begin(), buys.end());
+	return sells;
+}
+
+shared_ptr<RebalanceSolver> make_solver(const string& name)
+{
+	if (name == "greedy")
+		return shared_ptr<RebalanceSolver>();
+	if (name == "min-turnover")
+		return make_shared<MinTurnoverSolver>();
+	throw runtime_error("Unknown solver " + name + ", expected greedy or min-turnover");
+}
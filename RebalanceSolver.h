@@ -0,0 +1,46 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include "TradeApi.h"
+
+// Turns the state measured by Portfolio::checkCurrentState into orders.
+// Without a solver Portfolio uses its own pass, which handles every coin on
+// its own and only buys with the BTC already on the account.
+class RebalanceSolver
+{
+public:
+	// Values in BTC indexed by CoinId
+	struct State
+	{
+		std::vector<CoinId> coins;      // taking part, in symbol order, BTC included
+		TradeApi::CoinValues values;
+		TradeApi::CoinValues targets;
+	};
+
+	virtual ~RebalanceSolver() {}
+
+	// Sets completed to false when a deviation above the threshold is left
+	// after the orders
+	virtual std::vector<TradeApi::Order> solve(TradeApi& trade, const State& state,
+		double threshold, bool& completed) = 0;
+};
+
+// Brings every coin beyond the threshold to its target with one order each.
+// When BTC is still off after that, the fewest coins that fix it are traded
+// too, the cheapest by fee among equally good ones. Buys are sized so the
+// coin reaches the target after the fee and are paid for with the BTC of the
+// sells, which come first in the list. Orders below the pair minimum or
+// outside its price limits are left out.
+class MinTurnoverSolver : public RebalanceSolver
+{
+public:
+	virtual std::vector<TradeApi::Order> solve(TradeApi& trade, const State& state,
+		double threshold, bool& completed);
+};
+
+// "greedy" gives null, the built-in pass of Portfolio
+std::shared_ptr<RebalanceSolver> make_solver(const std::string& name);
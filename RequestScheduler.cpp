@@ -0,0 +1,212 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "RequestScheduler.h"
+#include "TraceEvents.h"
+#include <algorithm>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+RequestScheduler::RequestScheduler(shared_ptr<ConnectionPool> pool) :
+	m_pool(pool),
+	m_max_in_flight(16),
+	m_in_flight(0),
+	m_stats(LANES)
+{
+	m_public.tokens = m_public_limit.burst;
+	m_public.filled = Clock::now();
+	m_public.limit = &m_public_limit;
+	for (unsigned lane = 0; lane < LANES; ++lane)
+		m_wait_time[lane] = &Metrics::histogram("wex_queue_wait_seconds",
+			string("lane=\"") + name((Lane)lane) + "\"");
+}
+
+void RequestScheduler::set_limits(const Limit& account, const Limit& pub)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_account_limit = account;
+	m_public_limit = pub;
+	m_public.tokens = min(m_public.tokens, pub.burst);
+	for (auto& a : m_accounts)
+		a.second.tokens = min(a.second.tokens, account.burst);
+	m_served.notify_all();
+}
+
+void RequestScheduler::set_max_in_flight(unsigned count)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_max_in_flight = max(count, 1u);
+	m_served.notify_all();
+}
+
+const char* RequestScheduler::name(Lane lane)
+{
+	static const char* names[LANES] = { "cancel", "trade", "account", "status", "public" };
+	return names[lane];
+}
+
+RequestScheduler::Bucket& RequestScheduler::bucket(Lane lane, const string& account)
+{
+	if (lane == PUBLIC)
+		return m_public;
+	auto it = m_accounts.find(account);
+	if (it == m_accounts.end())
+	{
+		Bucket b;
+		b.tokens = m_account_limit.burst;
+		b.filled = Clock::now();
+		b.limit = &m_account_limit;
+		it = m_accounts.emplace(account, b).first;
+	}
+	return it->second;
+}
+
+void RequestScheduler::refill(Bucket& b, Clock::time_point now) const
+{
+	double seconds = chrono::duration<double>(now - b.filled).count();
+	b.tokens = min(b.limit->burst, b.tokens + seconds * b.limit->rate);
+	b.filled = now;
+}
+
+// The ticket to serve now, or null and the time a token comes in
+const RequestScheduler::Ticket* RequestScheduler::next(Clock::time_point now, Clock::time_point& retry)
+{
+	retry = Clock::time_point::max();
+	if (m_in_flight >= m_max_in_flight)
+		return nullptr;
+	for (unsigned lane = 0; lane < LANES; ++lane)
+	{
+		for (Ticket* t : m_lanes[lane])
+		{
+			Bucket& b = *t->bucket;
+			refill(b, now);
+			if (b.tokens >= 1.0)
+				return t;
+			if (b.limit->rate > 0.0)
+			{
+				chrono::duration<double> wait((1.0 - b.tokens) / b.limit->rate);
+				retry = min(retry, now + chrono::duration_cast<Clock::duration>(wait) + chrono::milliseconds(1));
+			}
+		}
+	}
+	return nullptr;
+}
+
+void RequestScheduler::acquire(Lane lane, const string& account)
+{
+	TraceSpan span("net", "queue", name(lane));
+	Clock::time_point start = Clock::now();
+	unique_lock<mutex> lock(m_mutex);
+	Ticket ticket{ &bucket(lane, account) };
+	LaneStats& s = m_stats[lane];
+	m_lanes[lane].push_back(&ticket);
+	s.max_queued = max(s.max_queued, ++s.queued);
+	Clock::time_point retry;
+	while (next(Clock::now(), retry) != &ticket)
+	{
+		if (retry == Clock::time_point::max())
+			m_served.wait(lock);
+		else
+			m_served.wait_until(lock, retry);
+	}
+	ticket.bucket->tokens -= 1.0;
+	++m_in_flight;
+	m_lanes[lane].erase(find(m_lanes[lane].begin(), m_lanes[lane].end(), &ticket));
+	--s.queued;
+	++s.requests;
+	Clock::duration elapsed = Clock::now() - start;
+	chrono::microseconds waited = chrono::duration_cast<chrono::microseconds>(elapsed);
+	m_wait_time[lane]->record(elapsed);
+	s.wait += waited;
+	s.max_wait = max(s.max_wait, waited);
+	// The next ticket may be servable too
+	m_served.notify_all();
+}
+
+void RequestScheduler::release()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		--m_in_flight;
+	}
+	m_served.notify_all();
+}
+
+string RequestScheduler::perform(ConnectionPool::Request& req, Lane lane, const string& account,
+	Histogram* latency, bool idempotent, bool* resent)
+{
+	return perform([&](ConnectionPool::Request& r) { r = req; }, lane, account, latency, idempotent, resent);
+}
+
+string RequestScheduler::perform(const Signer& sign, Lane lane, const string& account,
+	Histogram* latency, bool idempotent, bool* resent)
+{
+	acquire(lane, account);
+	string body;
+	try
+	{
+		ConnectionPool::Request req;
+		sign(req);
+		Clock::time_point start = Clock::now();
+		bool second = false;
+		body = m_pool->perform(req, idempotent, second);
+		if (resent)
+			*resent = second;
+		if (latency)
+			latency->record(Clock::now() - start);
+	}
+	catch (...)
+	{
+		release();
+		throw;
+	}
+	release();
+	return body;
+}
+
+string RequestScheduler::get(const string& target, Histogram* latency)
+{
+	promise<string> reply;
+	{
+		unique_lock<mutex> lock(m_merge_mutex);
+		auto it = m_pending_gets.find(target);
+		if (it != m_pending_gets.end())
+		{
+			shared_future<string> shared = it->second;
+			lock.unlock();
+			{
+				lock_guard<mutex> stats_lock(m_mutex);
+				++m_stats[PUBLIC].merged;
+			}
+			return shared.get();
+		}
+		m_pending_gets[target] = reply.get_future().share();
+	}
+	auto done = [&]()
+	{
+		lock_guard<mutex> lock(m_merge_mutex);
+		m_pending_gets.erase(target);
+	};
+	string body;
+	try
+	{
+		ConnectionPool::Request req{ boost::beast::http::verb::get, target, 11 };
+		body = perform(req, PUBLIC, string(), latency);
+	}
+	catch (...)
+	{
+		done();
+		reply.set_exception(current_exception());
+		throw;
+	}
+	done();
+	reply.set_value(body);
+	return body;
+}
+
+RequestScheduler::Stats RequestScheduler::stats() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_stats;
+}
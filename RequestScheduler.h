@@ -0,0 +1,121 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <functional>
+#include <condition_variable>
+#include <chrono>
+#include "ConnectionPool.h"
+#include "Metrics.h"
+
+// Gate in front of the connection pool which every request passes. Private
+// requests take a token from the bucket of their API key, public ones from a
+// bucket of their own, and at most max_in_flight requests are on the wire.
+// Waiting requests are served by lane, a lower lane first and in arrival
+// order within one, so cancels and trades overtake status polls and market
+// data. Identical public requests in flight at the same time share one reply.
+class RequestScheduler
+{
+public:
+	enum Lane
+	{
+		CANCEL,
+		TRADE,
+		ACCOUNT,    // balances
+		STATUS,     // order polls
+		PUBLIC,     // tickers, depth, pair info
+		LANES
+	};
+
+	struct Limit
+	{
+		double rate;        // tokens per second
+		double burst;       // bucket size
+
+		Limit(double rate = 10.0, double burst = 20.0) : rate(rate), burst(burst) {}
+	};
+
+	struct LaneStats
+	{
+		unsigned long long requests;
+		unsigned long long merged;      // public requests answered by another one in flight
+		unsigned queued;                // waiting right now
+		unsigned max_queued;
+		std::chrono::microseconds wait; // total time spent waiting
+		std::chrono::microseconds max_wait;
+
+		LaneStats() : requests(0), merged(0), queued(0), max_queued(0), wait(0), max_wait(0) {}
+	};
+
+	typedef std::vector<LaneStats> Stats;
+
+	explicit RequestScheduler(std::shared_ptr<ConnectionPool> pool);
+
+	// Limit of every API key and of the public requests
+	void set_limits(const Limit& account, const Limit& pub);
+	void set_max_in_flight(unsigned count);
+
+	// Sends the request once the lane is served. account names the token
+	// bucket of private requests and is ignored for the public lane. The
+	// time on the wire, without the wait, goes to latency when given.
+	// idempotent and resent are those of ConnectionPool::perform.
+	std::string perform(ConnectionPool::Request& req, Lane lane, const std::string& account,
+		Histogram* latency = nullptr, bool idempotent = true, bool* resent = nullptr);
+
+	// Fills in the request once the lane is served, just before it is sent
+	typedef std::function<void(ConnectionPool::Request&)> Signer;
+
+	// As above, with a request signed by sign after the wait, so that the
+	// nonces of an API key follow the order its requests leave in
+	std::string perform(const Signer& sign, Lane lane, const std::string& account,
+		Histogram* latency = nullptr, bool idempotent = true, bool* resent = nullptr);
+
+	// GET of a public target, merged with the same GET in flight
+	std::string get(const std::string& target, Histogram* latency = nullptr);
+
+	Stats stats() const;
+
+	static const char* name(Lane lane);
+
+private:
+	struct Bucket
+	{
+		double tokens;
+		std::chrono::steady_clock::time_point filled;
+		const Limit* limit;
+	};
+
+	struct Ticket
+	{
+		Bucket* bucket;
+	};
+
+	Bucket& bucket(Lane lane, const std::string& account);
+	void refill(Bucket& b, std::chrono::steady_clock::time_point now) const;
+	const Ticket* next(std::chrono::steady_clock::time_point now, std::chrono::steady_clock::time_point& retry);
+	void acquire(Lane lane, const std::string& account);
+	void release();
+
+	std::shared_ptr<ConnectionPool> m_pool;
+	Limit m_account_limit;
+	Limit m_public_limit;
+	unsigned m_max_in_flight;
+	unsigned m_in_flight;
+
+	mutable std::mutex m_mutex;
+	std::condition_variable m_served;
+	std::map<std::string, Bucket> m_accounts;
+	Bucket m_public;
+	std::deque<Ticket*> m_lanes[LANES];
+	Stats m_stats;
+	Histogram* m_wait_time[LANES];
+
+	std::mutex m_merge_mutex;
+	std::map<std::string, std::shared_future<std::string>> m_pending_gets;
+};
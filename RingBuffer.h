@@ -0,0 +1,81 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for many producers and a single consumer.
+// Every cell carries a sequence number telling whether it is free for the
+// producer of a given lap or filled for the consumer. Size must be a power of two.
+template<class T, size_t Size>
+class RingBuffer
+{
+	static_assert((Size & (Size - 1)) == 0, "RingBuffer size must be a power of two");
+
+	struct Cell
+	{
+		std::atomic<size_t> seq;
+		T data;
+	};
+
+public:
+	RingBuffer() : m_head(0), m_tail(0)
+	{
+		for (size_t i = 0; i < Size; ++i)
+			m_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+
+	// Calls fill(T&) on a reserved cell. Returns false if the buffer is full.
+	template<class F>
+	bool push(F fill)
+	{
+		size_t pos = m_head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = m_cells[pos & (Size - 1)];
+			size_t seq = cell.seq.load(std::memory_order_acquire);
+			intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+			if (diff == 0)
+			{
+				if (m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					fill(cell.data);
+					cell.seq.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+				return false;
+			else
+				pos = m_head.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Calls consume(const T&) on the oldest cell. Returns false if the buffer is empty.
+	// Must only be called by one thread at a time.
+	template<class F>
+	bool pop(F consume)
+	{
+		size_t pos = m_tail.load(std::memory_order_relaxed);
+		Cell& cell = m_cells[pos & (Size - 1)];
+		size_t seq = cell.seq.load(std::memory_order_acquire);
+		if ((intptr_t)seq - (intptr_t)(pos + 1) < 0)
+			return false;
+		consume(cell.data);
+		cell.seq.store(pos + Size, std::memory_order_release);
+		m_tail.store(pos + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	size_t size() const
+	{
+		return m_head.load(std::memory_order_relaxed) - m_tail.load(std::memory_order_relaxed);
+	}
+
+private:
+	Cell m_cells[Size];
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
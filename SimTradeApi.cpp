@@ -0,0 +1,272 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "SimTradeApi.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std;
+
+SimTradeApi::SimTradeApi(const TickerHistory& history,
+	const vector<PairParams>& params, double spread) :
+	m_history(history), m_spread(spread), m_row(0), m_next_id(1), m_tickers_row(string::npos)
+{
+	for (size_t i = 0; i < history.coins().size(); ++i)
+	{
+		CoinId id = CoinRegistry::intern(history.coins()[i]);
+		Coin& c = coin_slot(m_coins, id);
+		c.prices = history.prices(i);
+		c.params = coin_value(params, id);
+	}
+}
+
+const SimTradeApi::Coin& SimTradeApi::coin(CoinId id) const
+{
+	if (id >= m_coins.size() || !m_coins[id].prices)
+		throw runtime_error("No history for " + CoinRegistry::name(id));
+	return m_coins[id];
+}
+
+double SimTradeApi::price(CoinId id) const
+{
+	if (id == CoinRegistry::btc)
+		return 1.0;
+	return coin(id).prices[m_row];
+}
+
+void SimTradeApi::seek(size_t row)
+{
+	m_row = min(row, m_history.rows() - 1);
+	for (OpenOrder& o : m_open)
+		scan(o, m_row);
+	auto filled = stable_partition(m_open.begin(), m_open.end(),
+		[](const OpenOrder& o) { return o.fill_row == string::npos; });
+	for (auto it = filled; it != m_open.end(); ++it)
+		fill(*it);
+	m_open.erase(filled, m_open.end());
+}
+
+void SimTradeApi::deposit(CoinId coin, double amount)
+{
+	coin_slot(m_balances, coin) += amount;
+}
+
+const TradeApi::Tickers& SimTradeApi::tickers()
+{
+	if (m_tickers_row == m_row)
+		return m_tickers;
+	m_tickers.buyPrice.assign(m_coins.size(), 0.0);
+	m_tickers.sellPrice.assign(m_coins.size(), 0.0);
+	m_tickers.lastPrice.assign(m_coins.size(), 0.0);
+	for (CoinId id = 0; id < m_coins.size(); ++id)
+	{
+		if (!m_coins[id].prices)
+			continue;
+		// A zero price is a gap of the history, the coin has no ticker there
+		double p = m_coins[id].prices[m_row];
+		if (p <= 0.0)
+			continue;
+		m_tickers.lastPrice[id] = p;
+		m_tickers.buyPrice[id] = p * (1.0 + m_spread / 2);
+		m_tickers.sellPrice[id] = p * (1.0 - m_spread / 2);
+	}
+	m_tickers_row = m_row;
+	return m_tickers;
+}
+
+TradeApi::PairParams SimTradeApi::pairParams(CoinId id)
+{
+	return (id < m_coins.size()) ? m_coins[id].params : PairParams();
+}
+
+string SimTradeApi::validate(const Order& order, const Coin& c) const
+{
+	if (order.amount <= 0.0 || order.price <= 0.0)
+		return "Invalid order";
+	if (order.amount < c.params.min_amount)
+		return "Value " + order.coin + " must be greater than " + to_string(c.params.min_amount) + " " + order.coin + ".";
+	if ((c.params.min > 0.0 && order.price < c.params.min) ||
+		(c.params.max > 0.0 && order.price > c.params.max))
+		return "Price per " + order.coin + " is out of the allowed range.";
+	double funds = coin_value(m_balances, order.action == BUY ? CoinRegistry::btc : CoinRegistry::find(order.coin));
+	double needed = (order.action == BUY) ? order.amount * order.price : order.amount;
+	if (needed > funds)
+		return "It is not enough " + string(order.action == BUY ? "btc" : order.coin) + " in the account for sale.";
+	return string();
+}
+
+void SimTradeApi::scan(OpenOrder& o, size_t to) const
+{
+	// A buy fills once the ask drops to the order price, a sell once the bid reaches it
+	bool buy = o.order.action == BUY;
+	double limit = buy ? o.order.price / (1.0 + m_spread / 2) :
+		o.order.price / (1.0 - m_spread / 2);
+	const double* prices = m_coins[o.coin].prices;
+	to = min(to, m_history.rows() - 1);
+	for (; o.fill_row == string::npos && o.checked <= to; ++o.checked)
+	{
+		if (prices[o.checked] > 0.0 && (buy ? prices[o.checked] <= limit : prices[o.checked] >= limit))
+			o.fill_row = o.checked;
+	}
+}
+
+void SimTradeApi::fill(const OpenOrder& o)
+{
+	double fee = m_coins[o.coin].params.fee / 100.0;
+	double value = o.order.amount * o.order.price;
+	if (o.order.action == BUY)
+		m_balances[o.coin] += o.order.amount * (1.0 - fee);
+	else
+		m_balances[CoinRegistry::btc] += value * (1.0 - fee);
+	++m_stats.filled;
+	m_stats.turnover += value;
+	m_stats.fees += value * fee;
+}
+
+void SimTradeApi::release(const OpenOrder& o)
+{
+	if (o.order.action == BUY)
+		m_balances[CoinRegistry::btc] += o.order.amount * o.order.price;
+	else
+		m_balances[o.coin] += o.order.amount;
+}
+
+long long SimTradeApi::createOrder(const Order& order)
+{
+	CoinId id = CoinRegistry::find(order.coin);
+	const Coin& c = coin(id);
+	++m_stats.orders;
+	string err = validate(order, c);
+	if (err.size())
+	{
+		++m_stats.rejected;
+		throw runtime_error(err);
+	}
+	OpenOrder o;
+	o.id = m_next_id++;
+	o.order = order;
+	o.coin = id;
+	o.checked = m_row;
+	o.fill_row = string::npos;
+	scan(o, m_row);
+	// Funds of an open order are not available
+	coin_slot(m_balances, id);
+	if (order.action == BUY)
+		coin_slot(m_balances, CoinRegistry::btc) -= order.amount * order.price;
+	else
+		m_balances[id] -= order.amount;
+	if (o.fill_row != string::npos)
+		fill(o);
+	else
+		m_open.push_back(o);
+	return o.id;
+}
+
+void SimTradeApi::deleteOrder(long long id)
+{
+	for (auto it = m_open.begin(); it != m_open.end(); ++it)
+	{
+		if (it->id == id)
+		{
+			release(*it);
+			m_open.erase(it);
+			return;
+		}
+	}
+	throw runtime_error("Bad status");
+}
+
+bool SimTradeApi::checkOrder(long long id, const string&)
+{
+	for (const OpenOrder& o : m_open)
+	{
+		if (o.id == id)
+			return true;
+	}
+	return false;
+}
+
+void SimTradeApi::cancelCurrentOrders()
+{
+	for (const OpenOrder& o : m_open)
+		release(o);
+	m_open.clear();
+}
+
+vector<TradeApi::OrderResult> SimTradeApi::execute(const vector<Order>& orders, unsigned timeout)
+{
+	vector<OrderResult> results;
+	auto place = [&](const Order& order)
+	{
+		OrderResult r;
+		r.order = order;
+		try
+		{
+			r.id = createOrder(order);
+		}
+		catch (const exception& e)
+		{
+			r.error = e.what();
+		}
+		results.push_back(r);
+	};
+	vector<Order> now, later;
+	splitFunded(orders, coin_value(m_balances, CoinRegistry::btc), now, later);
+	for (const Order& o : now)
+		place(o);
+
+	size_t deadline = min(m_row + timeout, m_history.rows() - 1);
+	if (!later.empty())
+	{
+		// The rest of the buys wait for the sells to fill
+		size_t sold = m_row;
+		bool filled = true;
+		for (OpenOrder& o : m_open)
+		{
+			if (o.order.action != SELL)
+				continue;
+			scan(o, deadline);
+			filled = filled && o.fill_row != string::npos;
+			if (o.fill_row != string::npos)
+				sold = max(sold, o.fill_row);
+		}
+		if (filled)
+		{
+			seek(sold);
+			for (const Order& o : later)
+				place(o);
+		}
+		else
+		{
+			for (const Order& o : later)
+			{
+				OrderResult r;
+				r.order = o;
+				r.error = "Not placed, the sells did not fill in time";
+				results.push_back(r);
+			}
+		}
+	}
+
+	// Wait for the last fill or the timeout, whichever comes first
+	size_t settled = m_row;
+	for (OpenOrder& o : m_open)
+	{
+		scan(o, deadline);
+		settled = max(settled, (o.fill_row != string::npos) ? o.fill_row : deadline);
+	}
+	seek(settled);
+
+	for (OrderResult& r : results)
+	{
+		if (!r.id)
+			continue;
+		if (checkOrder(r.id, r.order.coin))
+		{
+			deleteOrder(r.id);
+			r.cancelled = true;
+		}
+		else
+			r.executed = true;
+	}
+	return results;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "TradeApi.h"
+#include "TickerHistory.h"
+
+// In-memory exchange replaying a TickerHistory. Time is a row of the
+// history: prices are read at the current row and a limit order is filled
+// at the first row where the market crosses its price. Fees are taken from
+// the received currency as on WEX, and an order is rejected when the
+// account lacks the funds or the amount is below the pair minimum.
+class SimTradeApi : public TradeApi
+{
+public:
+	struct Stats
+	{
+		unsigned long long orders;
+		unsigned long long filled;
+		unsigned long long rejected;
+		double turnover;    // BTC value of the filled orders
+		double fees;        // in BTC
+
+		Stats() : orders(0), filled(0), rejected(0), turnover(0.0), fees(0.0) {}
+	};
+
+	// Spread is the distance between the ask and the bid prices relative
+	// to the recorded price. Pair parameters are indexed by CoinId.
+	SimTradeApi(const TickerHistory& history,
+		const std::vector<PairParams>& params, double spread);
+
+	size_t row() const
+	{
+		return m_row;
+	}
+
+	// Moves the clock forward and fills the open orders crossed on the way
+	void seek(size_t row);
+
+	void deposit(CoinId coin, double amount);
+
+	// Price in BTC at the current row, 1 for btc itself and 0 where the
+	// history has no price
+	double price(CoinId coin) const;
+
+	const Stats& stats() const
+	{
+		return m_stats;
+	}
+
+	virtual const CoinValues& balances()
+	{
+		return m_balances;
+	}
+	virtual const Tickers& tickers();
+	virtual PairParams pairParams(CoinId coin);
+
+	// Places the orders, waits up to timeout rows for them to fill and
+	// cancels the rest. The clock stops at the row the last order was settled.
+	virtual std::vector<OrderResult> execute(const std::vector<Order>& orders, unsigned timeout);
+	virtual long long createOrder(const Order& order);
+	virtual void deleteOrder(long long id);
+	virtual bool checkOrder(long long id, const std::string& coin);
+	virtual void cancelCurrentOrders();
+	virtual void refresh() {}
+
+private:
+	struct Coin
+	{
+		const double* prices;   // nullptr for coins not in the history
+		PairParams params;
+
+		Coin() : prices(nullptr) {}
+	};
+
+	struct OpenOrder
+	{
+		long long id;
+		Order order;
+		CoinId coin;
+		size_t checked;     // rows before this one do not cross the price
+		size_t fill_row;    // npos until found
+	};
+
+	const Coin& coin(CoinId id) const;
+	// Checks the funds and pair limits, returns an error text or an empty one
+	std::string validate(const Order& order, const Coin& c) const;
+	// Looks for the fill up to the given row, the price is checked once per row
+	void scan(OpenOrder& o, size_t to) const;
+	void fill(const OpenOrder& o);
+	void release(const OpenOrder& o);
+
+	const TickerHistory& m_history;
+	std::vector<Coin> m_coins;
+	double m_spread;
+	size_t m_row;
+	long long m_next_id;
+	CoinValues m_balances;
+	Tickers m_tickers;
+	size_t m_tickers_row;   // row m_tickers were filled for
+	std::vector<OpenOrder> m_open;
+	Stats m_stats;
+};
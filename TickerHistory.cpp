@@ -0,0 +1,208 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "TickerHistory.h"
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <charconv>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/interprocess/exceptions.hpp>
+
+namespace bip = boost::interprocess;
+using namespace std;
+
+static const char magic[8] = { 'W', 'E', 'X', 'T', 'I', 'C', 'K', 0 };
+static const uint32_t version = 1;
+static const size_t name_size = 16;
+
+struct TickerHistory::Header
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t coins;
+	uint64_t rows;
+	// followed by coin names of name_size bytes, the time column
+	// and one price column per coin
+};
+
+TickerHistory::TickerHistory() :
+	m_rows(0), m_times(nullptr), m_prices(nullptr)
+{
+}
+
+size_t TickerHistory::find(const string& coin) const
+{
+	for (size_t i = 0; i < m_coins.size(); ++i)
+	{
+		if (m_coins[i] == coin)
+			return i;
+	}
+	return m_coins.size();
+}
+
+void TickerHistory::load(const string& path)
+{
+	if (!loadBinary(path))
+		loadCsv(path);
+}
+
+bool TickerHistory::loadBinary(const string& path)
+{
+	try
+	{
+		bip::file_mapping file(path.c_str(), bip::read_only);
+		bip::mapped_region region(file, bip::read_only);
+		if (region.get_size() < sizeof(Header))
+			return false;
+		const Header* h = static_cast<const Header*>(region.get_address());
+		size_t names = h->coins * name_size;
+		if (memcmp(h->magic, magic, sizeof(magic)) || h->version != version ||
+			region.get_size() < sizeof(Header) + names + h->rows * (h->coins + 1) * 8)
+			return false;
+		const char* name = reinterpret_cast<const char*>(h + 1);
+		m_coins.clear();
+		for (uint32_t i = 0; i < h->coins; ++i, name += name_size)
+			m_coins.push_back(string(name, strnlen(name, name_size)));
+		m_rows = h->rows;
+		m_times = reinterpret_cast<const int64_t*>(name);
+		m_prices = reinterpret_cast<const double*>(m_times + m_rows);
+		m_time_data.clear();
+		m_price_data.clear();
+		m_file.swap(file);
+		m_region.swap(region);
+		return true;
+	}
+	catch (const bip::interprocess_exception&)
+	{
+		return false;
+	}
+}
+
+void TickerHistory::loadCsv(const string& path)
+{
+	ifstream f(path, ios::binary);
+	if (!f.is_open())
+		throw runtime_error("Failed to open file " + path);
+	stringstream ss;
+	ss << f.rdbuf();
+	string text = ss.str();
+
+	const char* pos = text.data();
+	const char* end = pos + text.size();
+	auto line_end = [&]() { return std::find(pos, end, '\n'); };
+
+	const char* eol = line_end();
+	string header(pos, eol);
+	if (!header.empty() && header.back() == '\r')
+		header.pop_back();
+	pos = (eol < end) ? eol + 1 : end;
+	vector<string> coins;
+	{
+		istringstream hs(header);
+		string field;
+		getline(hs, field, ',');
+		while (getline(hs, field, ','))
+			coins.push_back(field);
+	}
+	if (coins.empty())
+		throw runtime_error("No coins in the header of " + path);
+
+	// Rows go to per coin columns straight away
+	vector<int64_t> times;
+	vector<vector<double>> columns(coins.size());
+	vector<double> last(coins.size(), 0.0);
+	vector<bool> known(coins.size(), false);
+	unsigned line = 1;
+	while (pos < end)
+	{
+		eol = line_end();
+		++line;
+		if (eol == pos || (eol - pos == 1 && *pos == '\r'))
+		{
+			pos = eol + 1;
+			continue;
+		}
+		int64_t t = 0;
+		from_chars_result r = from_chars(pos, eol, t);
+		if (r.ec != errc())
+			throw runtime_error(path + ":" + to_string(line) + ": time expected");
+		pos = r.ptr;
+		for (size_t c = 0; c < coins.size(); ++c)
+		{
+			if (pos >= eol || *pos != ',')
+				throw runtime_error(path + ":" + to_string(line) + ": " + coins[c] + " missing");
+			++pos;
+			if (pos < eol && *pos != ',' && *pos != '\r')
+			{
+				r = from_chars(pos, eol, last[c]);
+				if (r.ec != errc())
+					throw runtime_error(path + ":" + to_string(line) + ": bad " + coins[c] + " price");
+				pos = r.ptr;
+				// Rows before the first price of the coin take that price
+				if (!known[c])
+				{
+					fill(columns[c].begin(), columns[c].end(), last[c]);
+					known[c] = true;
+				}
+			}
+			columns[c].push_back(last[c]);
+		}
+		times.push_back(t);
+		pos = (eol < end) ? eol + 1 : end;
+	}
+	for (size_t c = 0; c < coins.size(); ++c)
+	{
+		if (!known[c] && !times.empty())
+			throw runtime_error("No " + coins[c] + " price in " + path);
+	}
+
+	m_coins = coins;
+	m_rows = times.size();
+	m_time_data.swap(times);
+	m_price_data.clear();
+	m_price_data.reserve(m_rows * coins.size());
+	for (auto& column : columns)
+		m_price_data.insert(m_price_data.end(), column.begin(), column.end());
+	m_times = m_time_data.data();
+	m_prices = m_price_data.data();
+	bip::mapped_region region;
+	bip::file_mapping file;
+	m_region.swap(region);
+	m_file.swap(file);
+}
+
+void TickerHistory::saveBinary(const string& path) const
+{
+	Header h;
+	memcpy(h.magic, magic, sizeof(magic));
+	h.version = version;
+	h.coins = (uint32_t)m_coins.size();
+	h.rows = m_rows;
+
+	string tmp = path + ".tmp";
+	{
+		ofstream f(tmp, ios::binary | ios::trunc);
+		if (!f.is_open())
+			throw runtime_error("Failed to open file " + tmp);
+		f.write(reinterpret_cast<const char*>(&h), sizeof(h));
+		for (const string& coin : m_coins)
+		{
+			if (coin.size() >= name_size)
+				throw runtime_error("Coin name too long: " + coin);
+			char name[name_size] = {};
+			memcpy(name, coin.data(), coin.size());
+			f.write(name, sizeof(name));
+		}
+		f.write(reinterpret_cast<const char*>(m_times), m_rows * sizeof(int64_t));
+		f.write(reinterpret_cast<const char*>(m_prices), m_rows * m_coins.size() * sizeof(double));
+		if (!f)
+			throw runtime_error("Failed to write file " + tmp);
+	}
+#ifdef _WIN32
+	remove(path.c_str());
+#endif
+	if (rename(tmp.c_str(), path.c_str()))
+		throw runtime_error("Failed to rename " + tmp);
+}
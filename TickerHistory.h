@@ -0,0 +1,69 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+// Recorded coin prices in BTC at regular points of time. Prices of one coin
+// are kept in one contiguous column, so replaying a coin walks memory in order.
+//
+// The text form is a CSV file with a "time,<coin>,<coin>..." header and one
+// row per point: unix time followed by the price of every coin. An empty
+// field repeats the previous price, leading empty fields take the first
+// one. The binary form is a header, the coin names, the time column and the
+// price columns, and is memory mapped as is.
+class TickerHistory
+{
+public:
+	TickerHistory();
+
+	// Picks the format by the file contents
+	void load(const std::string& path);
+	void loadCsv(const std::string& path);
+	// Maps a binary file. Returns false if it is not one.
+	bool loadBinary(const std::string& path);
+
+	void saveBinary(const std::string& path) const;
+
+	const std::vector<std::string>& coins() const
+	{
+		return m_coins;
+	}
+
+	size_t rows() const
+	{
+		return m_rows;
+	}
+
+	int64_t time(size_t row) const
+	{
+		return m_times[row];
+	}
+
+	// Price column of the coin with the given index in coins()
+	const double* prices(size_t coin) const
+	{
+		return m_prices + coin * m_rows;
+	}
+
+	// Index in coins(), coins().size() if the coin is not recorded
+	size_t find(const std::string& coin) const;
+
+private:
+	struct Header;
+
+	std::vector<std::string> m_coins;
+	size_t m_rows;
+	const int64_t* m_times;
+	const double* m_prices;
+
+	// Storage of a CSV file, a binary one stays in the mapping
+	std::vector<int64_t> m_time_data;
+	std::vector<double> m_price_data;
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+};
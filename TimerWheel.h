@@ -0,0 +1,179 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// Event loop of timed tasks. Deadlines are hashed into a ring of slots one
+// tick wide, so scheduling and cancelling cost the same for any number of
+// timers and a deadline is met within one tick. Tasks run on the thread
+// inside run(); any thread, a task included, may schedule or cancel.
+class TimerWheel
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+	typedef std::function<void()> Task;
+
+	explicit TimerWheel(Clock::duration tick = std::chrono::milliseconds(10), size_t slots = 1024) :
+		m_tick(tick), m_slots(slots), m_origin(Clock::now()), m_cursor(0), m_next_id(1), m_stop(false)
+	{
+	}
+
+	Clock::duration tick() const
+	{
+		return m_tick;
+	}
+
+	// Returns an id for cancel()
+	uint64_t schedule(Clock::time_point deadline, Task task)
+	{
+		uint64_t id;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			id = m_next_id++;
+			// A deadline in the past runs on the next turn of the loop
+			uint64_t t = std::max(ticks(deadline), m_cursor);
+			size_t slot = t % m_slots.size();
+			m_slots[slot].push_back(Entry{ id, deadline, std::move(task) });
+			m_where[id] = slot;
+		}
+		m_wake.notify_all();
+		return id;
+	}
+
+	uint64_t after(Clock::duration delay, Task task)
+	{
+		return schedule(Clock::now() + delay, std::move(task));
+	}
+
+	// False if the task already ran or was cancelled
+	bool cancel(uint64_t id)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_where.find(id);
+		if (it == m_where.end())
+			return false;
+		std::vector<Entry>& slot = m_slots[it->second];
+		for (size_t i = 0; i < slot.size(); ++i)
+		{
+			if (slot[i].id == id)
+			{
+				slot[i] = std::move(slot.back());
+				slot.pop_back();
+				break;
+			}
+		}
+		m_where.erase(it);
+		return true;
+	}
+
+	size_t pending() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_where.size();
+	}
+
+	// Runs the tasks as they come due until stop() is called or until the
+	// given time. Tasks which throw end the loop with their exception.
+	void run(Clock::time_point until = Clock::time_point::max())
+	{
+		std::vector<Task> due;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop = false;
+		while (!m_stop)
+		{
+			Clock::time_point now = Clock::now();
+			uint64_t now_tick = ticks(now);
+			// Visit every slot passed since the last turn, a full turn at most
+			uint64_t last = std::min(now_tick, m_cursor + m_slots.size() - 1);
+			for (uint64_t t = m_cursor; t <= last; ++t)
+				collect(m_slots[t % m_slots.size()], now, due);
+			m_cursor = now_tick;
+			if (!due.empty())
+			{
+				lock.unlock();
+				for (Task& task : due)
+					task();
+				due.clear();
+				lock.lock();
+				continue;
+			}
+			if (now >= until)
+				break;
+			m_wake.wait_until(lock, std::min(until, nextWake(now)));
+		}
+	}
+
+	// Makes run() return once the task running now is done
+	void stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+	}
+
+private:
+	struct Entry
+	{
+		uint64_t id;
+		Clock::time_point deadline;
+		Task task;
+	};
+
+	uint64_t ticks(Clock::time_point t) const
+	{
+		return (t <= m_origin) ? 0 : (uint64_t)((t - m_origin) / m_tick);
+	}
+
+	// Moves the tasks of the slot due by now to due, entries of later turns stay
+	void collect(std::vector<Entry>& slot, Clock::time_point now, std::vector<Task>& due)
+	{
+		for (size_t i = 0; i < slot.size(); )
+		{
+			if (slot[i].deadline > now)
+			{
+				++i;
+				continue;
+			}
+			due.push_back(std::move(slot[i].task));
+			m_where.erase(slot[i].id);
+			slot[i] = std::move(slot.back());
+			slot.pop_back();
+		}
+	}
+
+	// Start of the first tick with a timer, the end of a turn if there is none
+	Clock::time_point nextWake(Clock::time_point now) const
+	{
+		uint64_t t = m_cursor + 1;
+		if (!m_where.empty())
+		{
+			for (; t < m_cursor + m_slots.size(); ++t)
+			{
+				if (!m_slots[t % m_slots.size()].empty())
+					break;
+			}
+		}
+		else
+			t = m_cursor + m_slots.size();
+		return std::max(now, m_origin + m_tick * (Clock::rep)t);
+	}
+
+	Clock::duration m_tick;
+	std::vector<std::vector<Entry>> m_slots;
+	Clock::time_point m_origin;
+	uint64_t m_cursor;      // first tick not visited yet
+	uint64_t m_next_id;
+	std::unordered_map<uint64_t, size_t> m_where;   // slot of each timer
+	bool m_stop;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wake;
+};
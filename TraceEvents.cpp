@@ -0,0 +1,189 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "TraceEvents.h"
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+atomic<bool> TraceEvents::s_enabled(false);
+
+namespace
+{
+	// A daemon left tracing for days stops recording instead of eating memory
+	const size_t max_events = 1 << 20;
+
+	struct Event
+	{
+		const char* category;
+		string name;
+		string detail;
+		TraceEvents::Clock::time_point start;
+		TraceEvents::Clock::duration duration;
+	};
+
+	// Events of one thread. The lock is only ever contended by write().
+	struct Buffer
+	{
+		mutex lock;
+		vector<Event> events;
+		unsigned tid;
+		string name;
+		size_t dropped;
+
+		Buffer() : tid(0), dropped(0) {}
+	};
+
+	struct Registry
+	{
+		mutex lock;
+		vector<shared_ptr<Buffer>> buffers;
+		string path;
+		TraceEvents::Clock::time_point origin;
+	};
+
+	Registry& registry()
+	{
+		static Registry r;
+		return r;
+	}
+
+	// Buffers are shared with the registry, so events of threads which
+	// have already finished are still written
+	Buffer& buffer()
+	{
+		static thread_local shared_ptr<Buffer> local;
+		if (!local)
+		{
+			local = make_shared<Buffer>();
+			Registry& r = registry();
+			lock_guard<mutex> lock(r.lock);
+			r.buffers.push_back(local);
+			local->tid = (unsigned)r.buffers.size();
+			local->name = "thread " + to_string(local->tid);
+		}
+		return *local;
+	}
+
+	void write_string(ostream& os, const string& s)
+	{
+		os << '"';
+		for (char c : s)
+		{
+			if (c == '"' || c == '\\')
+				os << '\\' << c;
+			else if ((unsigned char)c < 0x20)
+			{
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", (unsigned)c);
+				os << code;
+			}
+			else
+				os << c;
+		}
+		os << '"';
+	}
+
+	void write_at_exit()
+	{
+		try
+		{
+			TraceEvents::write();
+		}
+		catch (const exception& e)
+		{
+			cerr << e.what() << endl;
+		}
+	}
+}
+
+void TraceEvents::enable(const string& path)
+{
+	Registry& r = registry();
+	buffer();
+	{
+		lock_guard<mutex> lock(r.lock);
+		bool first = r.path.empty();
+		r.path = path;
+		r.origin = Clock::now();
+		if (first)
+			atexit(write_at_exit);
+	}
+	set_thread_name("main");
+	s_enabled.store(true, memory_order_relaxed);
+}
+
+void TraceEvents::complete(const char* category, string_view name,
+	Clock::time_point start, Clock::time_point end, string_view detail)
+{
+	if (!enabled())
+		return;
+	Buffer& b = buffer();
+	lock_guard<mutex> lock(b.lock);
+	if (b.events.size() == max_events)
+	{
+		++b.dropped;
+		return;
+	}
+	b.events.push_back(Event{ category, string(name), string(detail), start, end - start });
+}
+
+void TraceEvents::set_thread_name(const string& name)
+{
+	Buffer& b = buffer();
+	lock_guard<mutex> lock(b.lock);
+	b.name = name;
+}
+
+void TraceEvents::write()
+{
+	Registry& r = registry();
+	lock_guard<mutex> lock(r.lock);
+	if (r.path.empty())
+		return;
+	ofstream f(r.path, ios::trunc);
+	if (!f.is_open())
+		throw runtime_error("Failed to open file " + r.path);
+	// Timestamps are microseconds since enable(), with nanosecond fractions
+	auto us = [](Clock::duration d)
+	{
+		return chrono::duration_cast<chrono::nanoseconds>(d).count() / 1000.0;
+	};
+	f << fixed << setprecision(3);
+	f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+	f << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"wex_manager\"}}";
+	for (const shared_ptr<Buffer>& b : r.buffers)
+	{
+		lock_guard<mutex> buffer_lock(b->lock);
+		f << "," << endl << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << b->tid
+			<< ",\"args\":{\"name\":";
+		write_string(f, b->name);
+		f << "}}";
+		for (const Event& e : b->events)
+		{
+			f << "," << endl << "{\"name\":";
+			write_string(f, e.name);
+			f << ",\"cat\":\"" << e.category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << us(e.start - r.origin) << ",\"dur\":" << us(e.duration);
+			if (!e.detail.empty())
+			{
+				f << ",\"args\":{\"detail\":";
+				write_string(f, e.detail);
+				f << "}";
+			}
+			f << "}";
+		}
+		if (b->dropped)
+			cerr << "Trace buffer of " << b->name << " was full, " << b->dropped << " spans dropped" << endl;
+	}
+	f << endl << "]}" << endl;
+	if (!f)
+		throw runtime_error("Failed to write file " + r.path);
+}
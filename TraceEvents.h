@@ -0,0 +1,74 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <chrono>
+#include <atomic>
+
+// Timeline of a run in the Chrome trace-event format, for chrome://tracing
+// and ui.perfetto.dev. Spans are appended to a buffer of the recording
+// thread, so threads never wait for each other, and all buffers are
+// written as one JSON file at exit. Nothing is recorded until enable().
+class TraceEvents
+{
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Starts recording, the file is written when the process exits
+	static void enable(const std::string& path);
+	static bool enabled()
+	{
+		return s_enabled.load(std::memory_order_relaxed);
+	}
+
+	// A span of the calling thread, detail is shown in the viewer as its argument
+	static void complete(const char* category, std::string_view name,
+		Clock::time_point start, Clock::time_point end, std::string_view detail = std::string_view());
+	// Name of the calling thread in the viewer
+	static void set_thread_name(const std::string& name);
+
+	// Writes the events recorded so far, done at exit by enable()
+	static void write();
+
+private:
+	static std::atomic<bool> s_enabled;
+};
+
+// Records the enclosing scope as a span when tracing is enabled
+class TraceSpan
+{
+public:
+	TraceSpan(const char* category, std::string_view name, std::string_view detail = std::string_view()) :
+		m_category(nullptr)
+	{
+		if (!TraceEvents::enabled())
+			return;
+		m_category = category;
+		m_name = name;
+		m_detail = detail;
+		m_start = TraceEvents::Clock::now();
+	}
+	~TraceSpan()
+	{
+		end();
+	}
+
+	// Ends the span before the scope does
+	void end()
+	{
+		if (m_category)
+			TraceEvents::complete(m_category, m_name, m_start, TraceEvents::Clock::now(), m_detail);
+		m_category = nullptr;
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* m_category;
+	std::string m_name;
+	std::string m_detail;
+	TraceEvents::Clock::time_point m_start;
+};
@@ -0,0 +1,91 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "TradeApi.h"
+#include <stdexcept>
+
+using namespace std;
+
+double TradeApi::balance(const string& coin)
+{
+	const CoinValues& b = balances();
+	CoinId id = CoinRegistry::find(coin);
+	if (id == CoinRegistry::none)
+		throw runtime_error("Invalid coin");
+	return coin_value(b, id);
+}
+
+TradeApi::CoinInfo TradeApi::info(CoinId coin)
+{
+	const Tickers& t = tickers();
+	CoinInfo ci;
+	ci.coin = CoinRegistry::name(coin);
+	ci.buyPrice = coin_value(t.buyPrice, coin);
+	ci.sellPrice = coin_value(t.sellPrice, coin);
+	ci.lastPrice = coin_value(t.lastPrice, coin);
+	if (ci.buyPrice == 0.0 && ci.sellPrice == 0.0)
+		throw runtime_error("Invalid coin");
+	return ci;
+}
+
+TradeApi::CoinInfo TradeApi::info(const string& coin)
+{
+	// Reading the tickers registers the coins of the pairs
+	tickers();
+	return info(CoinRegistry::find(coin));
+}
+
+void TradeApi::splitFunded(const vector<Order>& orders, double funds,
+	vector<Order>& now, vector<Order>& later)
+{
+	for (const Order& o : orders)
+	{
+		if (o.action == BUY)
+		{
+			double cost = o.price * o.amount;
+			if (cost > funds)
+			{
+				later.push_back(o);
+				continue;
+			}
+			funds -= cost;
+		}
+		now.push_back(o);
+	}
+}
+
+bool TradeApi::sellsSettled(const vector<OrderResult>& results)
+{
+	for (const OrderResult& r : results)
+	{
+		if (r.order.action == SELL && !r.executed && !r.cancelled && r.error.empty())
+			return false;
+	}
+	return true;
+}
+
+map<string, double> TradeApi::nonZeroBalances()
+{
+	const CoinValues& amounts = balances();
+	map<string, double> res;
+	for (CoinId id = 0; id < amounts.size(); ++id)
+	{
+		if (amounts[id] != 0.0)
+			res[CoinRegistry::name(id)] = amounts[id];
+	}
+	return res;
+}
+
+map<string, double> TradeApi::nonZeroBalancesInBTC()
+{
+	const CoinValues& amounts = balances();
+	const Tickers& t = tickers();
+	map<string, double> res;
+	for (CoinId id = 0; id < amounts.size(); ++id)
+	{
+		if (amounts[id] == 0.0)
+			continue;
+		res[CoinRegistry::name(id)] = (id == CoinRegistry::btc) ? amounts[id] :
+			amounts[id] * (coin_value(t.buyPrice, id) + coin_value(t.sellPrice, id)) / 2;
+	}
+	return res;
+}
@@ -1,48 +1,111 @@
-// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#pragma once
-
-#include <string>
-#include <vector>
-
-class TradeApi
-{
-public:
-	enum Operation
-	{
-		BUY, 
-		SELL
-	};
-
-	struct Order
-	{
-		std::string coin;
-		double amount;
-		double price;
-		Operation action;
-
-		Order() : amount(0.0), price(0.0), action(BUY) {}
-	};
-
-	struct CoinInfo
-	{
-		std::string coin;
-		double buyPrice;
-		double sellPrice;
-		double lastPrice;
-
-		CoinInfo() : buyPrice(0.0), sellPrice(0.0), lastPrice(0.0) {}
-	};
-
-	virtual double balance(const std::string& coin) = 0;
-	virtual CoinInfo info(const std::string& coin) = 0;
-	virtual std::map<std::string, double> nonZeroBalances() = 0;
-	virtual std::map<std::string, double> nonZeroBalancesInBTC() = 0;
-
-	virtual bool execute(const std::vector<Order>& orders, unsigned timeout) = 0;
-	virtual long long createOrder(const Order& order) = 0;
-        virtual void deleteOrder(long long id) = 0;
-	virtual bool checkOrder(long long id, const std::string& coin) = 0;
-        virtual void cancelCurrentOrders() = 0;
-};
-
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include "CoinRegistry.h"
+
+class TradeApi
+{
+public:
+	// Values per coin indexed by CoinId, coins past the end have zero
+	typedef std::vector<double> CoinValues;
+
+	enum Operation
+	{
+		BUY, 
+		SELL
+	};
+
+	struct Order
+	{
+		std::string coin;
+		double amount;
+		double price;
+		Operation action;
+
+		Order() : amount(0.0), price(0.0), action(BUY) {}
+	};
+
+	struct CoinInfo
+	{
+		std::string coin;
+		double buyPrice;
+		double sellPrice;
+		double lastPrice;
+
+		CoinInfo() : buyPrice(0.0), sellPrice(0.0), lastPrice(0.0) {}
+	};
+
+	// Prices of all coins in BTC, one array per field. A coin without a
+	// ticker has zero prices.
+	struct Tickers
+	{
+		CoinValues buyPrice;
+		CoinValues sellPrice;
+		CoinValues lastPrice;
+	};
+
+	// Trading rules of the coin/BTC pair
+	struct PairParams
+	{
+		unsigned decimal_places;
+		double min;
+		double max;
+		double fee;
+		double min_amount;
+		bool reverted; // traded as btc_<coin>
+
+		PairParams() : decimal_places(8), min(0.0), max(0.0), fee(0.0), min_amount(0.0), reverted(false) {}
+	};
+
+	struct OrderResult
+	{
+		Order order;
+		long long id;
+		bool executed;
+		bool cancelled;
+		std::string error;
+
+		OrderResult() : id(0), executed(false), cancelled(false) {}
+	};
+
+	virtual ~TradeApi() {}
+
+	// Amounts on the account
+	virtual const CoinValues& balances() = 0;
+	virtual const Tickers& tickers() = 0;
+	// Trading rules of the coin/BTC pair, the defaults for an unknown pair
+	virtual PairParams pairParams(CoinId coin) = 0;
+
+	// Throws for a coin no exchange reply has named, zero for a coin the
+	// account does not hold
+	double balance(const std::string& coin);
+	// Throws if the coin has no ticker
+	CoinInfo info(CoinId coin);
+	CoinInfo info(const std::string& coin);
+	std::map<std::string, double> nonZeroBalances();
+	// BTC value of the balances at the middle of buy and sell prices
+	std::map<std::string, double> nonZeroBalancesInBTC();
+
+	// Places the orders and waits up to timeout for them to fill. Buys the
+	// BTC on the account can't pay for are placed once the sells have filled.
+	virtual std::vector<OrderResult> execute(const std::vector<Order>& orders, unsigned timeout) = 0;
+	virtual long long createOrder(const Order& order) = 0;
+        virtual void deleteOrder(long long id) = 0;
+	virtual bool checkOrder(long long id, const std::string& coin) = 0;
+        virtual void cancelCurrentOrders() = 0;
+	// Drops cached balances and prices, the next query fetches them again
+	virtual void refresh() = 0;
+
+	// Steps of execute(), also used by Accounts.
+	// Splits the orders into the ones funds of BTC pay for, in list order,
+	// and the buys which need the BTC of the sells
+	static void splitFunded(const std::vector<Order>& orders, double funds,
+		std::vector<Order>& now, std::vector<Order>& later);
+	// True when no sell in results can still fill
+	static bool sellsSettled(const std::vector<OrderResult>& results);
+};
+
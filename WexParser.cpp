@@ -0,0 +1,269 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "WexParser.h"
+#include "JsonReader.h"
+
+using namespace std;
+
+typedef TradeApi::PairParams PairParams;
+typedef TradeApi::CoinInfo CoinInfo;
+
+// Splits "<coin>_btc" or "btc_<coin>" into the coin and the direction
+static string_view pair_coin(string_view pair_name, bool& reverted)
+{
+	reverted = pair_name.substr(0, 4) == "btc_";
+	if (!reverted)
+		return pair_name.substr(0, pair_name.find('_'));
+	return pair_name.substr(pair_name.find('_') + 1);
+}
+
+static bool is_token(string_view name)
+{
+	if (name.length() < 2)
+		return false;
+	return name.substr(name.length() - 2) == "et";
+}
+
+// Walks a private API reply and hands the reader positioned at the
+// "return" value to read_return. Returns the "error" text.
+template<class F>
+static string parse_reply(const string& body, F read_return)
+{
+	JsonReader r(body);
+	string err;
+	string_view key;
+	r.beginObject();
+	while (r.nextMember(key))
+	{
+		if (key == "return" && r.peek() == '{')
+			read_return(r);
+		else if (key == "error")
+			err = string(r.readString());
+		else
+			r.skipValue();
+	}
+	return err;
+}
+
+void parsePairs(const string& body, vector<PairParams>& params,
+	vector<string>& pairs)
+{
+	JsonReader r(body);
+	string_view key;
+	r.beginObject();
+	while (r.nextMember(key))
+	{
+		if (key != "pairs")
+		{
+			r.skipValue();
+			continue;
+		}
+		string_view pair_name;
+		r.beginObject();
+		while (r.nextMember(pair_name))
+		{
+			if (pair_name.find("btc") == string_view::npos)
+			{
+				r.skipValue();
+				continue;
+			}
+			PairParams p;
+			string_view coin = pair_coin(pair_name, p.reverted);
+			string_view field;
+			r.beginObject();
+			while (r.nextMember(field))
+			{
+				if (field == "decimal_places")
+					p.decimal_places = (unsigned)r.readInteger();
+				else if (field == "fee")
+					p.fee = r.readNumber();
+				else if (field == "max_price")
+					p.max = r.readNumber();
+				else if (field == "min_price")
+					p.min = r.readNumber();
+				else if (field == "min_amount")
+					p.min_amount = r.readNumber();
+				else
+					r.skipValue();
+			}
+			coin_slot(params, CoinRegistry::intern(string(coin))) = p;
+			pairs.emplace_back(pair_name);
+		}
+	}
+}
+
+void parseTickers(const string& body, TradeApi::Tickers& tickers)
+{
+	JsonReader r(body);
+	string_view pair_name;
+	r.beginObject();
+	while (r.nextMember(pair_name))
+	{
+		bool reverted;
+		string_view coin = pair_coin(pair_name, reverted);
+		CoinId id = CoinRegistry::intern(string(coin));
+		CoinInfo i;
+		string_view field;
+		r.beginObject();
+		while (r.nextMember(field))
+		{
+			if (field == "buy")
+				i.buyPrice = r.readNumber();
+			else if (field == "sell")
+				i.sellPrice = r.readNumber();
+			else if (field == "last")
+				i.lastPrice = r.readNumber();
+			else
+				r.skipValue();
+		}
+		if (reverted)
+		{
+			i.buyPrice = 1.0 / i.buyPrice;
+			i.sellPrice = 1.0 / i.sellPrice;
+			i.lastPrice = 1.0 / i.lastPrice;
+		}
+		coin_slot(tickers.buyPrice, id) = i.buyPrice;
+		coin_slot(tickers.sellPrice, id) = i.sellPrice;
+		coin_slot(tickers.lastPrice, id) = i.lastPrice;
+	}
+}
+
+// [[price, amount], ...] into levels of the coin
+static void read_levels(JsonReader& r, vector<OrderBook::Level>& levels, bool reverted)
+{
+	levels.clear();
+	r.beginArray();
+	while (r.nextElement())
+	{
+		OrderBook::Level l;
+		r.beginArray();
+		r.nextElement();
+		l.price = r.readNumber();
+		r.nextElement();
+		l.amount = r.readNumber();
+		while (r.nextElement())
+			r.skipValue();
+		if (reverted)
+		{
+			l.amount *= l.price;
+			l.price = 1.0 / l.price;
+		}
+		levels.push_back(l);
+	}
+}
+
+void parseDepth(const string& body, OrderBook& book)
+{
+	JsonReader r(body);
+	string_view pair_name;
+	r.beginObject();
+	while (r.nextMember(pair_name))
+	{
+		if (r.peek() != '{')
+		{
+			r.skipValue();
+			continue;
+		}
+		bool reverted;
+		string_view coin = pair_coin(pair_name, reverted);
+		CoinId id = CoinRegistry::intern(string(coin));
+		OrderBook::Side& s = book.side(id);
+		string_view field;
+		r.beginObject();
+		while (r.nextMember(field))
+		{
+			if (field == "asks")
+				read_levels(r, reverted ? s.bids : s.asks, reverted);
+			else if (field == "bids")
+				read_levels(r, reverted ? s.asks : s.bids, reverted);
+			else
+				r.skipValue();
+		}
+		book.sorted(id);
+	}
+}
+
+string parseFunds(const string& body, TradeApi::CoinValues& balances, double min_balance)
+{
+	return parse_reply(body, [&](JsonReader& r)
+	{
+		string_view key;
+		r.beginObject();
+		while (r.nextMember(key))
+		{
+			if (key != "funds")
+			{
+				r.skipValue();
+				continue;
+			}
+			string_view coin;
+			r.beginObject();
+			while (r.nextMember(coin))
+			{
+				double balance = r.readNumber();
+				if (!is_token(coin) && balance > min_balance)
+					coin_slot(balances, CoinRegistry::intern(string(coin))) = balance;
+			}
+		}
+	});
+}
+
+string parseOrderId(const string& body, long long& id)
+{
+	id = 0;
+	return parse_reply(body, [&](JsonReader& r)
+	{
+		string_view key;
+		r.beginObject();
+		while (r.nextMember(key))
+		{
+			if (key == "order_id")
+				id = r.readInteger();
+			else
+				r.skipValue();
+		}
+	});
+}
+
+string parseOrderStatus(const string& body, bool& active)
+{
+	active = false;
+	return parse_reply(body, [&](JsonReader& r)
+	{
+		string_view id, key;
+		r.beginObject();
+		while (r.nextMember(id))
+		{
+			r.beginObject();
+			while (r.nextMember(key))
+			{
+				if (key == "status")
+					active = active || r.readInteger() == 0;
+				else
+					r.skipValue();
+			}
+		}
+	});
+}
+
+string parseOrderIds(const string& body, vector<long long>& ids)
+{
+	return parse_reply(body, [&](JsonReader& r)
+	{
+		string_view id;
+		r.beginObject();
+		while (r.nextMember(id))
+		{
+			long long value = 0;
+			if (from_chars(id.data(), id.data() + id.size(), value).ec != errc())
+				throw runtime_error("Invalid order id");
+			ids.push_back(value);
+			r.skipValue();
+		}
+	});
+}
+
+string parseError(const string& body)
+{
+	return parse_reply(body, [](JsonReader& r) { r.skipValue(); });
+}
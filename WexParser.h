@@ -0,0 +1,43 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include "TradeApi.h"
+#include "OrderBook.h"
+
+// Decoders for Wex API responses. Each one walks the response text once with
+// JsonReader and fills the typed structures directly. Private API decoders
+// return the "error" text of the response, empty on success.
+
+// Coin symbols met by the decoders are interned in CoinRegistry and the
+// per coin results are stored at their ids.
+
+// /api/3/info: parameters of the pairs traded against BTC
+void parsePairs(const std::string& body,
+	std::vector<TradeApi::PairParams>& params,
+	std::vector<std::string>& pairs);
+
+// /api/3/ticker/...: prices of the coins in BTC
+void parseTickers(const std::string& body, TradeApi::Tickers& tickers);
+
+// /api/3/depth/...: levels of the pairs in BTC per coin. A reverted pair has
+// its sides swapped, its asks are bids for the coin.
+void parseDepth(const std::string& body, OrderBook& book);
+
+// getInfo: funds larger than min_balance, tokens are skipped
+std::string parseFunds(const std::string& body,
+	TradeApi::CoinValues& balances, double min_balance);
+
+// Trade: id of the created order, 0 if it was executed at once
+std::string parseOrderId(const std::string& body, long long& id);
+
+// OrderInfo: whether the order is still active
+std::string parseOrderStatus(const std::string& body, bool& active);
+
+// ActiveOrders: ids of the open orders
+std::string parseOrderIds(const std::string& body, std::vector<long long>& ids);
+
+// Any private method when only the result matters, e.g. CancelOrder
+std::string parseError(const std::string& body);
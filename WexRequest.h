@@ -0,0 +1,201 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include "RequestScheduler.h"
+
+// Parameters of the private API methods, as bits of a set
+namespace WexParam
+{
+	enum : unsigned
+	{
+		pair = 1,
+		type = 2,
+		rate = 4,
+		amount = 8,
+		order_id = 16
+	};
+
+	constexpr const char* name(unsigned param)
+	{
+		return param == pair ? "pair" : param == type ? "type" : param == rate ? "rate" :
+			param == amount ? "amount" : param == order_id ? "order_id" : nullptr;
+	}
+}
+
+// What a private API method takes, which scheduler lane it goes in and
+// whether running it twice does no harm
+struct WexMethod
+{
+	const char* name;
+	unsigned required;
+	unsigned optional;
+	RequestScheduler::Lane lane;
+	bool idempotent;
+};
+
+namespace WexMethods
+{
+	using namespace WexParam;
+
+	inline constexpr WexMethod Trade{ "Trade", pair | type | rate | amount, 0, RequestScheduler::TRADE, false };
+	inline constexpr WexMethod OrderInfo{ "OrderInfo", order_id, 0, RequestScheduler::STATUS, true };
+	inline constexpr WexMethod CancelOrder{ "CancelOrder", order_id, 0, RequestScheduler::CANCEL, false };
+	inline constexpr WexMethod ActiveOrders{ "ActiveOrders", 0, pair, RequestScheduler::STATUS, true };
+	inline constexpr WexMethod getInfo{ "getInfo", 0, 0, RequestScheduler::ACCOUNT, true };
+}
+
+// Number with a fixed count of decimal places
+struct WexFixed
+{
+	double value;
+	unsigned decimal_places;
+};
+
+template<const WexMethod& M, unsigned Supplied = 0>
+class WexRequestBuilder;
+
+class WexRequest;
+
+template<const WexMethod& M>
+WexRequestBuilder<M> build(WexRequest& req);
+
+// Parameters of one private request, "method=<name>&<param>=<value>..."
+// in a fixed buffer. The nonce goes in front when the request is signed,
+// so a request rejected for its nonce is signed again as it is. Values
+// are coin names, order types and numbers, none needs url escaping.
+class WexRequest
+{
+public:
+	static const size_t capacity = 160;
+	// Digits of the largest nonce
+	static const size_t nonce_digits = std::numeric_limits<uint32_t>::digits10 + 1;
+	static_assert(nonce_digits == 10, "a 32-bit nonce has up to 10 digits");
+	// Room for "nonce=<nonce>&" in front of the parameters
+	static const size_t body_capacity = sizeof("nonce=") - 1 + nonce_digits + 1 + capacity;
+
+	WexRequest() : m_method(nullptr), m_size(0) {}
+
+	const WexMethod& method() const
+	{
+		return *m_method;
+	}
+
+	std::string_view params() const
+	{
+		return std::string_view(m_params, m_size);
+	}
+
+	// Value of a parameter, empty when it was not set
+	std::string_view param(unsigned p) const
+	{
+		std::string_view rest = params();
+		std::string_view name = WexParam::name(p);
+		while (!rest.empty())
+		{
+			size_t end = rest.find('&');
+			std::string_view field = rest.substr(0, end);
+			if (field.size() > name.size() && field.substr(0, name.size()) == name && field[name.size()] == '=')
+				return field.substr(name.size() + 1);
+			rest = (end == std::string_view::npos) ? std::string_view() : rest.substr(end + 1);
+		}
+		return std::string_view();
+	}
+
+	// Writes "nonce=<nonce>&<params>" to out, which holds body_capacity
+	// characters, and returns the length
+	size_t body(uint32_t nonce, char* out) const
+	{
+		memcpy(out, "nonce=", 6);
+		char* p = std::to_chars(out + 6, out + 6 + nonce_digits, nonce).ptr;
+		*p++ = '&';
+		memcpy(p, m_params, m_size);
+		return p + m_size - out;
+	}
+
+private:
+	template<const WexMethod& M, unsigned Supplied>
+	friend class WexRequestBuilder;
+	template<const WexMethod& M>
+	friend WexRequestBuilder<M> build(WexRequest& req);
+
+	void append(std::string_view s)
+	{
+		if (m_size + s.size() > capacity)
+			throw std::length_error("Request parameters too long");
+		memcpy(m_params + m_size, s.data(), s.size());
+		m_size += s.size();
+	}
+
+	void append(long long value)
+	{
+		char buf[24];
+		append(std::string_view(buf, std::to_chars(buf, buf + sizeof(buf), value).ptr - buf));
+	}
+
+	void append(const WexFixed& f)
+	{
+		char buf[64];
+		std::to_chars_result r = std::to_chars(buf, buf + sizeof(buf), f.value,
+			std::chars_format::fixed, (int)f.decimal_places);
+		if (r.ec != std::errc())
+			throw std::length_error("Request parameter out of range");
+		append(std::string_view(buf, r.ptr - buf));
+	}
+
+	const WexMethod* m_method;
+	size_t m_size;
+	char m_params[capacity];
+};
+
+// Fills a request of method M. Every set<P>() returns a builder which has
+// P in Supplied, and done() does not compile until all parameters the
+// method requires are set:
+//     build<WexMethods::OrderInfo>(req).set<WexParam::order_id>(id).done();
+template<const WexMethod& M, unsigned Supplied>
+class WexRequestBuilder
+{
+public:
+	explicit WexRequestBuilder(WexRequest& req) : m_req(req) {}
+
+	// The value is the concatenation of the parts: string views, integers
+	// or WexFixed numbers
+	template<unsigned P, class... Parts>
+	WexRequestBuilder<M, Supplied | P> set(const Parts&... parts)
+	{
+		static_assert(WexParam::name(P) != nullptr, "one parameter at a time");
+		static_assert(((M.required | M.optional) & P) == P, "the method does not take this parameter");
+		static_assert((Supplied & P) == 0, "parameter set twice");
+		m_req.append("&");
+		m_req.append(WexParam::name(P));
+		m_req.append("=");
+		(m_req.append(parts), ...);
+		return WexRequestBuilder<M, Supplied | P>(m_req);
+	}
+
+	WexRequest& done()
+	{
+		static_assert((Supplied & M.required) == M.required, "a required parameter is missing");
+		return m_req;
+	}
+
+private:
+	WexRequest& m_req;
+};
+
+// Starts a request of method M in req, dropping what it held
+template<const WexMethod& M>
+WexRequestBuilder<M> build(WexRequest& req)
+{
+	req.m_method = &M;
+	req.m_size = 0;
+	req.append("method=");
+	req.append(M.name);
+	return WexRequestBuilder<M>(req);
+}
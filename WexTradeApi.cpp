@@ -1,663 +1,976 @@
-﻿// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#include "WexTradeApi.h"
-#include "Log.h"
-#include <boost/beast/core.hpp>
-#include <boost/beast/http.hpp>
-#include <boost/beast/version.hpp>
-#include <boost/asio/connect.hpp>
-#include <boost/asio/ip/tcp.hpp>
-#include <boost/asio/ssl/stream.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
-#include <boost/format.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string/join.hpp>
-#include <chrono>
-#include <thread>
-#include <algorithm>
-#include <list>
-#include <iostream>
-
-using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
-namespace ssl = boost::asio::ssl;       // from <boost/asio/ssl.hpp>
-namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
-using namespace boost::property_tree;
-using namespace std;
-
-WexTradeApi::WexTradeApi(const std::string& key, const std::string& secret):
-	m_key(key),
-	m_secret(secret), 
-	m_nonce(time(0))
-{
-    Log l("WexTradeApi::WexTradeApi()");
-}
-
-struct OrderChecker
-{
-    WexTradeApi* m_api;
-
-    OrderChecker(WexTradeApi* api) : m_api(api) {}
-
-    bool operator()(const pair<long long, std::string>& p)
-	{
-		return !m_api->checkOrder(p.first, p.second);
-	}
-};
-
-bool WexTradeApi::execute(const std::vector<Order>& orders, unsigned timeout)
-{
-    Log l("WexTradeApi::execute");
-	chrono::steady_clock::time_point start = chrono::steady_clock::now();
-    list<pair<long long, std::string>> ids;
-	for (const Order& o : orders)
-		ids.push_back(make_pair(createOrder(o), o.coin));
-	OrderChecker check(this);
-	while (true)
-	{
-		if (ids.empty())
-			break;
-		ids.remove_if(check);
-		if (chrono::steady_clock::now() - start > chrono::minutes(timeout))
-			break;
-		std::this_thread::sleep_for(chrono::seconds(30));
-	}
-	bool res = !ids.empty();
-	for (auto p : ids)
-        deleteOrder(p.first);
-	return res;
-}
-
-std::string double_to_string(double val,  unsigned decimal_places)
-{
-    std::stringstream stream;
-    stream << std::fixed << std::setprecision(decimal_places) << val;
-    return stream.str();
-}
-
-long long WexTradeApi::createOrder(const Order& order)
-{
-    Log l("WexTradeApi::createOrder");
-	std::map<std::string, std::string> params;
-    params["method"] = "Trade";
-    params["pair"] = order.coin + "_btc";
-    params["type"] = (order.action == BUY) ? "buy" : "sell";
-    params["rate"] = double_to_string(order.price, m_params[order.coin].decimal_places);
-    params["amount"] = double_to_string(order.amount, m_params[order.coin].decimal_places);
-    if(m_params[order.coin].reverted)
-    {
-        params["pair"] = "btc_" + order.coin;
-        params["type"] = (order.action == BUY) ? "sell" : "buy";
-        params["rate"] = double_to_string(1.0 / order.price, m_params[order.coin].decimal_places);
-        params["amount"] = double_to_string(order.amount * order.price, m_params[order.coin].decimal_places);
-    }
-    std::istringstream is(call(params));
-	ptree pt;
-	read_json(is, pt);
-	std::string err = pt.get("error", "");
-    long long order_id = 0;
-    if (!err.size())
-    {
-        ptree result = pt.get_child("return");
-        order_id = result.get<long long>("order_id");
-    }
-    if (!m_log.empty())
-	{
-		ofstream fout(m_log, ofstream::app);
-		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
-		fout << "****" << std::ctime(&ttp) << "****" << endl;
-		fout << "Create order: " << endl;
-		fout << "Action: " << ((order.action == BUY) ? "buy" : "sell") << endl;
-		fout << "Currency: " << order.coin << endl;
-		fout << "Rate: " << order.price << endl;
-		fout << "Amount: " << order.amount << endl;
-		fout << "Result: ";
-		if (err.size())
-			fout << "error [" << err << "]" << endl;
-		else
-            fout << order_id << endl;
-	}
-    if (err.size())
-    {
-        Log::write("throw");
-        throw std::runtime_error(err);
-    }
-    return order_id;
-}
-
-bool WexTradeApi::checkOrder(long long id, const std::string& coin)
-{
-    Log l(boost::str(boost::format("WexTradeApi::checkOrder(%d, %s)") %
-                            id % coin.c_str()));
-    if(id == 0)
-        return false;
-	std::map<std::string, std::string> params;
-    params["method"] = "OrderInfo";
-    params["order_id"] = boost::lexical_cast<std::string>(id);
-    std::istringstream is(call(params));
-	ptree pt;
-	read_json(is, pt);
-	std::string err = pt.get("error", "");
-	if (err.size())
-	{
-		Log::write("throw");
-		throw std::runtime_error(err);
-	}
-    ptree result = pt.get_child("return");
-    for (ptree::iterator it = result.begin(); it != result.end(); ++it)
-	{
-		ptree cpt = it->second;
-        int status = cpt.get<int>("status");
-        if (status == 0)
-			return true;
-	}
-	if (!m_log.empty())
-	{
-		ofstream fout(m_log, ofstream::app);
-		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
-		fout << "****" << std::ctime(&ttp) << "****" << endl;
-		fout << "Order " << id << " for " << coin << " is executed" << endl;
-	}
-    return false;
-}
-
-void WexTradeApi::cancelCurrentOrders()
-{
-    Log l("WexTradeApi::cancelCurrentOrders()");
-    std::vector<long long> orders = getCurrentOrders();
-    for(auto id: orders)
-        deleteOrder(id);
-}
-
-std::vector<long long> WexTradeApi::getCurrentOrders()
-{
-    Log l("WexTradeApi::getCurrentOrders()");
-    std::map<std::string, std::string> params;
-    params["method"] = "ActiveOrders";
-    std::istringstream is(call(params));
-    ptree pt;
-    read_json(is, pt);
-    std::string err = pt.get("error", "");
-    if (err.size())
-    {
-        if(err == "no orders")
-            return std::vector<long long>();
-        Log::write("throw");
-        throw std::runtime_error(err);
-    }
-    ptree result = pt.get_child("return");
-    std::vector<long long> res;
-    for (auto it: result)
-    {
-        std::string name = it.first;
-        res.push_back(boost::lexical_cast<long long>(name));
-    }
-    return res;
-}
-
-std::vector<long long> WexTradeApi::getCurrentOrders(const string &coin)
-{
-    Log l(boost::str(boost::format("WexTradeApi::getCurrentOrders(%s)") %
-                            coin.c_str()));
-    std::map<std::string, std::string> params;
-    params["method"] = "returnOpenOrders";
-    params["pair"] = coin + "_btc";
-    if(m_params[coin].reverted)
-        params["pair"] = "btc_" + coin;
-    std::istringstream is(call(params));
-    ptree pt;
-    read_json(is, pt);
-    std::string err = pt.get("error", "");
-    if (err.size())
-    {
-        Log::write("throw");
-        throw std::runtime_error(err);
-    }
-    ptree result = pt.get_child("return");
-    std::vector<long long> res;
-    for (auto it: result)
-    {
-        std::string name = it.first;
-        res.push_back(boost::lexical_cast<long long>(name));
-    }
-    return res;
-}
-
-void WexTradeApi::deleteOrder(long long id)
-{
-    Log l(boost::str(boost::format("WexTradeApi::deleteOrder(%d)") % id));
-	std::map<std::string, std::string> params;
-    params["method"] = "CancelOrder";
-    params["order_id"] = boost::lexical_cast<std::string>(id);
-    std::istringstream is(call(params));
-	ptree pt;
-	read_json(is, pt);
-	std::string err = pt.get("error", "");
-	if (!m_log.empty())
-	{
-		ofstream fout(m_log, ofstream::app);
-		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
-		fout << "****" << std::ctime(&ttp) << "****" << endl;
-        fout << "Delete order " << id << endl;
-		if (err.size())
-			fout << "Error: " << err << endl;
-	}
-	if (err.size())
-	{
-		Log::write("throw");
-		throw std::runtime_error(err);
-	}
-}
-
-double WexTradeApi::balance(const std::string& coin)
-{
-    Log l(boost::str(boost::format("WexTradeApi::balance(%s)") % coin.c_str()));
-	if (m_balances.empty())
-		readBalances();
-	auto it = m_balances.find(coin);
-	if (it == m_balances.end())
-	{
-		Log::write("throw");
-		throw runtime_error("Invalid coin");
-	}
-	return it->second;
-}
-
-TradeApi::CoinInfo WexTradeApi::info(const std::string& coin)
-{
-    Log l(boost::str(boost::format("WexTradeApi::info(%s)") % coin.c_str()));
-	if (m_tickers.empty())
-		readTickers();
-	auto it = m_tickers.find(coin);
-	if (it == m_tickers.end())
-	{
-		Log::write("throw");
-		throw runtime_error("Invalid coin");
-	}
-	return it->second;
-}
-
-static void
-load_root_certificates(ssl::context& ctx)
-{
-	std::string const cert =
-		/*  This is the DigiCert root certificate.
-
-		CN = DigiCert High Assurance EV Root CA
-		OU = www.digicert.com
-		O = DigiCert Inc
-		C = US
-
-		Valid to: Sunday, ?November ?9, ?2031 5:00:00 PM
-
-		Thumbprint(sha1):
-		5f b7 ee 06 33 e2 59 db ad 0c 4c 9a e6 d3 8f 1a 61 c7 dc 25
-		*/
-		"-----BEGIN CERTIFICATE-----\n"
-		"MIIDxTCCAq2gAwIBAgIQAqxcJmoLQJuPC3nyrkYldzANBgkqhkiG9w0BAQUFADBs\n"
-		"MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
-		"d3cuZGlnaWNlcnQuY29tMSswKQYDVQQDEyJEaWdpQ2VydCBIaWdoIEFzc3VyYW5j\n"
-		"ZSBFViBSb290IENBMB4XDTA2MTExMDAwMDAwMFoXDTMxMTExMDAwMDAwMFowbDEL\n"
-		"MAkGA1UEBhMCVVMxFTATBgNVBAoTDERpZ2lDZXJ0IEluYzEZMBcGA1UECxMQd3d3\n"
-		"LmRpZ2ljZXJ0LmNvbTErMCkGA1UEAxMiRGlnaUNlcnQgSGlnaCBBc3N1cmFuY2Ug\n"
-		"RVYgUm9vdCBDQTCCASIwDQYJKoZIhvcNAQEBBQADggEPADCCAQoCggEBAMbM5XPm\n"
-		"+9S75S0tMqbf5YE/yc0lSbZxKsPVlDRnogocsF9ppkCxxLeyj9CYpKlBWTrT3JTW\n"
-		"PNt0OKRKzE0lgvdKpVMSOO7zSW1xkX5jtqumX8OkhPhPYlG++MXs2ziS4wblCJEM\n"
-		"xChBVfvLWokVfnHoNb9Ncgk9vjo4UFt3MRuNs8ckRZqnrG0AFFoEt7oT61EKmEFB\n"
-		"Ik5lYYeBQVCmeVyJ3hlKV9Uu5l0cUyx+mM0aBhakaHPQNAQTXKFx01p8VdteZOE3\n"
-		"hzBWBOURtCmAEvF5OYiiAhF8J2a3iLd48soKqDirCmTCv2ZdlYTBoSUeh10aUAsg\n"
-		"EsxBu24LUTi4S8sCAwEAAaNjMGEwDgYDVR0PAQH/BAQDAgGGMA8GA1UdEwEB/wQF\n"
-		"MAMBAf8wHQYDVR0OBBYEFLE+w2kD+L9HAdSYJhoIAu9jZCvDMB8GA1UdIwQYMBaA\n"
-		"FLE+w2kD+L9HAdSYJhoIAu9jZCvDMA0GCSqGSIb3DQEBBQUAA4IBAQAcGgaX3Nec\n"
-		"nzyIZgYIVyHbIUf4KmeqvxgydkAQV8GK83rZEWWONfqe/EW1ntlMMUu4kehDLI6z\n"
-		"eM7b41N5cdblIZQB2lWHmiRk9opmzN6cN82oNLFpmyPInngiK3BD41VHMWEZ71jF\n"
-		"hS9OMPagMRYjyOfiZRYzy78aG6A9+MpeizGLYAiJLQwGXFK3xPkKmNEVX58Svnw2\n"
-		"Yzi9RKR/5CYrCsSXaQ3pjOLAEFe4yHYSkVXySGnYvCoCWw9E1CAx2/S6cCZdkGCe\n"
-		"vEsXCS+0yx5DaMkHJ8HSXPfqIbloEpw8nL+e/IBcm2PN7EeqJSdnoDfzAIJ9VNep\n"
-		"+OkuE6N36B9K\n"
-		"-----END CERTIFICATE-----\n"
-		/*  This is the GeoTrust root certificate.
-
-		CN = GeoTrust Global CA
-		O = GeoTrust Inc.
-		C = US
-		Valid to: Friday, ‎May ‎20, ‎2022 9:00:00 PM
-
-		Thumbprint(sha1):
-		‎de 28 f4 a4 ff e5 b9 2f a3 c5 03 d1 a3 49 a7 f9 96 2a 82 12
-		*/
-		"-----BEGIN CERTIFICATE-----\n"
-		"MIIDxTCCAq2gAwIBAgIQAqxcJmoLQJuPC3nyrkYldzANBgkqhkiG9w0BAQUFADBs\n"
-		"MQswCQYDVQQGEwJVUzEVMBMGA1UEChMMRGlnaUNlcnQgSW5jMRkwFwYDVQQLExB3\n"
-		"d3cuZGlnaWNlcnQuY29tMSswKQYDVQQDEyJEaWdpQ2VydCBIaWdoIEFzc3VyYW5j\n"
-		"ZSBFViBSb290IENBMB4XDTA2MTExMDAwMDAwMFoXDTMxMTExMDAwMDAwMFowbDEL\n"
-		"MAkGA1UEBhMCVVMxFTATBgNVBAoTDERpZ2lDZXJ0IEluYzEZMBcGA1UECxMQd3d3\n"
-		"LmRpZ2ljZXJ0LmNvbTErMCkGA1UEAxMiRGlnaUNlcnQgSGlnaCBBc3N1cmFuY2Ug\n"
-		"RVYgUm9vdCBDQTCCASIwDQYJKoZIhvcNAQEBBQADggEPADCCAQoCggEBAMbM5XPm\n"
-		"+9S75S0tMqbf5YE/yc0lSbZxKsPVlDRnogocsF9ppkCxxLeyj9CYpKlBWTrT3JTW\n"
-		"PNt0OKRKzE0lgvdKpVMSOO7zSW1xkX5jtqumX8OkhPhPYlG++MXs2ziS4wblCJEM\n"
-		"xChBVfvLWokVfnHoNb9Ncgk9vjo4UFt3MRuNs8ckRZqnrG0AFFoEt7oT61EKmEFB\n"
-		"Ik5lYYeBQVCmeVyJ3hlKV9Uu5l0cUyx+mM0aBhakaHPQNAQTXKFx01p8VdteZOE3\n"
-		"hzBWBOURtCmAEvF5OYiiAhF8J2a3iLd48soKqDirCmTCv2ZdlYTBoSUeh10aUAsg\n"
-		"EsxBu24LUTi4S8sCAwEAAaNjMGEwDgYDVR0PAQH/BAQDAgGGMA8GA1UdEwEB/wQF\n"
-		"MAMBAf8wHQYDVR0OBBYEFLE+w2kD+L9HAdSYJhoIAu9jZCvDMB8GA1UdIwQYMBaA\n"
-		"FLE+w2kD+L9HAdSYJhoIAu9jZCvDMA0GCSqGSIb3DQEBBQUAA4IBAQAcGgaX3Nec\n"
-		"nzyIZgYIVyHbIUf4KmeqvxgydkAQV8GK83rZEWWONfqe/EW1ntlMMUu4kehDLI6z\n"
-		"eM7b41N5cdblIZQB2lWHmiRk9opmzN6cN82oNLFpmyPInngiK3BD41VHMWEZ71jF\n"
-		"hS9OMPagMRYjyOfiZRYzy78aG6A9+MpeizGLYAiJLQwGXFK3xPkKmNEVX58Svnw2\n"
-		"Yzi9RKR/5CYrCsSXaQ3pjOLAEFe4yHYSkVXySGnYvCoCWw9E1CAx2/S6cCZdkGCe\n"
-		"vEsXCS+0yx5DaMkHJ8HSXPfqIbloEpw8nL+e/IBcm2PN7EeqJSdnoDfzAIJ9VNep\n"
-		"+OkuE6N36B9K\n"
-		"-----END CERTIFICATE-----\n"
-		;
-
-	boost::system::error_code ec;
-	ctx.add_certificate_authority(
-		boost::asio::buffer(cert.data(), cert.size()), ec);
-	if (ec)
-		throw boost::system::system_error{ ec };
-}
-
-void WexTradeApi::readTickers()
-{
-    Log l("WexTradeApi::readTickers()");
-
-    // get pair list
-	std::stringstream is; 
-    is << public_get("/api/3/info");
-	ptree pt;
-	read_json(is, pt);
-    ptree pair_tree = pt.get_child("pairs");
-    std::vector<std::string> pairs;
-    for (ptree::iterator it = pair_tree.begin(); it != pair_tree.end(); ++it)
-	{
-        std::string pair_name = it->first;
-        if (pair_name.find("btc") == std::string::npos)
-			continue;
-        PairParams params;
-        ptree param_data = it->second;
-        std::string coin;
-        if(pair_name.substr(0, 4) != "btc_")
-        {
-            coin = pair_name.substr(0, pair_name.find("_"));
-            params.reverted = false;
-        }
-        else
-        {
-            coin = pair_name.substr(pair_name.find("_") + 1);
-            params.reverted = true;
-        }
-        params.decimal_places = param_data.get<unsigned>("decimal_places");
-        params.fee = param_data.get<double>("fee");
-        params.max = param_data.get<double>("max_price");
-        params.min = param_data.get<double>("min_price");
-        params.min_amount = param_data.get<double>("min_amount");
-        m_params[coin] = params;
-        pairs.push_back(pair_name);
-	}
-    // get tickers for this pairs
-    std::string path = boost::algorithm::join(pairs, "-");
-    is << public_get("/api/3/ticker/" + path);
-    read_json(is, pt);
-    for(auto it: pt)
-    {
-        std::string pair_name = it.first;
-        std::string coin;
-        CoinInfo i;
-        if(pair_name.substr(0, 4) != "btc_")
-        {
-            coin = pair_name.substr(0, pair_name.find("_"));
-            i.coin = coin;
-            i.buyPrice = it.second.get<double>("buy");
-            i.sellPrice = it.second.get<double>("sell");
-            i.lastPrice = it.second.get<double>("last");
-        }
-        else
-        {
-            coin = pair_name.substr(pair_name.find("_") + 1);
-            i.coin = coin;
-            i.buyPrice = 1.0 / it.second.get<double>("buy");
-            i.sellPrice = 1.0 / it.second.get<double>("sell");
-            i.lastPrice = 1.0 / it.second.get<double>("last");
-        }
-        m_tickers[coin] = i;
-    }
-}
-
-bool is_token(const std::string& name)
-{
-    if(name.length() < 2)
-        return false;
-    size_t pos = name.length() - 2;
-    return (name.substr(pos, 2) == "et");
-}
-
-void WexTradeApi::readBalances()
-{
-    Log l("WexTradeApi::readBalances()");
-	m_balances.clear();
-	std::map<std::string, std::string> params;
-    params["method"] = "getInfo";
-	std::istringstream is(call(params));
-	ptree pt;
-	read_json(is, pt);
-	std::string err = pt.get("error", "");
-	if (err.size())
-	{
-		Log::write("throw");
-		throw std::runtime_error(err);
-	}
-    ptree funds = pt.get_child("return").get_child("funds");
-    for (ptree::iterator it = funds.begin(); it != funds.end(); ++it)
-	{
-        if(is_token(it->first))
-            continue;
-        double balance = boost::lexical_cast<double>(it->second.data());
-        if(balance > 0.001)
-            m_balances[it->first] = balance;
-    }
-}
-
-string WexTradeApi::public_get(const string &target)
-{
-    // connection params
-    std::string host("wex.nz");
-    std::string port("443");
-
-    // The io_service is required for all I/O
-    boost::asio::io_service ios;
-
-    // The SSL context is required, and holds certificates
-    ssl::context ctx{ ssl::context::sslv23_client };
-
-    // This holds the root certificate used for verification
-    load_root_certificates(ctx);
-
-    // These objects perform our I/O
-    tcp::resolver resolver{ ios };
-    ssl::stream<tcp::socket> stream{ ios, ctx };
-
-    // Look up the domain name
-    auto const lookup = resolver.resolve({ host, port });
-
-    // Make the connection on the IP address we get from a lookup
-    boost::asio::connect(stream.next_layer(), lookup);
-
-    // Perform the SSL handshake
-    stream.handshake(ssl::stream_base::client);
-
-    // Set up an HTTP GET request message
-    http::request<http::string_body> req{ http::verb::get, target, 11 };
-    req.set(http::field::host, host);
-    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-
-    // Send the HTTP request to the remote host
-    http::write(stream, req);
-
-    // This buffer is used for reading and must be persisted
-    boost::beast::flat_buffer buffer;
-
-    // Declare a container to hold the response
-    http::response<http::string_body> res;
-
-    // Receive the HTTP response
-    http::read(stream, buffer, res);
-
-    // Write the message to string stream to read in parser
-    std::stringstream is;
-    is << res.body();
-
-    // Gracefully close the stream
-    boost::system::error_code ec;
-    stream.shutdown(ec);
-
-    return is.str();
-}
-
-std::string WexTradeApi::call(const std::map<std::string, std::string>& params)
-{
-    Log l("WexTradeApi::call");
-    // connection params
-    std::string host("wex.nz");
-    std::string port("443");
-    std::string target("/tapi");
-
-    std::string postData = postBody(params);
-	std::string sign = signBody(postData);
-
-    // The io_service is required for all I/O
-    boost::asio::io_service ios;
-
-    // The SSL context is required, and holds certificates
-    ssl::context ctx{ ssl::context::sslv23_client };
-
-    // This holds the root certificate used for verification
-    load_root_certificates(ctx);
-
-    // These objects perform our I/O
-    tcp::resolver resolver{ ios };
-    ssl::stream<tcp::socket> stream{ ios, ctx };
-
-    // Look up the domain name
-    auto const lookup = resolver.resolve({ host, port });
-
-    // Make the connection on the IP address we get from a lookup
-    boost::asio::connect(stream.next_layer(), lookup);
-
-    // Perform the SSL handshake
-    stream.handshake(ssl::stream_base::client);
-
-    // Set up an HTTP POST request message
-    http::request<http::string_body> req;
-    req.method(http::verb::post);
-    req.target(target);
-    req.set(http::field::host, host);
-    req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-    req.set(http::field::content_type,
-            "application/x-www-form-urlencoded");
-    req.set("Key", m_key);
-    req.set("Sign", sign);
-    req.body() = postData;
-    req.prepare_payload();
-
-    // Send the HTTP request to the remote host
-    http::write(stream, req);
-
-    // This buffer is used for reading and must be persisted
-    boost::beast::flat_buffer buffer;
-
-    // Declare a container to hold the response
-    http::response<http::string_body> res;
-
-    // Receive the HTTP response
-    http::read(stream, buffer, res);
-
-    // Write the message to output stream
-    std::string reply(res.body());
-
-    // Gracefully close the stream
-    boost::system::error_code ec;
-    stream.shutdown(ec);
-/*    if (ec == boost::asio::error::eof)
-    {
-        // Rationale:
-        // http://stackoverflow.com/questions/25587403/boost-asio-ssl-async-shutdown-always-finishes-with-an-error
-        ec.assign(0, ec.category());
-    }
-    else if (ec)
-        throw boost::system::system_error{ ec };*/
-    // If we get here then the connection is closed gracefully
-    return reply;
-}
-
-std::string WexTradeApi::postBody(const std::map<std::string, std::string>& params)
-{
-    Log l("WexTradeApi::postBody");
-	std::string res = (boost::format("nonce=%d") % m_nonce++).str();
-	for (auto param : params)
-		res += "&" + param.first + "=" + param.second;
-    Log::write(boost::str(boost::format("Result: %s") % res.c_str()));
-	return res;
-}
-
-std::string WexTradeApi::signBody(const std::string& body)
-{
-    Log l("WexTradeApi::signBody");
-    Log::write(boost::str(boost::format("Body: %s") % body.c_str()));
-	unsigned char* digest = HMAC(EVP_sha512(),
-		m_secret.c_str(), m_secret.length(),
-		(unsigned char*)body.c_str(), body.length(), NULL, NULL);
-	char mdString[129];
-	for (int i = 0; i < 64; i++)
-		sprintf(&mdString[i * 2], "%02x", (unsigned int)digest[i]);
-	mdString[128] = 0;
-    Log::write(boost::str(boost::format("Sign: %s") % mdString));
-	return mdString;
-}
-
-map<std::string, double> WexTradeApi::nonZeroBalancesInBTC()
-{
-    Log l("WexTradeApi::nonZeroBalancesInBTC()");
-	if (m_balances.empty())
-		readBalances();
-	if (m_tickers.empty())
-		readTickers();
-	map<std::string, double> balances;
-	for (auto b : m_balances)
-	{
-		if (b.second == 0.0)
-			continue;
-        if (b.first == "btc")
-		{
-			balances[b.first] = b.second;
-            Log::write(boost::str(boost::format("%s:%f") % b.first.c_str() % b.second));
-		}
-		else
-		{
-			TradeApi::CoinInfo ci = m_tickers[b.first];
-			double amount = b.second * (ci.buyPrice + ci.sellPrice) / 2;
-			balances[b.first] = amount;
-            Log::write(boost::str(boost::format("%s:%f") % b.first.c_str() % amount));
-		}
-	}
-	return balances;
-}
-
-std::map<std::string, double> WexTradeApi::nonZeroBalances()
-{
-    Log l("WexTradeApi::nonZeroBalances()");
-	if (m_balances.empty())
-		readBalances();
-	if (m_tickers.empty())
-		readTickers();
-	map<std::string, double> balances;
-	for (auto b : m_balances)
-	{
-		if (b.second == 0.0)
-			continue;
-		balances[b.first] = b.second;
-        Log::write(boost::str(boost::format("%s:%f") % b.first.c_str() % b.second));
-	}
-	return balances;
-}
-
+﻿// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "WexTradeApi.h"
+#include "Log.h"
+#include "WexParser.h"
+#include "MetadataCache.h"
+#include "Metrics.h"
+#include "TraceEvents.h"
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/format.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/algorithm/string/join.hpp>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <algorithm>
+#include <list>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+
+namespace http = boost::beast::http;    // from <boost/beast/http.hpp>
+using namespace std;
+
+WexTradeApi::WexTradeApi(const std::string& key, const std::string& secret,
+	const ConnectionPool::Endpoint& endpoint):
+	m_key(key),
+	m_signer(secret),
+	m_nonce(std::make_unique<NonceSequencer>()),
+	m_pool(std::make_shared<ConnectionPool>(endpoint)),
+	m_scheduler(std::make_shared<RequestScheduler>(m_pool)),
+	m_market(nullptr),
+	m_max_in_flight(4),
+	m_fill_check(ACTIVE_ORDERS),
+	m_log(-1),
+	m_max_price_gap(0.01),
+	m_max_slippage(0.0),
+	m_depth_levels(50),
+	m_first_poll(chrono::seconds(1)),
+	m_max_poll(chrono::seconds(60)),
+	m_metadata_ttl(0)
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::WexTradeApi()");
+}
+
+WexTradeApi::WexTradeApi(const std::string& key, const std::string& secret, WexTradeApi& market) :
+	m_key(key),
+	m_signer(secret),
+	m_nonce(std::make_unique<NonceSequencer>()),
+	m_pool(market.m_pool),
+	m_scheduler(market.m_scheduler),
+	m_market(&market),
+	m_max_in_flight(4),
+	m_fill_check(ACTIVE_ORDERS),
+	m_log(-1),
+	m_max_price_gap(0.01),
+	m_max_slippage(0.0),
+	m_depth_levels(50),
+	m_first_poll(chrono::seconds(1)),
+	m_max_poll(chrono::seconds(60)),
+	m_metadata_ttl(0)
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::WexTradeApi(market)");
+}
+
+WexTradeApi::~WexTradeApi()
+{
+    if (m_refresh.joinable())
+    {
+        // A metadata refresh still waiting for the exchange is cut off
+        m_pool->close();
+        m_refresh.join();
+    }
+    // Shared connections are reported by their owner
+    if (m_market)
+        return;
+    ConnectionPool::Stats s = m_pool->stats();
+    LOG_WRITE(INFO, NET, boost::str(boost::format("Connections: %d requests, %d connects, %d reused, %d reconnects, %d resumed sessions, %d lookups") %
+                          s.requests % s.connects % s.reuses % s.reconnects % s.resumed % s.lookups));
+    RequestScheduler::Stats lanes = m_scheduler->stats();
+    for (unsigned lane = 0; lane < lanes.size(); ++lane)
+    {
+        const RequestScheduler::LaneStats& l = lanes[lane];
+        if (!l.requests && !l.merged)
+            continue;
+        LOG_WRITE(INFO, NET, boost::str(boost::format("Lane %s: %d requests, %d merged, %d most queued, %.1f ms mean wait, %.1f ms longest") %
+                              RequestScheduler::name((RequestScheduler::Lane)lane) % l.requests % l.merged % l.max_queued %
+                              (l.requests ? l.wait.count() / 1000.0 / l.requests : 0.0) % (l.max_wait.count() / 1000.0)));
+    }
+}
+
+// Histogram of an API method, looked up in the registry once per thread
+static Histogram& method_histogram(const char* metric, const char* method)
+{
+    static thread_local std::map<std::pair<const char*, const char*>, Histogram*> cache;
+    Histogram*& h = cache[std::make_pair(metric, method)];
+    if (!h)
+        h = &Metrics::histogram(metric, "method=\"" + std::string(method) + "\"");
+    return *h;
+}
+
+// Decodes a reply of the method and records the time it took
+template<class F>
+static auto timed_parse(const char* method, F parse)
+{
+    ScopedTimer timer(method_histogram("wex_parse_seconds", method));
+    return parse();
+}
+
+struct OrderChecker
+{
+    WexTradeApi* m_api;
+    std::vector<TradeApi::OrderResult>& m_results;
+    // Sorted ActiveOrders snapshot, null to query every order
+    const std::vector<long long>* m_active;
+
+    OrderChecker(WexTradeApi* api, std::vector<TradeApi::OrderResult>& results) :
+        m_api(api), m_results(results), m_active(nullptr) {}
+
+    bool operator()(size_t i)
+	{
+		TradeApi::OrderResult& r = m_results[i];
+		// Orders still in the snapshot are open, only confirm the missing ones
+		if (m_active && std::binary_search(m_active->begin(), m_active->end(), r.id))
+			return false;
+		r.executed = !m_api->checkOrder(r.id, r.order.coin);
+		return r.executed;
+	}
+};
+
+// Cancels the timers when the scope ends, they refer to its locals
+struct TimerGuard
+{
+	TimerWheel& wheel;
+	std::vector<uint64_t>& ids;
+
+	~TimerGuard()
+	{
+		for (uint64_t id : ids)
+			wheel.cancel(id);
+	}
+};
+
+// Runs f(0) .. f(count - 1) on at most limit threads. Indices are handed
+// out in increasing order, so the requests queue in the scheduler in it too.
+template<class F>
+static void for_each_concurrent(size_t count, unsigned limit, F f)
+{
+	std::atomic<size_t> next(0);
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++)
+			f(i);
+	};
+	size_t threads = std::min<size_t>(std::max(limit, 1u), count);
+	std::vector<std::thread> pool;
+	for (size_t i = 1; i < threads; ++i)
+		pool.emplace_back(worker);
+	worker();
+	for (auto& t : pool)
+		t.join();
+}
+
+std::vector<TradeApi::OrderResult> WexTradeApi::execute(const std::vector<Order>& orders, unsigned timeout)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::execute");
+	typedef TimerWheel::Clock Clock;
+	Clock::time_point deadline = Clock::now() + chrono::minutes(timeout);
+	std::vector<Order> now, later;
+	splitFunded(orders, coin_value(balances(), CoinRegistry::btc), now, later);
+	std::vector<OrderResult> results = placeOrders(now);
+
+	// Every open order has its own timer: a first check soon after the
+	// placement, then the interval doubles up to m_max_poll. Timers coming
+	// due in the same tick make one round and share one ActiveOrders
+	// snapshot, however long the OrderInfo calls between them take.
+	size_t open = 0;
+	std::vector<uint64_t> timers;
+	std::vector<long long> active;
+	uint64_t active_round = 0;
+	std::function<void(size_t, Clock::duration, uint64_t)> poll;
+	auto schedule = [&](size_t i, Clock::duration interval)
+	{
+		Clock::time_point due = Clock::now() + interval;
+		uint64_t round = (uint64_t)(due.time_since_epoch() / m_timers.tick()) + 1;
+		timers.push_back(m_timers.schedule(due, [&, i, interval, round]() { poll(i, interval, round); }));
+	};
+	auto track = [&](size_t begin)
+	{
+		for (size_t i = begin; i < results.size(); ++i)
+		{
+			if (!results[i].id || results[i].executed)
+				continue;
+			++open;
+			schedule(i, m_first_poll);
+		}
+	};
+	auto place_later = [&]()
+	{
+		if (later.empty() || !sellsSettled(results))
+			return;
+		size_t begin = results.size();
+		std::vector<OrderResult> more = placeOrders(later);
+		results.insert(results.end(), more.begin(), more.end());
+		later.clear();
+		track(begin);
+	};
+	poll = [&](size_t i, Clock::duration interval, uint64_t round)
+	{
+		OrderChecker check(this, results);
+		if (m_fill_check == ACTIVE_ORDERS)
+		{
+			if (round != active_round)
+			{
+				active = getCurrentOrders();
+				std::sort(active.begin(), active.end());
+				active_round = round;
+			}
+			check.m_active = &active;
+		}
+		if (check(i))
+		{
+			--open;
+			place_later();
+		}
+		else
+		{
+			schedule(i, std::min<Clock::duration>(interval * 2, m_max_poll));
+		}
+		if (!open && later.empty())
+			m_timers.stop();
+	};
+	TimerGuard guard{ m_timers, timers };
+
+	track(0);
+	place_later();
+	if (open || !later.empty())
+	{
+		timers.push_back(m_timers.schedule(deadline, [this]() { m_timers.stop(); }));
+		m_timers.run();
+	}
+	for (const Order& o : later)
+	{
+		OrderResult r;
+		r.order = o;
+		r.error = "Not placed, the sells did not fill in time";
+		results.push_back(r);
+	}
+	cancelOrders(results);
+	return results;
+}
+
+std::vector<TradeApi::OrderResult> WexTradeApi::placeOrders(const std::vector<Order>& orders)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::placeOrders");
+	std::vector<OrderResult> results(orders.size());
+	std::vector<Order> priced(orders);
+	priceOrders(priced);
+	std::vector<WexRequest> params(orders.size());
+	for (size_t i = 0; i < orders.size(); ++i)
+	{
+		results[i].order = priced[i];
+		orderRequest(priced[i], params[i]);
+	}
+	// The intents are on the disk before any order is sent
+	std::vector<uint64_t> intents(orders.size());
+	if (m_journal)
+	{
+		for (size_t i = 0; i < orders.size(); ++i)
+			intents[i] = m_journal->intent(priced[i]);
+		m_journal->commit();
+	}
+	for_each_concurrent(orders.size(), m_max_in_flight, [&](size_t i)
+	{
+		// An order without a reply may exist, it stays an open intent
+		bool answered = false;
+		try
+		{
+			std::string reply = send(params[i]);
+			answered = true;
+			results[i].id = readOrderId(priced[i], reply);
+			if (!results[i].id)
+				results[i].executed = true; // filled immediately
+			if (m_journal)
+				m_journal->placed(intents[i], results[i].id);
+		}
+		catch (const std::exception& e)
+		{
+			results[i].error = e.what();
+			if (m_journal && answered)
+				m_journal->rejected(intents[i]);
+		}
+	});
+	if (m_journal)
+		m_journal->commit();
+	return results;
+}
+
+size_t WexTradeApi::checkOrders(std::vector<OrderResult>& results)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::checkOrders");
+    list<size_t> pending;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (results[i].id && !results[i].executed && !results[i].cancelled)
+			pending.push_back(i);
+	}
+	if (pending.empty())
+		return 0;
+	OrderChecker check(this, results);
+	std::vector<long long> active;
+	if (m_fill_check == ACTIVE_ORDERS)
+	{
+		active = getCurrentOrders();
+		std::sort(active.begin(), active.end());
+		check.m_active = &active;
+	}
+	pending.remove_if(check);
+	if (m_journal)
+		m_journal->commit();
+	return pending.size();
+}
+
+void WexTradeApi::cancelOrders(std::vector<OrderResult>& results)
+{
+	std::vector<size_t> pending;
+	std::vector<long long> ids;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		if (results[i].id && !results[i].executed && !results[i].cancelled)
+		{
+			pending.push_back(i);
+			ids.push_back(results[i].id);
+		}
+	}
+	std::vector<std::string> errors = deleteOrders(ids);
+	for (size_t n = 0; n < pending.size(); ++n)
+	{
+		OrderResult& r = results[pending[n]];
+		r.cancelled = errors[n].empty();
+		if (!errors[n].empty())
+			r.error = errors[n];
+	}
+}
+
+std::string double_to_string(double val,  unsigned decimal_places)
+{
+    std::stringstream stream;
+    stream << std::fixed << std::setprecision(decimal_places) << val;
+    return stream.str();
+}
+
+void WexTradeApi::orderRequest(const Order& order, WexRequest& req)
+{
+	PairParams pp = pairParams(order.coin);
+    if(pp.reverted)
+    {
+        build<WexMethods::Trade>(req)
+            .set<WexParam::pair>("btc_", order.coin)
+            .set<WexParam::type>((order.action == BUY) ? "sell" : "buy")
+            .set<WexParam::rate>(WexFixed{ 1.0 / order.price, pp.decimal_places })
+            .set<WexParam::amount>(WexFixed{ order.amount * order.price, pp.decimal_places })
+            .done();
+        return;
+    }
+    build<WexMethods::Trade>(req)
+        .set<WexParam::pair>(order.coin, "_btc")
+        .set<WexParam::type>((order.action == BUY) ? "buy" : "sell")
+        .set<WexParam::rate>(WexFixed{ order.price, pp.decimal_places })
+        .set<WexParam::amount>(WexFixed{ order.amount, pp.decimal_places })
+        .done();
+}
+
+long long WexTradeApi::readOrderId(const Order& order, const std::string& reply)
+{
+    long long order_id = 0;
+    std::string err = timed_parse("Trade", [&]() { return parseOrderId(reply, order_id); });
+    if (m_log >= 0)
+	{
+		ostringstream fout;
+		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+		fout << "****" << std::ctime(&ttp) << "****" << endl;
+		fout << "Create order: " << endl;
+		fout << "Action: " << ((order.action == BUY) ? "buy" : "sell") << endl;
+		fout << "Currency: " << order.coin << endl;
+		fout << "Rate: " << order.price << endl;
+		fout << "Amount: " << order.amount << endl;
+		fout << "Result: ";
+		if (err.size())
+			fout << "error [" << err << "]" << endl;
+		else
+            fout << order_id << endl;
+		Log::write(m_log, fout.str());
+	}
+    if (err.size())
+    {
+        LOG_WRITE(ERR, API, "throw");
+        throw std::runtime_error(err);
+    }
+    return order_id;
+}
+
+long long WexTradeApi::createOrder(const Order& order)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::createOrder");
+    WexRequest req;
+    orderRequest(order, req);
+    if (!m_journal)
+        return readOrderId(order, call(req));
+    uint64_t intent = m_journal->intent(order);
+    m_journal->commit();
+    std::string reply = call(req);
+    long long id = 0;
+    try
+    {
+        id = readOrderId(order, reply);
+    }
+    catch (const std::exception&)
+    {
+        m_journal->rejected(intent);
+        m_journal->commit();
+        throw;
+    }
+    m_journal->placed(intent, id);
+    m_journal->commit();
+    return id;
+}
+
+bool WexTradeApi::checkOrder(long long id, const std::string& coin)
+{
+	LOG_SCOPE(INFO, ORDERS, boost::str(boost::format("WexTradeApi::checkOrder(%d, %s)") %
+		id % coin.c_str()));
+	if(id == 0)
+		return false;
+	WexRequest req;
+	build<WexMethods::OrderInfo>(req).set<WexParam::order_id>(id).done();
+	bool active = false;
+	std::string reply = call(req);
+	std::string err = timed_parse("OrderInfo", [&]() { return parseOrderStatus(reply, active); });
+	if (err.size())
+	{
+		LOG_WRITE(ERR, API, "throw");
+		throw std::runtime_error(err);
+	}
+	if (active)
+		return true;
+	if (m_journal)
+		m_journal->filled(id);
+	if (m_log >= 0)
+	{
+		ostringstream fout;
+		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+		fout << "****" << std::ctime(&ttp) << "****" << endl;
+		fout << "Order " << id << " for " << coin << " is executed" << endl;
+		Log::write(m_log, fout.str());
+	}
+	return false;
+}
+
+void WexTradeApi::cancelCurrentOrders()
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::cancelCurrentOrders()");
+    std::vector<long long> orders = getCurrentOrders();
+    std::vector<std::string> errors = deleteOrders(orders);
+    for (const std::string& err : errors)
+    {
+        if (err.size())
+        {
+            LOG_WRITE(ERR, API, "throw");
+            throw std::runtime_error(err);
+        }
+    }
+}
+
+std::vector<TradeApi::OrderResult> WexTradeApi::recoverOrders(chrono::seconds max_age)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::recoverOrders()");
+    std::vector<OrderResult> results;
+    if (!m_journal)
+    {
+        cancelCurrentOrders();
+        return results;
+    }
+    if (m_journal->unconfirmed())
+        LOG_WRITE(INFO, ORDERS, boost::str(boost::format("%d orders of the last run were sent without a reply") %
+                                m_journal->unconfirmed()));
+    std::vector<long long> active = getCurrentOrders();
+    std::sort(active.begin(), active.end());
+    std::vector<long long> kept;
+    time_t now = time(0);
+    for (const OrderJournal::Open& o : m_journal->recovered())
+    {
+        if (!std::binary_search(active.begin(), active.end(), o.id))
+        {
+            m_journal->filled(o.id);
+            continue;
+        }
+        const TradeApi::CoinInfo ci = info(o.order.coin);
+        double middle = (ci.buyPrice + ci.sellPrice) / 2;
+        if (now - o.time >= max_age.count() || !middle ||
+            std::abs(o.order.price / middle - 1.0) > m_max_price_gap)
+            continue;
+        OrderResult r;
+        r.order = o.order;
+        r.id = o.id;
+        results.push_back(r);
+        kept.push_back(o.id);
+    }
+    // Orders of the last run without a reply and orders placed by hand
+    // are unknown here, they go with the stale ones
+    std::sort(kept.begin(), kept.end());
+    std::vector<long long> stale;
+    std::set_difference(active.begin(), active.end(), kept.begin(), kept.end(), std::back_inserter(stale));
+    LOG_WRITE(INFO, ORDERS, boost::str(boost::format("Recovered %d open orders, cancel %d of %d active") %
+                            results.size() % stale.size() % active.size()));
+    std::vector<std::string> errors = deleteOrders(stale);
+    m_journal->commit();
+    for (const std::string& err : errors)
+    {
+        if (err.size())
+        {
+            LOG_WRITE(ERR, API, "throw");
+            throw std::runtime_error(err);
+        }
+    }
+    return results;
+}
+
+void WexTradeApi::awaitOrders(std::vector<OrderResult>& results, chrono::seconds timeout)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::awaitOrders()");
+	typedef TimerWheel::Clock Clock;
+	// One check of all orders per poll, the interval doubles up to
+	// m_max_poll as in execute()
+	std::vector<uint64_t> timers;
+	TimerGuard guard{ m_timers, timers };
+	std::function<void(Clock::duration)> poll = [&](Clock::duration interval)
+	{
+		if (!checkOrders(results))
+		{
+			m_timers.stop();
+			return;
+		}
+		interval = std::min<Clock::duration>(interval * 2, m_max_poll);
+		timers.push_back(m_timers.after(interval, [&, interval]() { poll(interval); }));
+	};
+	if (checkOrders(results))
+	{
+		timers.push_back(m_timers.after(m_first_poll, [&]() { poll(m_first_poll); }));
+		timers.push_back(m_timers.after(timeout, [this]() { m_timers.stop(); }));
+		m_timers.run();
+	}
+	cancelOrders(results);
+}
+
+std::vector<long long> WexTradeApi::getCurrentOrders()
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::getCurrentOrders()");
+    WexRequest req;
+    build<WexMethods::ActiveOrders>(req).done();
+    std::vector<long long> res;
+    std::string reply = call(req);
+    std::string err = timed_parse("ActiveOrders", [&]() { return parseOrderIds(reply, res); });
+    if (err.size())
+    {
+        if(err == "no orders")
+            return std::vector<long long>();
+        LOG_WRITE(ERR, API, "throw");
+        throw std::runtime_error(err);
+    }
+    return res;
+}
+
+std::vector<long long> WexTradeApi::getCurrentOrders(const string &coin)
+{
+    LOG_SCOPE(INFO, ORDERS, boost::str(boost::format("WexTradeApi::getCurrentOrders(%s)") %
+                            coin.c_str()));
+    WexRequest req;
+    if(pairParams(coin).reverted)
+        build<WexMethods::ActiveOrders>(req).set<WexParam::pair>("btc_", coin).done();
+    else
+        build<WexMethods::ActiveOrders>(req).set<WexParam::pair>(coin, "_btc").done();
+    std::vector<long long> res;
+    std::string reply = call(req);
+    std::string err = timed_parse("ActiveOrders", [&]() { return parseOrderIds(reply, res); });
+    if (err.size())
+    {
+        if(err == "no orders")
+            return std::vector<long long>();
+        LOG_WRITE(ERR, API, "throw");
+        throw std::runtime_error(err);
+    }
+    return res;
+}
+
+static void cancelRequest(long long id, WexRequest& req)
+{
+	build<WexMethods::CancelOrder>(req).set<WexParam::order_id>(id).done();
+}
+
+std::string WexTradeApi::readCancel(long long id, const std::string& reply)
+{
+	std::string err = timed_parse("CancelOrder", [&]() { return parseError(reply); });
+	if (m_journal && err.empty())
+		m_journal->cancelled(id);
+	if (m_log >= 0)
+	{
+		ostringstream fout;
+		time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+		fout << "****" << std::ctime(&ttp) << "****" << endl;
+        fout << "Delete order " << id << endl;
+		if (err.size())
+			fout << "Error: " << err << endl;
+		Log::write(m_log, fout.str());
+	}
+	return err;
+}
+
+void WexTradeApi::deleteOrder(long long id)
+{
+    LOG_SCOPE(INFO, ORDERS, boost::str(boost::format("WexTradeApi::deleteOrder(%d)") % id));
+	WexRequest req;
+	cancelRequest(id, req);
+	std::string err = readCancel(id, call(req));
+	if (m_journal)
+		m_journal->commit();
+	if (err.size())
+	{
+		LOG_WRITE(ERR, API, "throw");
+		throw std::runtime_error(err);
+	}
+}
+
+std::vector<std::string> WexTradeApi::deleteOrders(const std::vector<long long>& ids)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::deleteOrders");
+	std::vector<std::string> errors(ids.size());
+	std::vector<WexRequest> params(ids.size());
+	for (size_t i = 0; i < ids.size(); ++i)
+		cancelRequest(ids[i], params[i]);
+	for_each_concurrent(ids.size(), m_max_in_flight, [&](size_t i)
+	{
+		try
+		{
+			errors[i] = readCancel(ids[i], send(params[i]));
+		}
+		catch (const std::exception& e)
+		{
+			errors[i] = e.what();
+		}
+	});
+	if (m_journal)
+		m_journal->commit();
+	return errors;
+}
+
+const TradeApi::CoinValues& WexTradeApi::balances()
+{
+    LOG_SCOPE(TRACE, API, "WexTradeApi::balances()");
+	if (m_balances.empty())
+		readBalances();
+	return m_balances;
+}
+
+const TradeApi::Tickers& WexTradeApi::tickers()
+{
+    LOG_SCOPE(TRACE, API, "WexTradeApi::tickers()");
+	if (m_market)
+		return m_market->tickers();
+	if (m_tickers.buyPrice.empty())
+		readTickers();
+	return m_tickers;
+}
+
+void WexTradeApi::readTickers()
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::readTickers()");
+
+    std::vector<std::string> pairs;
+    {
+        std::lock_guard<std::mutex> lock(m_params_mutex);
+        pairs = m_pairs;
+    }
+    if (pairs.empty() && !loadMetadata(pairs))
+    {
+        // get pair list
+        std::vector<PairParams> params;
+        std::string reply = public_get("/api/3/info");
+        timed_parse("info", [&]() { parsePairs(reply, params, pairs); });
+        storeMetadata(params, pairs);
+    }
+    // get tickers for this pairs
+    std::string path = boost::algorithm::join(pairs, "-");
+    std::string reply = public_get("/api/3/ticker/" + path);
+    timed_parse("ticker", [&]() { parseTickers(reply, m_tickers); });
+}
+
+// Books younger than this are used as they are
+static const chrono::seconds depth_max_age(2);
+
+void WexTradeApi::readDepth(const std::vector<CoinId>& coins, chrono::seconds max_age)
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::readDepth()");
+    std::vector<std::string> pairs;
+    for (CoinId id : coins)
+    {
+        if (id == CoinRegistry::btc)
+            continue;
+        {
+            std::lock_guard<std::mutex> lock(m_book_mutex);
+            if (m_book.age(id) < max_age)
+                continue;
+        }
+        const std::string& coin = CoinRegistry::name(id);
+        std::string pair = pairParams(id).reverted ? "btc_" + coin : coin + "_btc";
+        if (std::find(pairs.begin(), pairs.end(), pair) == pairs.end())
+            pairs.push_back(pair);
+    }
+    if (pairs.empty())
+        return;
+    std::string body = public_get(boost::str(boost::format("/api/3/depth/%s?limit=%d") %
+        boost::algorithm::join(pairs, "-") % m_depth_levels));
+    std::lock_guard<std::mutex> lock(m_book_mutex);
+    timed_parse("depth", [&]() { parseDepth(body, m_book); });
+}
+
+void WexTradeApi::priceOrders(std::vector<Order>& orders)
+{
+    if (m_max_slippage <= 0.0 || orders.empty())
+        return;
+    // Accounts use the book of the market, which every account refreshes
+    WexTradeApi& source = m_market ? *m_market : *this;
+    std::vector<CoinId> coins;
+    for (const Order& o : orders)
+        coins.push_back(CoinRegistry::find(o.coin));
+    source.readDepth(coins, depth_max_age);
+
+    std::lock_guard<std::mutex> lock(source.m_book_mutex);
+    for (size_t i = 0; i < orders.size(); ++i)
+    {
+        Order& o = orders[i];
+        bool buy = o.action == BUY;
+        double cap = o.price * (buy ? 1.0 + m_max_slippage : 1.0 - m_max_slippage);
+        double vwap;
+        double limit = source.m_book.sweep(coins[i], o.action, o.amount, vwap);
+        // A thin book gets the furthest price allowed
+        if (limit == 0.0 || (buy ? limit > cap : limit < cap))
+            limit = cap;
+        if (buy ? limit < o.price : limit > o.price)
+            continue;
+        PairParams pp = pairParams(coins[i]);
+        if (!pp.reverted)
+        {
+            // The request rounds the rate to the nearest, round it away
+            // from the book instead so the last level is still reached
+            double unit = std::pow(10.0, (double)pp.decimal_places);
+            limit = buy ? std::ceil(limit * unit) / unit : std::floor(limit * unit) / unit;
+        }
+        LOG_WRITE(DEBUG, ORDERS, boost::str(boost::format("%s %s %f: %.8f -> %.8f, vwap %.8f") %
+            (buy ? "buy" : "sell") % o.coin % o.amount % o.price % limit % vwap));
+        if (buy)
+            o.amount *= o.price / limit;
+        o.price = limit;
+    }
+}
+
+void WexTradeApi::refresh()
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::refresh()");
+    m_balances.clear();
+    m_tickers = Tickers();
+}
+
+TradeApi::PairParams WexTradeApi::pairParams(CoinId coin)
+{
+    if (m_market)
+        return m_market->pairParams(coin);
+    std::lock_guard<std::mutex> lock(m_params_mutex);
+    return coin_value(m_params, coin);
+}
+
+TradeApi::PairParams WexTradeApi::pairParams(const std::string& coin)
+{
+    return pairParams(CoinRegistry::find(coin));
+}
+
+bool WexTradeApi::loadMetadata(std::vector<std::string>& pairs)
+{
+    if (m_metadata_path.empty())
+        return false;
+    MetadataCache cache(m_metadata_path);
+    if (!cache.open() || cache.age() > m_metadata_ttl)
+        return false;
+    {
+        std::lock_guard<std::mutex> lock(m_params_mutex);
+        cache.read(m_params, pairs);
+        m_pairs = pairs;
+    }
+    LOG_WRITE(INFO, API, "pair parameters loaded from " + m_metadata_path);
+    // Revalidate a snapshot past half its lifetime without delaying this
+    // run, a younger one is used as it is
+    if (cache.age() > m_metadata_ttl / 2 && !m_refresh.joinable())
+    {
+        m_refresh = std::thread([this]()
+        {
+            try
+            {
+                std::vector<PairParams> params;
+                std::vector<std::string> pairs;
+                std::string reply = public_get("/api/3/info");
+                timed_parse("info", [&]() { parsePairs(reply, params, pairs); });
+                storeMetadata(params, pairs);
+            }
+            catch (const std::exception& e)
+            {
+                LOG_WRITE(ERR, API, std::string("metadata refresh failed: ") + e.what());
+            }
+        });
+    }
+    return true;
+}
+
+void WexTradeApi::storeMetadata(const std::vector<PairParams>& params,
+    const std::vector<std::string>& pairs)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_params_mutex);
+        m_params = params;
+        m_pairs = pairs;
+    }
+    if (m_metadata_path.empty())
+        return;
+    try
+    {
+        MetadataCache(m_metadata_path).save(params, pairs);
+    }
+    catch (const std::exception& e)
+    {
+        LOG_WRITE(ERR, API, std::string("metadata snapshot not saved: ") + e.what());
+    }
+}
+
+void WexTradeApi::readBalances()
+{
+    LOG_SCOPE(INFO, API, "WexTradeApi::readBalances()");
+	m_balances.clear();
+	WexRequest req;
+	build<WexMethods::getInfo>(req).done();
+	std::string reply = call(req);
+	std::string err = timed_parse("getInfo", [&]() { return parseFunds(reply, m_balances, 0.001); });
+	if (err.size())
+	{
+		LOG_WRITE(ERR, API, "throw");
+		throw std::runtime_error(err);
+	}
+	for (CoinId id = 0; id < m_balances.size(); ++id)
+	{
+		if (m_balances[id] != 0.0)
+			LOG_WRITE(DEBUG, API, boost::str(boost::format("%s:%f") % CoinRegistry::name(id).c_str() % m_balances[id]));
+	}
+}
+
+string WexTradeApi::public_get(const string &target)
+{
+    const char* method = "other";
+    for (const char* m : { "info", "ticker", "depth" })
+    {
+        if (target.compare(0, 7 + strlen(m), std::string("/api/3/") + m) == 0)
+            method = m;
+    }
+    TraceSpan span("api", method, target);
+    return m_scheduler->get(target, &method_histogram("wex_request_duration_seconds", method));
+}
+
+// Resends of a request rejected for its nonce. Every process and thread
+// sharing the key may overtake it once.
+static const unsigned max_nonce_retries = 8;
+
+ConnectionPool::Request WexTradeApi::signedRequest(const WexRequest& params)
+{
+	char body[WexRequest::body_capacity];
+	std::string_view postData(body, postBody(params, body));
+	char sign[HmacSigner::hex_size];
+	m_signer.sign(postData, sign);
+    LOG_SECRET(DEBUG, SIGN, "Sign: " + std::string(sign, sizeof(sign)));
+    return postRequest(postData, std::string_view(sign, sizeof(sign)));
+}
+
+ConnectionPool::Request WexTradeApi::postRequest(std::string_view body, std::string_view sign)
+{
+    // Set up an HTTP POST request message
+    http::request<http::string_body> req;
+    req.method(http::verb::post);
+    req.target("/tapi");
+    req.set(http::field::content_type,
+            "application/x-www-form-urlencoded");
+    req.set("Key", m_key);
+    req.set("Sign", boost::beast::string_view(sign.data(), sign.size()));
+    req.body().assign(body.data(), body.size());
+    req.prepare_payload();
+    return req;
+}
+
+std::string WexTradeApi::send(const WexRequest& params)
+{
+    const WexMethod& method = params.method();
+    TraceSpan span("api", method.name);
+    Histogram* latency = &method_histogram("wex_request_duration_seconds", method.name);
+    bool resent = false;
+    // The nonce is drawn once the scheduler lets the request go, a request
+    // waiting in its lane does not hold back the nonces of later ones
+    auto sign = [&](ConnectionPool::Request& req) { req = signedRequest(params); };
+    std::string reply = m_scheduler->perform(sign, method.lane, m_key, latency, method.idempotent, &resent);
+    // Concurrent requests may reach the exchange out of nonce order, and
+    // another client of the key may have used higher nonces. Rejected
+    // requests were not executed, so sign them again above the nonce the
+    // exchange expects and resend.
+    for (unsigned retry = 0; retry < max_nonce_retries && reply.find("invalid nonce") != std::string::npos; ++retry)
+    {
+        // Unless the pool sent it twice: the pool resends a trade or cancel
+        // only when the first write failed, but a cancel of an order which
+        // is gone already is done either way. A trade is signed again.
+        if (resent && !method.idempotent && executed(params, reply))
+            break;
+        LOG_WRITE(INFO, NET, "resend with a new nonce");
+        ++Metrics::counter("wex_retries_total", "kind=\"nonce\"");
+        static const std::string expected("you should send:");
+        size_t pos = reply.find(expected);
+        if (pos != std::string::npos)
+            m_nonce->raise(strtoull(reply.c_str() + pos + expected.size(), nullptr, 10) - 1);
+        reply = m_scheduler->perform(sign, method.lane, m_key, latency, method.idempotent, &resent);
+    }
+    if (reply.find("\"success\":0") != std::string::npos)
+        ++Metrics::counter("wex_errors_total", "kind=\"api\"");
+    return reply;
+}
+
+bool WexTradeApi::executed(const WexRequest& params, std::string& reply)
+{
+    LOG_SCOPE(INFO, ORDERS, "WexTradeApi::executed");
+    if (&params.method() != &WexMethods::CancelOrder)
+        return false;
+    // Done when the order is no longer active
+    std::string_view id = params.param(WexParam::order_id);
+    WexRequest req;
+    build<WexMethods::OrderInfo>(req).set<WexParam::order_id>(id).done();
+    std::string info = call(req);
+    bool active = false;
+    std::string err = timed_parse("OrderInfo", [&]() { return parseOrderStatus(info, active); });
+    if (err.size() || active)
+        return false;
+    reply = "{\"success\":1,\"return\":{\"order_id\":" + std::string(id) + "}}";
+    return true;
+}
+
+std::string WexTradeApi::call(const WexRequest& params)
+{
+    LOG_SCOPE(DEBUG, NET, "WexTradeApi::call");
+    return send(params);
+}
+
+size_t WexTradeApi::postBody(const WexRequest& params, char* out)
+{
+    LOG_SCOPE(DEBUG, SIGN, "WexTradeApi::postBody");
+	size_t size = params.body(m_nonce->next(), out);
+    LOG_WRITE(DEBUG, SIGN, "Result: " + std::string(out, size));
+	return size;
+}
+
@@ -1,60 +1,228 @@
-// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#pragma once
-
-#include <string>
-#include <vector>
-#include <map>
-#include "TradeApi.h"
-
-class WexTradeApi : public TradeApi
-{
-public:
-    WexTradeApi(const std::string& key, const std::string& secret);
-
-	virtual double balance(const std::string& coin);
-	virtual CoinInfo info(const std::string& coin);
-	virtual std::map<std::string, double> nonZeroBalances();
-	virtual std::map<std::string, double> nonZeroBalancesInBTC();
-
-	virtual bool execute(const std::vector<Order>& orders, unsigned timeout);
-	virtual long long createOrder(const Order& order);
-    virtual void deleteOrder(long long id);
-	virtual bool checkOrder(long long id, const std::string& coin);
-    virtual void cancelCurrentOrders();
-
-    std::vector<long long> getCurrentOrders();
-    std::vector<long long> getCurrentOrders(const std::string& coin);
-
-	void set_log(const std::string& logfile) {
-		m_log = logfile;
-	}
-private:
-	void readTickers();
-	void readBalances();
-
-    std::string public_get(const std::string& target);
-	std::string call(const std::map<std::string, std::string>& params);
-	std::string postBody(const std::map<std::string, std::string>& params);
-	std::string signBody(const std::string& body);
-
-	std::string m_key;
-	std::string m_secret;
-
-    struct PairParams
-    {
-        unsigned decimal_places;
-        double min;
-        double max;
-        double fee;
-        double min_amount;
-        bool reverted;
-    };
-    std::map<std::string, PairParams> m_params;
-	std::map<std::string, CoinInfo> m_tickers;
-	std::map<std::string, double> m_balances;
-	unsigned  m_nonce;
-
-	std::string m_log;
-};
-
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include "TradeApi.h"
+#include "ConnectionPool.h"
+#include "RequestScheduler.h"
+#include "NonceSequencer.h"
+#include "OrderJournal.h"
+#include "HmacSigner.h"
+#include "WexRequest.h"
+#include "OrderBook.h"
+#include "TimerWheel.h"
+#include "Log.h"
+
+std::string double_to_string(double val, unsigned decimal_places);
+
+class WexTradeApi : public TradeApi
+{
+public:
+    // How execute() finds filled orders
+    enum FillCheck
+    {
+        ACTIVE_ORDERS,  // one ActiveOrders call per poll, OrderInfo for vanished orders
+        EACH_ORDER      // OrderInfo for every open order
+    };
+
+    WexTradeApi(const std::string& key, const std::string& secret,
+        const ConnectionPool::Endpoint& endpoint = ConnectionPool::Endpoint());
+    // Account which takes tickers and pair parameters from market and shares
+    // its connections. Fetch market.tickers() before the account is used
+    // from another thread, refresh() of the account keeps the market data.
+    WexTradeApi(const std::string& key, const std::string& secret, WexTradeApi& market);
+    virtual ~WexTradeApi();
+
+	virtual const CoinValues& balances();
+	virtual const Tickers& tickers();
+	virtual PairParams pairParams(CoinId coin);
+
+	virtual std::vector<OrderResult> execute(const std::vector<Order>& orders, unsigned timeout);
+	virtual long long createOrder(const Order& order);
+    virtual void deleteOrder(long long id);
+	virtual bool checkOrder(long long id, const std::string& coin);
+    virtual void cancelCurrentOrders();
+	virtual void refresh();
+
+    // Steps of execute() for callers which track orders themselves.
+    // checkOrders() marks filled orders and returns the number still open,
+    // cancelOrders() cancels all open ones.
+    std::vector<OrderResult> placeOrders(const std::vector<Order>& orders);
+    size_t checkOrders(std::vector<OrderResult>& results);
+    void cancelOrders(std::vector<OrderResult>& results);
+
+    // Cancels orders concurrently, returns an error text per id (empty on success)
+    std::vector<std::string> deleteOrders(const std::vector<long long>& ids);
+
+    std::vector<long long> getCurrentOrders();
+    std::vector<long long> getCurrentOrders(const std::string& coin);
+
+	void set_log(const std::string& logfile) {
+		m_log = Log::open(logfile);
+		if (m_log < 0)
+			throw std::runtime_error("Failed to open file " + logfile);
+	}
+
+	// Keeps the nonce of the key in a file shared with other processes,
+	// call before the first private request
+	void set_nonce_file(const std::string& path) {
+		m_nonce = std::make_unique<NonceSequencer>(path, m_key);
+	}
+
+	// Records the orders of the key in a write-ahead journal, which lets
+	// recoverOrders() keep the orders an earlier run left open. Orders
+	// further than max_price_gap (a share) from the middle price are
+	// cancelled by it instead.
+	void set_journal(const std::string& path, double max_price_gap = 0.01) {
+		m_journal = std::make_unique<OrderJournal>(path);
+		m_max_price_gap = max_price_gap;
+	}
+
+	bool journaled() const {
+		return m_journal != nullptr;
+	}
+
+	// Reconciles the journal with ActiveOrders instead of cancelling every
+	// open order. Orders of the journal which are no longer active have
+	// finished; active ones placed less than max_age ago at a price still
+	// near the market are returned to be waited for. All other active
+	// orders are cancelled, as cancelCurrentOrders() does without a journal.
+	std::vector<OrderResult> recoverOrders(std::chrono::seconds max_age);
+	// Polls the orders until they have finished or timeout passed, then
+	// cancels the rest
+	void awaitOrders(std::vector<OrderResult>& results, std::chrono::seconds timeout);
+
+	// Maximum number of order requests sent at the same time
+	void set_max_in_flight(unsigned count) {
+		m_max_in_flight = count;
+	}
+
+	void set_fill_check(FillCheck mode) {
+		m_fill_check = mode;
+	}
+
+	// Keeps pair parameters in a snapshot file. A snapshot younger than ttl
+	// replaces the /api/3/info request and is revalidated in background.
+	void set_metadata_cache(const std::string& path, std::chrono::seconds ttl) {
+		m_metadata_path = path;
+		m_metadata_ttl = ttl;
+	}
+
+	// Prices orders from the order book instead of the middle of the
+	// ticker: a buy takes the asks and a sell the bids up to the level that
+	// fills the whole amount, but never further than max_slippage (a share,
+	// 0.01 is 1%) from the given price. A buy keeps its BTC value, so it
+	// gets a smaller amount at a higher price. Zero turns it off.
+	void set_depth_pricing(double max_slippage, unsigned levels = 50) {
+		m_max_slippage = max_slippage;
+		m_depth_levels = levels;
+	}
+
+	// execute() checks an order first after the given time, then doubles
+	// the wait after every check up to max
+	void set_fill_polling(std::chrono::milliseconds first, std::chrono::milliseconds max) {
+		m_first_poll = first;
+		m_max_poll = max;
+	}
+
+	std::chrono::milliseconds first_poll() const {
+		return m_first_poll;
+	}
+
+	std::chrono::milliseconds max_poll() const {
+		return m_max_poll;
+	}
+
+	// Event loop execute() waits in. Other work may schedule tasks on it,
+	// they run while an execute() call waits for its orders.
+	TimerWheel& timers() {
+		return m_timers;
+	}
+
+	// Fetches the depth of the pairs older than max_age, all in one request
+	void readDepth(const std::vector<CoinId>& coins, std::chrono::seconds max_age);
+	// Reprices the orders from the book as set_depth_pricing() describes
+	void priceOrders(std::vector<Order>& orders);
+
+	// Request rate of the API key and of the public API. An account made
+	// from a market shares the scheduler of the market, so the public limit
+	// and the in-flight limit hold for all of them together.
+	void set_rate_limits(const RequestScheduler::Limit& account, const RequestScheduler::Limit& pub) {
+		m_scheduler->set_limits(account, pub);
+	}
+
+	ConnectionPool::Stats connection_stats() const {
+		return m_pool->stats();
+	}
+
+	RequestScheduler::Stats scheduler_stats() const {
+		return m_scheduler->stats();
+	}
+
+	// Request building steps of call(), public for wex_bench. postBody()
+	// writes the body with a new nonce to out, WexRequest::body_capacity
+	// long, and returns its length.
+	size_t postBody(const WexRequest& params, char* out);
+	ConnectionPool::Request signedRequest(const WexRequest& params);
+private:
+	void readTickers();
+	void readBalances();
+	PairParams pairParams(const std::string& coin);
+	bool loadMetadata(std::vector<std::string>& pairs);
+	void storeMetadata(const std::vector<PairParams>& params,
+		const std::vector<std::string>& pairs);
+
+    void orderRequest(const Order& order, WexRequest& req);
+    long long readOrderId(const Order& order, const std::string& reply);
+    std::string readCancel(long long id, const std::string& reply);
+
+    std::string public_get(const std::string& target);
+	std::string call(const WexRequest& params);
+	ConnectionPool::Request postRequest(std::string_view body, std::string_view sign);
+	// Signs and sends the request, again with a new nonce if it was rejected
+	std::string send(const WexRequest& params);
+	// Whether a cancel rejected for its nonce has nothing left to do, with
+	// the reply it would have got
+	bool executed(const WexRequest& params, std::string& reply);
+
+	std::string m_key;
+	HmacSigner m_signer;
+
+    std::vector<PairParams> m_params;
+    std::vector<std::string> m_pairs;
+    std::mutex m_params_mutex;
+	Tickers m_tickers;
+	CoinValues m_balances;
+	std::unique_ptr<NonceSequencer> m_nonce;
+	std::shared_ptr<ConnectionPool> m_pool;
+	std::shared_ptr<RequestScheduler> m_scheduler;
+	WexTradeApi* m_market;
+	unsigned m_max_in_flight;
+	FillCheck m_fill_check;
+
+	int m_log;
+	std::unique_ptr<OrderJournal> m_journal;
+	double m_max_price_gap;
+
+	OrderBook m_book;
+	std::mutex m_book_mutex;
+	double m_max_slippage;
+	unsigned m_depth_levels;
+
+	TimerWheel m_timers;
+	std::chrono::milliseconds m_first_poll;
+	std::chrono::milliseconds m_max_poll;
+
+	std::string m_metadata_path;
+	std::chrono::seconds m_metadata_ttl;
+	std::thread m_refresh;
+};
+
@@ -0,0 +1,179 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+
+// Fixed set of worker threads with a task queue each. A worker takes the
+// newest task of its own queue and, when that is empty, steals the oldest
+// task of another worker, so uneven tasks still keep all threads busy.
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency()) :
+		m_pending(0), m_next(0), m_stop(false)
+	{
+		if (!threads)
+			threads = 1;
+		for (unsigned i = 0; i < threads; ++i)
+			m_queues.emplace_back(new Queue);
+		for (unsigned i = 0; i < threads; ++i)
+			m_threads.emplace_back([this, i]() { work(i); });
+	}
+
+	~WorkStealingPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (std::thread& t : m_threads)
+			t.join();
+	}
+
+	unsigned size() const
+	{
+		return (unsigned)m_threads.size();
+	}
+
+	// Tasks submitted by a worker go to its own queue, others are spread
+	// over the queues in turn
+	void submit(Task task)
+	{
+		unsigned q = (current().pool == this) ? current().index :
+			m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+		{
+			// Queued under the pool lock so a worker about to sleep sees it
+			std::lock_guard<std::mutex> lock(m_mutex);
+			++m_pending;
+			std::lock_guard<std::mutex> queue_lock(m_queues[q]->mutex);
+			m_queues[q]->tasks.push_back(std::move(task));
+		}
+		m_wake.notify_one();
+	}
+
+	// Blocks until every submitted task has finished. The first exception
+	// thrown by a task is rethrown here.
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_idle.wait(lock, [this]() { return m_pending == 0; });
+		if (m_error)
+		{
+			std::exception_ptr e = m_error;
+			m_error = nullptr;
+			std::rethrow_exception(e);
+		}
+	}
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	struct Worker
+	{
+		WorkStealingPool* pool;
+		unsigned index;
+	};
+
+	static Worker& current()
+	{
+		static thread_local Worker worker = { nullptr, 0 };
+		return worker;
+	}
+
+	bool take(unsigned self, Task& task)
+	{
+		{
+			Queue& own = *m_queues[self];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.tasks.empty())
+			{
+				task = std::move(own.tasks.back());
+				own.tasks.pop_back();
+				return true;
+			}
+		}
+		for (size_t i = 1; i < m_queues.size(); ++i)
+		{
+			Queue& victim = *m_queues[(self + i) % m_queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.tasks.empty())
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(unsigned self)
+	{
+		current() = { this, self };
+		Task task;
+		while (true)
+		{
+			if (!take(self, task))
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_stop)
+					return;
+				// A task may have been queued between take() and the lock,
+				// so only sleep while nothing is queued anywhere
+				m_wake.wait(lock, [this]() { return m_stop || queued(); });
+				continue;
+			}
+			try
+			{
+				task();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (!m_error)
+					m_error = std::current_exception();
+			}
+			task = nullptr;
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (--m_pending == 0)
+				m_idle.notify_all();
+		}
+	}
+
+	// Called under m_mutex, which is always taken before a queue lock
+	bool queued()
+	{
+		for (auto& q : m_queues)
+		{
+			std::lock_guard<std::mutex> lock(q->mutex);
+			if (!q->tasks.empty())
+				return true;
+		}
+		return false;
+	}
+
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	size_t m_pending;
+	std::atomic<unsigned> m_next;
+	bool m_stop;
+	std::exception_ptr m_error;
+};
@@ -0,0 +1,312 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+//
+// Replays recorded prices through Portfolio for a grid of thresholds and
+// target parts and reports what every combination would have cost.
+#include <string>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/program_options.hpp>
+#include "TickerHistory.h"
+#include "SimTradeApi.h"
+#include "MetadataCache.h"
+#include "Portfolio.h"
+#include "WorkStealingPool.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+struct Settings
+{
+	vector<CoinId> coins;
+	double capital;
+	unsigned interval;
+	unsigned timeout;
+	double spread;
+	vector<TradeApi::PairParams> params;
+	shared_ptr<RebalanceSolver> solver;
+};
+
+struct Config
+{
+	double threshold;
+	vector<double> parts;
+};
+
+struct Outcome
+{
+	SimTradeApi::Stats stats;
+	unsigned checks;
+	double mean_value;      // BTC
+	double final_value;     // BTC
+	double tracking_error;  // root mean square distance from the target weights
+};
+
+// "0.05" is a single value, "0.01:0.1:0.01" a range with a step
+static vector<double> parse_range(const string& text)
+{
+	vector<double> res;
+	vector<double> v;
+	istringstream ss(text);
+	string field;
+	while (getline(ss, field, ':'))
+		v.push_back(stod(field));
+	if (v.size() == 1)
+		return v;
+	if (v.size() != 3 || v[2] <= 0.0 || v[1] < v[0])
+		throw runtime_error("Bad range " + text + ", expected from:to:step");
+	for (unsigned i = 0; v[0] + i * v[2] <= v[1] + v[2] * 1e-9; ++i)
+		res.push_back(v[0] + i * v[2]);
+	return res;
+}
+
+static vector<Config> make_grid(const vector<double>& thresholds,
+	const vector<vector<double>>& parts)
+{
+	vector<Config> grid;
+	vector<size_t> idx(parts.size(), 0);
+	while (true)
+	{
+		Config c;
+		for (size_t i = 0; i < parts.size(); ++i)
+			c.parts.push_back(parts[i][idx[i]]);
+		for (double t : thresholds)
+		{
+			c.threshold = t;
+			grid.push_back(c);
+		}
+		size_t i = 0;
+		for (; i < parts.size(); ++i)
+		{
+			if (++idx[i] < parts[i].size())
+				break;
+			idx[i] = 0;
+		}
+		if (i == parts.size())
+			return grid;
+	}
+}
+
+static Outcome run(const TickerHistory& history, const Settings& s, const Config& c)
+{
+	SimTradeApi trade(history, s.params, s.spread);
+	Portfolio p;
+	p.set_verbose(false);
+	p.set_solver(s.solver);
+	double sum = 0.0;
+	for (double part : c.parts)
+		sum += part;
+	for (size_t i = 0; i < s.coins.size(); ++i)
+	{
+		p.addCoin(s.coins[i], c.parts[i]);
+		trade.deposit(s.coins[i], s.capital * c.parts[i] / sum / trade.price(s.coins[i]));
+	}
+
+	Outcome res;
+	res.checks = 0;
+	double value_sum = 0.0;
+	double deviation_sum = 0.0;
+	vector<double> values(s.coins.size());
+	size_t rows = history.rows();
+	for (size_t row = 0; row < rows; )
+	{
+		trade.seek(row);
+		const TradeApi::CoinValues& amounts = trade.balances();
+		double value = 0.0;
+		for (size_t i = 0; i < s.coins.size(); ++i)
+		{
+			values[i] = coin_value(amounts, s.coins[i]) * trade.price(s.coins[i]);
+			value += values[i];
+		}
+		double deviation = 0.0;
+		for (size_t i = 0; i < s.coins.size(); ++i)
+		{
+			double d = values[i] / value - c.parts[i] / sum;
+			deviation += d * d;
+		}
+		++res.checks;
+		value_sum += value;
+		deviation_sum += deviation;
+
+		vector<TradeApi::Order> orders = p.checkCurrentState(trade, c.threshold);
+		if (!orders.empty())
+			trade.execute(orders, s.timeout);
+		// Like the daemon, the next check waits for the orders to settle
+		row = max(row + s.interval, trade.row() + 1);
+	}
+
+	res.stats = trade.stats();
+	res.mean_value = value_sum / res.checks;
+	res.tracking_error = sqrt(deviation_sum / res.checks);
+	res.final_value = 0.0;
+	const TradeApi::CoinValues& amounts = trade.balances();
+	for (CoinId id = 0; id < amounts.size(); ++id)
+	{
+		if (amounts[id] != 0.0)
+			res.final_value += amounts[id] * trade.price(id);
+	}
+	return res;
+}
+
+static void print_row(ostream& os, const Config& c, const Outcome& o, const string& sep)
+{
+	os << c.threshold << sep;
+	for (size_t i = 0; i < c.parts.size(); ++i)
+		os << c.parts[i] << (i + 1 < c.parts.size() ? ":" : "");
+	os << sep << o.stats.orders << sep << o.stats.filled << sep << o.stats.rejected
+		<< sep << o.stats.turnover << sep << o.stats.turnover / o.mean_value
+		<< sep << o.stats.fees << sep << o.tracking_error * 100.0 << sep << o.final_value << endl;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		po::options_description desc("Available options");
+		desc.add_options()
+			("help,h", "show options list")
+			("history", po::value<string>(), "Recorded prices, CSV or binary")
+			("convert", po::value<string>(), "Save the history in the binary format to this file and exit")
+			("coins,c", po::value< vector<string> >()->multitoken(), "Currency symbols, several values")
+			("parts,p", po::value< vector<string> >()->multitoken(), "Currency parts, a value or from:to:step for each coin")
+			("threshold,t", po::value< vector<string> >()->multitoken(), "Thresholds, values or from:to:step ranges")
+			("interval", po::value<unsigned>()->default_value(5), "History rows between rebalance checks")
+			("timeout", po::value<unsigned>()->default_value(30), "History rows an order stays open")
+			("capital", po::value<double>()->default_value(1.0), "Starting value in BTC, split by the target parts")
+			("fee", po::value<double>()->default_value(0.2), "Fee in percents for pairs without parameters")
+			("min-amount", po::value<double>()->default_value(0.0), "Minimum order amount for pairs without parameters")
+			("metadata-cache", po::value<string>(), "Pair parameters snapshot written by wex_manager")
+			("spread", po::value<double>()->default_value(0.1), "Distance between ask and bid, in percents")
+			("threads", po::value<unsigned>()->default_value(0), "Worker threads, all cores by default")
+			("solver", po::value<string>()->default_value("greedy"), "Order planning: greedy or min-turnover")
+			("output,o", po::value<string>(), "CSV file for the results of every combination")
+			("top", po::value<unsigned>()->default_value(10), "Number of best combinations to print");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+		if (vm.count("help") || !vm.count("history"))
+		{
+			cout << desc << endl;
+			return 0;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		TickerHistory history;
+		history.load(vm["history"].as<string>());
+		if (!history.rows())
+			throw runtime_error("History is empty");
+		if (vm.count("convert"))
+		{
+			history.saveBinary(vm["convert"].as<string>());
+			return 0;
+		}
+
+		Settings s;
+		vector<string> coins = vm["coins"].as< vector<string> >();
+		vector<string> part_specs = vm["parts"].as< vector<string> >();
+		if (coins.size() != part_specs.size())
+			throw runtime_error("Coins number differs from parts number");
+		for (const string& coin : coins)
+		{
+			if (coin != "btc" && history.find(coin) == history.coins().size())
+				throw runtime_error("No history for " + coin);
+			// The deposit at the first row is bought at its price
+			if (coin != "btc" && !(history.prices(history.find(coin))[0] > 0.0))
+				throw runtime_error("No " + coin + " price at the start of the history");
+			s.coins.push_back(CoinRegistry::intern(coin));
+		}
+		s.capital = vm["capital"].as<double>();
+		s.interval = max(1u, vm["interval"].as<unsigned>());
+		s.timeout = vm["timeout"].as<unsigned>();
+		s.spread = vm["spread"].as<double>() / 100.0;
+		s.solver = make_solver(vm["solver"].as<string>());
+		// Coins missing from the snapshot keep the defaults
+		TradeApi::PairParams defaults;
+		defaults.fee = vm["fee"].as<double>();
+		defaults.min_amount = vm["min-amount"].as<double>();
+		for (const string& coin : history.coins())
+			coin_slot(s.params, CoinRegistry::intern(coin)) = defaults;
+		if (vm.count("metadata-cache"))
+		{
+			MetadataCache cache(vm["metadata-cache"].as<string>());
+			vector<TradeApi::PairParams> params;
+			vector<string> pairs;
+			if (!cache.open())
+				throw runtime_error("Failed to read " + vm["metadata-cache"].as<string>());
+			cache.read(params, pairs);
+			for (const string& coin : history.coins())
+			{
+				CoinId id = CoinRegistry::find(coin);
+				bool listed = find(pairs.begin(), pairs.end(), coin + "_btc") != pairs.end() ||
+					find(pairs.begin(), pairs.end(), "btc_" + coin) != pairs.end();
+				if (listed && id < params.size())
+					s.params[id] = params[id];
+			}
+		}
+
+		vector<vector<double>> parts;
+		for (const string& spec : part_specs)
+			parts.push_back(parse_range(spec));
+		vector<double> thresholds;
+		for (const string& spec : vm["threshold"].as< vector<string> >())
+		{
+			vector<double> t = parse_range(spec);
+			thresholds.insert(thresholds.end(), t.begin(), t.end());
+		}
+		vector<Config> grid = make_grid(thresholds, parts);
+		chrono::steady_clock::time_point loaded = chrono::steady_clock::now();
+
+		// One task per combination, the history is shared read only
+		vector<Outcome> outcomes(grid.size());
+		{
+			unsigned threads = vm["threads"].as<unsigned>();
+			WorkStealingPool pool(threads ? threads : thread::hardware_concurrency());
+			for (size_t i = 0; i < grid.size(); ++i)
+				pool.submit([&, i]() { outcomes[i] = run(history, s, grid[i]); });
+			pool.wait();
+		}
+		chrono::steady_clock::time_point done = chrono::steady_clock::now();
+
+		if (vm.count("output"))
+		{
+			string fname = vm["output"].as<string>();
+			ofstream fout(fname);
+			if (!fout.is_open())
+				throw runtime_error("Failed to open file " + fname);
+			fout << "threshold,parts,orders,filled,rejected,turnover,turnover_ratio,fees,tracking_error,final_value" << endl;
+			for (size_t i = 0; i < grid.size(); ++i)
+				print_row(fout, grid[i], outcomes[i], ",");
+		}
+
+		vector<size_t> order(grid.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		sort(order.begin(), order.end(), [&](size_t a, size_t b)
+		{
+			return outcomes[a].final_value > outcomes[b].final_value;
+		});
+		auto ms = [](chrono::steady_clock::duration d)
+		{
+			return chrono::duration_cast<chrono::milliseconds>(d).count();
+		};
+		cout << grid.size() << " combinations over " << history.rows() << " rows, loaded in "
+			<< ms(loaded - start) << "ms, simulated in " << ms(done - loaded) << "ms" << endl;
+		cout << "threshold\tparts\torders\tfilled\trejected\tturnover\tturnover/value\tfees\ttracking error %\tfinal BTC" << endl;
+		for (size_t i = 0; i < order.size() && i < vm["top"].as<unsigned>(); ++i)
+			print_row(cout, grid[order[i]], outcomes[order[i]], "\t");
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
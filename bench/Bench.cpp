@@ -0,0 +1,731 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include "WexParser.h"
+#include "JsonReader.h"
+#include "WexTradeApi.h"
+#include "Portfolio.h"
+#include "PortfolioBatch.h"
+#include "WorkStealingPool.h"
+#include "TimerWheel.h"
+#include "HmacSigner.h"
+#include "Metrics.h"
+#include <openssl/hmac.h>
+#include <boost/program_options.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/format.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <random>
+#include <algorithm>
+
+using namespace boost::property_tree;
+namespace po = boost::program_options;
+using namespace std;
+
+typedef TradeApi::PairParams PairParams;
+typedef TradeApi::CoinInfo CoinInfo;
+
+static string read_file(const string& path)
+{
+	ifstream f(path, ios::binary);
+	if (!f.is_open())
+		throw runtime_error("Failed to open file " + path);
+	stringstream ss;
+	ss << f.rdbuf();
+	return ss.str();
+}
+
+static volatile size_t sink;
+
+struct Result
+{
+	string name;
+	double ns;
+	size_t iterations;
+};
+
+// Times benchmarks and collects the results
+class Runner
+{
+public:
+	Runner(const string& filter, chrono::milliseconds min_time) :
+		m_filter(filter), m_min_time(min_time) {}
+
+	// Repeats f until the run takes at least min_time and records the time
+	// per call, or per item when every call handles items of them
+	template<class F>
+	void run(const string& name, F f, size_t items = 1)
+	{
+		if (!m_filter.empty() && name.find(m_filter) == string::npos)
+			return;
+		size_t iterations = 1;
+		while (true)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (size_t i = 0; i < iterations; ++i)
+				f();
+			chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+			if (elapsed > m_min_time)
+			{
+				Result r = { name, elapsed.count() / iterations / items, iterations };
+				cout << left << setw(36) << name << right << setw(14) << fixed << setprecision(1)
+					<< r.ns << " ns/op" << endl;
+				m_results.push_back(r);
+				return;
+			}
+			iterations *= 2;
+		}
+	}
+
+	const vector<Result>& results() const
+	{
+		return m_results;
+	}
+
+private:
+	string m_filter;
+	chrono::milliseconds m_min_time;
+	vector<Result> m_results;
+};
+
+// Previous property_tree based decoders, kept as the baseline
+
+static void legacyPairs(const string& body, map<string, PairParams>& params, vector<string>& pairs)
+{
+	stringstream is;
+	is << body;
+	ptree pt;
+	read_json(is, pt);
+	ptree pair_tree = pt.get_child("pairs");
+	for (ptree::iterator it = pair_tree.begin(); it != pair_tree.end(); ++it)
+	{
+		string pair_name = it->first;
+		if (pair_name.find("btc") == string::npos)
+			continue;
+		PairParams p;
+		ptree param_data = it->second;
+		string coin;
+		if (pair_name.substr(0, 4) != "btc_")
+		{
+			coin = pair_name.substr(0, pair_name.find("_"));
+			p.reverted = false;
+		}
+		else
+		{
+			coin = pair_name.substr(pair_name.find("_") + 1);
+			p.reverted = true;
+		}
+		p.decimal_places = param_data.get<unsigned>("decimal_places");
+		p.fee = param_data.get<double>("fee");
+		p.max = param_data.get<double>("max_price");
+		p.min = param_data.get<double>("min_price");
+		p.min_amount = param_data.get<double>("min_amount");
+		params[coin] = p;
+		pairs.push_back(pair_name);
+	}
+}
+
+static void legacyTickers(const string& body, map<string, CoinInfo>& tickers)
+{
+	stringstream is;
+	is << body;
+	ptree pt;
+	read_json(is, pt);
+	for (auto it : pt)
+	{
+		string pair_name = it.first;
+		string coin;
+		CoinInfo i;
+		if (pair_name.substr(0, 4) != "btc_")
+		{
+			coin = pair_name.substr(0, pair_name.find("_"));
+			i.coin = coin;
+			i.buyPrice = it.second.get<double>("buy");
+			i.sellPrice = it.second.get<double>("sell");
+			i.lastPrice = it.second.get<double>("last");
+		}
+		else
+		{
+			coin = pair_name.substr(pair_name.find("_") + 1);
+			i.coin = coin;
+			i.buyPrice = 1.0 / it.second.get<double>("buy");
+			i.sellPrice = 1.0 / it.second.get<double>("sell");
+			i.lastPrice = 1.0 / it.second.get<double>("last");
+		}
+		tickers[coin] = i;
+	}
+}
+
+static bool is_token(const string& name)
+{
+	if (name.length() < 2)
+		return false;
+	size_t pos = name.length() - 2;
+	return (name.substr(pos, 2) == "et");
+}
+
+static void legacyFunds(const string& body, map<string, double>& balances)
+{
+	istringstream is(body);
+	ptree pt;
+	read_json(is, pt);
+	string err = pt.get("error", "");
+	if (err.size())
+		throw runtime_error(err);
+	ptree funds = pt.get_child("return").get_child("funds");
+	for (ptree::iterator it = funds.begin(); it != funds.end(); ++it)
+	{
+		if (is_token(it->first))
+			continue;
+		double balance = boost::lexical_cast<double>(it->second.data());
+		if (balance > 0.001)
+			balances[it->first] = balance;
+	}
+}
+
+static void legacyOrderIds(const string& body, vector<long long>& ids)
+{
+	istringstream is(body);
+	ptree pt;
+	read_json(is, pt);
+	ptree result = pt.get_child("return");
+	for (auto it : result)
+		ids.push_back(boost::lexical_cast<long long>(it.first));
+}
+
+static void check(bool ok, const string& what)
+{
+	if (!ok)
+		throw runtime_error("Implementations disagree on " + what);
+}
+
+static void json_benchmarks(Runner& runner, const string& dir)
+{
+	string info = read_file(dir + "/info.json");
+	string ticker = read_file(dir + "/ticker.json");
+	string getinfo = read_file(dir + "/getinfo.json");
+	string active = read_file(dir + "/activeorders.json");
+
+	// Both paths have to produce the same data before timing them
+	map<string, PairParams> p1;
+	vector<PairParams> p2;
+	vector<string> n1, n2;
+	legacyPairs(info, p1, n1);
+	parsePairs(info, p2, n2);
+	check(n1 == n2, "pairs");
+	for (auto& p : p1)
+	{
+		const PairParams& q = coin_value(p2, CoinRegistry::find(p.first));
+		check(p.second.decimal_places == q.decimal_places && p.second.fee == q.fee &&
+			p.second.min == q.min && p.second.max == q.max &&
+			p.second.min_amount == q.min_amount && p.second.reverted == q.reverted, "pair " + p.first);
+	}
+	map<string, CoinInfo> t1;
+	TradeApi::Tickers t2;
+	legacyTickers(ticker, t1);
+	parseTickers(ticker, t2);
+	for (auto& t : t1)
+	{
+		CoinId id = CoinRegistry::find(t.first);
+		check(t.second.buyPrice == coin_value(t2.buyPrice, id) && t.second.sellPrice == coin_value(t2.sellPrice, id) &&
+			t.second.lastPrice == coin_value(t2.lastPrice, id), "ticker " + t.first);
+	}
+	map<string, double> b1;
+	TradeApi::CoinValues b2;
+	legacyFunds(getinfo, b1);
+	parseFunds(getinfo, b2, 0.001);
+	for (CoinId id = 0; id < b2.size(); ++id)
+	{
+		auto it = b1.find(CoinRegistry::name(id));
+		check(b2[id] == (it != b1.end() ? it->second : 0.0), "funds " + CoinRegistry::name(id));
+	}
+	check(b1.size() == (size_t)count_if(b2.begin(), b2.end(), [](double v) { return v != 0.0; }), "funds");
+	vector<long long> o1, o2;
+	legacyOrderIds(active, o1);
+	parseOrderIds(active, o2);
+	check(o1 == o2, "active orders");
+
+	runner.run("json/ptree info", [&]() { map<string, PairParams> p; vector<string> n; legacyPairs(info, p, n); sink = p.size(); });
+	runner.run("json/reader info", [&]() { vector<PairParams> p; vector<string> n; parsePairs(info, p, n); sink = p.size(); });
+	runner.run("json/ptree ticker", [&]() { map<string, CoinInfo> t; legacyTickers(ticker, t); sink = t.size(); });
+	runner.run("json/reader ticker", [&]() { TradeApi::Tickers t; parseTickers(ticker, t); sink = t.buyPrice.size(); });
+	runner.run("json/ptree getInfo", [&]() { map<string, double> b; legacyFunds(getinfo, b); sink = b.size(); });
+	runner.run("json/reader getInfo", [&]() { TradeApi::CoinValues b; parseFunds(getinfo, b, 0.001); sink = b.size(); });
+	runner.run("json/ptree ActiveOrders", [&]() { vector<long long> o; legacyOrderIds(active, o); sink = o.size(); });
+	runner.run("json/reader ActiveOrders", [&]() { vector<long long> o; parseOrderIds(active, o); sink = o.size(); });
+
+	// What readTickers and readBalances do with a response
+	runner.run("parse/readTickers", [&]()
+	{
+		vector<PairParams> p;
+		vector<string> n;
+		TradeApi::Tickers t;
+		parsePairs(info, p, n);
+		parseTickers(ticker, t);
+		sink = t.buyPrice.size();
+	});
+	runner.run("parse/readBalances", [&]() { TradeApi::CoinValues b; parseFunds(getinfo, b, 0.001); sink = b.size(); });
+
+	// Depth refresh into a book that keeps its capacity, and pricing from it
+	string depth = read_file(dir + "/depth.json");
+	OrderBook book;
+	parseDepth(depth, book);
+	CoinId ltc = CoinRegistry::find("ltc");
+	double vwap;
+	check(book.side(ltc).asks.size() == 50 && book.sweep(ltc, TradeApi::BUY, 1.0, vwap) > 0.0, "depth");
+	runner.run("json/reader depth", [&]() { parseDepth(depth, book); sink = book.side(ltc).asks.size(); });
+	for (double amount : { 1.0, 100.0, 1000.0 })
+	{
+		runner.run("depth/sweep " + to_string((int)amount) + " ltc", [&]()
+		{
+			sink = (size_t)book.sweep(ltc, TradeApi::BUY, amount, vwap);
+		});
+	}
+}
+
+static void wex_benchmarks(Runner& runner)
+{
+	WexTradeApi api("bench-key", "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef");
+	// The parameter map and string joining the requests were built with
+	// before WexRequest
+	map<string, string> params;
+	unsigned nonce = 1500000000;
+	auto legacy_body = [&]()
+	{
+		params["method"] = "Trade";
+		params["pair"] = "ltc_btc";
+		params["type"] = "buy";
+		params["rate"] = double_to_string(0.01652, 8);
+		params["amount"] = double_to_string(12.345678, 8);
+		string res = (boost::format("nonce=%d") % nonce++).str();
+		for (auto param : params)
+			res += "&" + param.first + "=" + param.second;
+		return res;
+	};
+	WexRequest req;
+	auto build_trade = [&]()
+	{
+		build<WexMethods::Trade>(req)
+			.set<WexParam::pair>("ltc", "_btc")
+			.set<WexParam::type>("buy")
+			.set<WexParam::rate>(WexFixed{ 0.01652, 8 })
+			.set<WexParam::amount>(WexFixed{ 12.345678, 8 })
+			.done();
+	};
+	char buffer[WexRequest::body_capacity];
+	build_trade();
+	string body(buffer, api.postBody(req, buffer));
+	// Same parameters apart from the nonce, the map sorts them by name
+	auto fields = [](const string& b)
+	{
+		vector<string> f;
+		boost::split(f, b, [](char c) { return c == '&'; });
+		f.erase(f.begin());
+		sort(f.begin(), f.end());
+		return f;
+	};
+	check(fields(body) == fields(legacy_body()), "request bodies");
+
+	runner.run("wex/postBody map", [&]() { sink = legacy_body().size(); });
+	runner.run("wex/postBody", [&]() { build_trade(); sink = api.postBody(req, buffer); });
+	runner.run("wex/signedRequest", [&]() { sink = api.signedRequest(req).body().size(); });
+
+	// One-shot HMAC with sprintf hex as signBody did before HmacSigner
+	const string secret = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+	char hex[129];
+	auto one_shot = [&]()
+	{
+		unsigned char* digest = HMAC(EVP_sha512(), secret.c_str(), secret.length(),
+			(const unsigned char*)body.c_str(), body.length(), NULL, NULL);
+		for (int i = 0; i < 64; i++)
+			sprintf(&hex[i * 2], "%02x", (unsigned int)digest[i]);
+	};
+	runner.run("sign/hmac one-shot", [&]() { one_shot(); sink = hex[0]; });
+	HmacSigner signer(secret);
+	char out[HmacSigner::hex_size * 16];
+	one_shot();
+	check(signer.sign(body) == string(hex), "signatures");
+	runner.run("sign/HmacSigner", [&]() { signer.sign(body, out); sink = out[0]; });
+	vector<string> bodies(16);
+	vector<string_view> views(16);
+	for (size_t i = 0; i < bodies.size(); ++i)
+	{
+		bodies[i] = string(buffer, api.postBody(req, buffer));
+		views[i] = bodies[i];
+	}
+	runner.run("sign/HmacSigner batch 16, per body", [&]()
+	{
+		signer.sign(views.data(), views.size(), out);
+		sink = out[0];
+	}, views.size());
+	unsigned char digest[64];
+	for (size_t i = 0; i < 64; ++i)
+		digest[i] = (unsigned char)(i * 37);
+	runner.run("sign/hex 64 bytes", [&]() { HmacSigner::hex(digest, sizeof(digest), out); sink = out[0]; });
+	runner.run("wex/double_to_string", [&]() { sink = double_to_string(0.0165123456, 8).size(); });
+}
+
+// Serves fixed balances and prices to Portfolio
+class StubTradeApi : public TradeApi
+{
+public:
+	StubTradeApi() {}
+
+	explicit StubTradeApi(unsigned coins)
+	{
+		mt19937 rng(coins);
+		uniform_real_distribution<double> price(0.0001, 0.1), value(0.01, 1.0);
+		m_coins.push_back("btc");
+		coin_slot(m_balances, CoinRegistry::btc) = value(rng);
+		for (unsigned i = 0; i < coins - 1; ++i)
+		{
+			string coin = "c" + to_string(i);
+			CoinId id = CoinRegistry::intern(coin);
+			double last = price(rng);
+			set_price(id, last);
+			coin_slot(m_balances, id) = value(rng) / last;
+			m_coins.push_back(coin);
+		}
+	}
+
+	const vector<string>& coins() const { return m_coins; }
+
+	// A zero price leaves the coin without a ticker
+	void set_price(CoinId id, double last)
+	{
+		coin_slot(m_tickers.lastPrice, id) = last;
+		coin_slot(m_tickers.buyPrice, id) = last * 1.001;
+		coin_slot(m_tickers.sellPrice, id) = last * 0.999;
+	}
+
+	CoinValues& mutable_balances() { return m_balances; }
+
+	virtual const CoinValues& balances() { return m_balances; }
+	virtual const Tickers& tickers() { return m_tickers; }
+	virtual PairParams pairParams(CoinId) { return PairParams(); }
+	virtual vector<OrderResult> execute(const vector<Order>&, unsigned) { return vector<OrderResult>(); }
+	virtual long long createOrder(const Order&) { return 0; }
+	virtual void deleteOrder(long long) {}
+	virtual bool checkOrder(long long, const string&) { return false; }
+	virtual void cancelCurrentOrders() {}
+	virtual void refresh() {}
+
+private:
+	vector<string> m_coins;
+	CoinValues m_balances;
+	Tickers m_tickers;
+};
+
+// Middle prices the way checkCurrentState values the coins
+static TradeApi::CoinValues middle_prices(StubTradeApi& trade, const vector<CoinId>& ids)
+{
+	TradeApi::CoinValues prices(CoinRegistry::size());
+	const TradeApi::Tickers& tickers = trade.tickers();
+	for (CoinId id : ids)
+	{
+		prices[id] = (id == CoinRegistry::btc) ? 1.0 :
+			(coin_value(tickers.buyPrice, id) + coin_value(tickers.sellPrice, id)) / 2;
+	}
+	return prices;
+}
+
+// PortfolioBatch against Portfolio::checkCurrentState over random states:
+// coins without a ticker, coins held outside the portfolio, portfolios
+// without BTC and holdings near the targets, which end in the single order
+// to the coin of the largest drift
+static void check_portfolio_batch()
+{
+	vector<CoinId> ids{ CoinRegistry::btc };
+	for (unsigned i = 0; i < 6; ++i)
+		ids.push_back(CoinRegistry::intern("q" + to_string(i)));
+	mt19937 rng(2018);
+	uniform_real_distribution<double> unit(0.0, 1.0), price(0.0001, 0.1), part(0.1, 1.0),
+		value(0.01, 1.0), near(0.97, 1.03), threshold(0.02, 0.2);
+	const size_t portfolios = 200;
+	size_t errors = 0, fallbacks = 0, incomplete = 0;
+	for (unsigned round = 0; round < 50; ++round)
+	{
+		StubTradeApi trade;
+		for (CoinId id : ids)
+			if (id != CoinRegistry::btc)
+				trade.set_price(id, unit(rng) < 0.03 ? 0.0 : price(rng));
+		TradeApi::CoinValues prices = middle_prices(trade, ids);
+		PortfolioBatch batch(ids);
+		batch.resize(portfolios);
+		vector<Portfolio> singles(portfolios);
+		vector<TradeApi::CoinValues> balances(portfolios, TradeApi::CoinValues(CoinRegistry::size()));
+		for (size_t p = 0; p < portfolios; ++p)
+		{
+			singles[p].set_verbose(false);
+			batch.threshold(p) = threshold(rng);
+			bool balanced = unit(rng) < 0.3;
+			bool empty = true;
+			for (CoinId id : ids)
+			{
+				size_t row = batch.row(id);
+				// An empty portfolio has no targets to compare
+				bool member = unit(rng) < (id == CoinRegistry::btc ? 0.8 : 0.6) || (empty && id == ids.back());
+				empty = empty && !member;
+				if (member)
+				{
+					batch.part(row, p) = part(rng);
+					singles[p].addCoin(id, batch.part(row, p));
+				}
+				double v = 0.0;
+				if (balanced)
+					v = member ? batch.part(row, p) * (id == CoinRegistry::btc ? 2 * unit(rng) : near(rng)) : 0.0;
+				else if (unit(rng) < 0.6)
+					v = value(rng);
+				// Coins without a ticker are held in units
+				batch.amount(row, p) = balances[p][id] = (prices[id] != 0.0) ? v / prices[id] : v;
+			}
+		}
+		batch.evaluate(prices);
+		for (size_t p = 0; p < portfolios; ++p)
+		{
+			trade.mutable_balances() = balances[p];
+			vector<TradeApi::Order> orders;
+			string error;
+			try
+			{
+				orders = singles[p].checkCurrentState(trade, batch.threshold(p));
+			}
+			catch (const exception& e)
+			{
+				error = e.what();
+			}
+			vector<TradeApi::Order> batched = batch.orders(p);
+			bool same = orders.size() == batched.size();
+			for (size_t i = 0; same && i < orders.size(); ++i)
+			{
+				same = orders[i].coin == batched[i].coin && orders[i].action == batched[i].action &&
+					orders[i].price == batched[i].price && orders[i].amount == batched[i].amount;
+			}
+			string state = " of portfolio " + to_string(round * portfolios + p);
+			check(same, "batch orders" + state);
+			check(singles[p].completed() == batch.completed(p), "batch completed" + state);
+			check(error == batch.error(p), "batch error" + state);
+			errors += !error.empty();
+			// The coin of the largest drift is below the threshold only
+			// when it got the fallback order
+			fallbacks += error.empty() && !orders.empty() && abs(batch.maxDrift(p)) < batch.threshold(p);
+			incomplete += !singles[p].completed();
+		}
+	}
+	check(errors && fallbacks && incomplete, "batch states covered");
+}
+
+static void portfolio_benchmarks(Runner& runner)
+{
+	check_portfolio_batch();
+	for (unsigned coins : { 3, 10, 30, 100, 300, 1000 })
+	{
+		StubTradeApi trade(coins);
+		Portfolio p;
+		p.set_verbose(false);
+		for (const string& c : trade.coins())
+			p.addCoin(c, 1.0);
+		runner.run("portfolio/checkCurrentState " + to_string(coins), [&]()
+		{
+			sink = p.checkCurrentState(trade, 0.05).size();
+		});
+	}
+
+	// Many portfolios over the same prices, every one with its own parts
+	// and holdings
+	StubTradeApi trade(10);
+	vector<CoinId> ids;
+	for (const string& c : trade.coins())
+		ids.push_back(CoinRegistry::find(c));
+	TradeApi::CoinValues prices = middle_prices(trade, ids);
+	WorkStealingPool pool(thread::hardware_concurrency());
+	for (size_t portfolios : { 1000, 100000 })
+	{
+		PortfolioBatch batch(ids);
+		batch.resize(portfolios);
+		mt19937 rng(portfolios);
+		uniform_real_distribution<double> scale(0.8, 1.2);
+		for (size_t p = 0; p < portfolios; ++p)
+		{
+			batch.threshold(p) = 0.05;
+			for (CoinId id : ids)
+			{
+				size_t row = batch.row(id);
+				batch.part(row, p) = scale(rng);
+				batch.amount(row, p) = coin_value(trade.balances(), id) * scale(rng);
+			}
+		}
+		string size = "10x" + to_string(portfolios);
+		runner.run("portfolio/batch " + size, [&]()
+		{
+			batch.evaluate(prices);
+			sink = batch.completed(0);
+		});
+		runner.run("portfolio/batch threaded " + size, [&]()
+		{
+			batch.evaluate(prices, &pool);
+			sink = batch.completed(0);
+		});
+	}
+}
+
+// Polling timers of 1000 open orders spread over the next minute
+static void timer_benchmarks(Runner& runner)
+{
+	TimerWheel wheel;
+	vector<uint64_t> ids(1000);
+	runner.run("timers/schedule+cancel 1000", [&]()
+	{
+		TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+		for (size_t i = 0; i < ids.size(); ++i)
+			ids[i] = wheel.schedule(now + chrono::milliseconds(60 * i), []() {});
+		for (uint64_t id : ids)
+			wheel.cancel(id);
+		sink = wheel.pending();
+	});
+	runner.run("timers/run 1000 due", [&]()
+	{
+		size_t fired = 0;
+		TimerWheel::Clock::time_point now = TimerWheel::Clock::now();
+		for (size_t i = 0; i < ids.size(); ++i)
+			wheel.schedule(now, [&]() { if (++fired == ids.size()) wheel.stop(); });
+		wheel.run();
+		sink = fired;
+	});
+}
+
+static void metrics_benchmarks(Runner& runner)
+{
+	Histogram& h = Metrics::histogram("bench_seconds");
+	chrono::microseconds value(1);
+	runner.run("metrics/Histogram::record", [&]()
+	{
+		h.record(value);
+		value = chrono::microseconds(value.count() * 7 % 100003);
+		sink = h.count();
+	});
+	runner.run("metrics/Histogram::quantile", [&]() { sink = h.quantile(0.99).count(); });
+}
+
+static void write_json(const vector<Result>& results, ostream& os)
+{
+	os << "{\"benchmarks\":[" << endl;
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+		os << "{\"name\":\"" << results[i].name << "\",\"ns_per_op\":" << fixed << setprecision(2)
+			<< results[i].ns << ",\"iterations\":" << results[i].iterations << "}"
+			<< (i + 1 < results.size() ? "," : "") << endl;
+	}
+	os << "]}" << endl;
+}
+
+static map<string, double> read_json_results(const string& path)
+{
+	string text = read_file(path);
+	map<string, double> res;
+	JsonReader r(text);
+	string_view key;
+	r.beginObject();
+	while (r.nextMember(key))
+	{
+		if (key != "benchmarks")
+		{
+			r.skipValue();
+			continue;
+		}
+		r.beginArray();
+		while (r.nextElement())
+		{
+			string name;
+			double ns = 0.0;
+			r.beginObject();
+			while (r.nextMember(key))
+			{
+				if (key == "name")
+					name = string(r.readString());
+				else if (key == "ns_per_op")
+					ns = r.readNumber();
+				else
+					r.skipValue();
+			}
+			res[name] = ns;
+		}
+	}
+	return res;
+}
+
+// Prints the change against a previous run, returns the number of regressions
+static unsigned compare(const vector<Result>& results, const string& path, double tolerance)
+{
+	map<string, double> baseline = read_json_results(path);
+	unsigned regressions = 0;
+	cout << endl << "Compared to " << path << ":" << endl;
+	for (const Result& r : results)
+	{
+		auto it = baseline.find(r.name);
+		if (it == baseline.end() || it->second <= 0.0)
+			continue;
+		double change = (r.ns / it->second - 1.0) * 100.0;
+		bool regression = change > tolerance;
+		regressions += regression;
+		cout << left << setw(36) << r.name << right << setw(9) << showpos << fixed << setprecision(1)
+			<< change << noshowpos << "%" << (regression ? "  REGRESSION" : "") << endl;
+	}
+	return regressions;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		po::options_description desc("Available options");
+		desc.add_options()
+			("help,h", "show options list")
+			("data", po::value<string>()->default_value(WEX_BENCH_DATA), "Directory with recorded responses")
+			("filter", po::value<string>()->default_value(""), "Run only benchmarks containing this text")
+			("min-time", po::value<unsigned>()->default_value(200), "Minimum run time per benchmark, milliseconds")
+			("json", po::value<string>(), "Write results as JSON to this file")
+			("compare", po::value<string>(), "JSON results of a previous run to compare with")
+			("tolerance", po::value<double>()->default_value(10.0), "Slowdown in percents counted as regression");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+		if (vm.count("help"))
+		{
+			cout << desc << endl;
+			return 0;
+		}
+
+		Runner runner(vm["filter"].as<string>(), chrono::milliseconds(vm["min-time"].as<unsigned>()));
+		json_benchmarks(runner, vm["data"].as<string>());
+		wex_benchmarks(runner);
+		portfolio_benchmarks(runner);
+		timer_benchmarks(runner);
+		metrics_benchmarks(runner);
+
+		if (vm.count("json"))
+		{
+			string fname = vm["json"].as<string>();
+			ofstream fout(fname);
+			if (!fout.is_open())
+				throw runtime_error("Failed to open file " + fname);
+			write_json(runner.results(), fout);
+		}
+		if (vm.count("compare") &&
+			compare(runner.results(), vm["compare"].as<string>(), vm["tolerance"].as<double>()))
+			return 2;
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
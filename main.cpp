@@ -1,92 +1,277 @@
-// Copyright (c) 2015 Scruffy Scruffington
-// Distributed under the Apache 2.0 software license, see the LICENSE file
-#include <string>
-#include <boost/program_options.hpp>
-#include <iostream>
-#include <fstream>
-#include <chrono>
-#include "WexTradeApi.h"
-#include "Portfolio.h"
-#include "Log.h"
-
-namespace po = boost::program_options;
-using namespace std;
-
-int main(int argc, char* argv[])
-{
-	try
-	{
-		Log::init();
-		po::options_description desc("Available options");
-		desc.add_options()
-			("help,h", "show options list")
-			("key,k", po::value<string>(), "Poloniex API key")
-			("secret,s", po::value<string>(), "Poloniex API secret")
-			("coins,c", po::value< vector<string> >()->multitoken(), "Poloniex currency symbols, several values")
-			("parts,p", po::value< vector<double> >()->multitoken(), "Currency parts, several values")
-			("threshold,t", po::value<double>(), "Threshold to align currency part, in percents")
-			("timeout", po::value<unsigned>(), "Order timeout in minutes")
-			("balancelog,b", po::value<string>(), "File to log current balance")
-			("orderlog,o", po::value<string>(), "File to log all orders operations");
-		po::variables_map vm;
-		po::store(po::parse_command_line(argc, argv, desc), vm);
-		po::notify(vm);
-
-		if (vm.count("help"))
-		{
-			cout << desc << endl;
-			return 0;
-		}
-
-		string key = vm["key"].as<string>();
-		string secret = vm["secret"].as<string>();
-		vector<string> coins = vm["coins"].as< vector<string> >();
-		vector<double> parts = vm["parts"].as< vector<double> >();
-		if (coins.size() != parts.size())
-			throw runtime_error("Coins number differs from parts number");
-		double threshold = vm["threshold"].as<double>();
-		unsigned timeout = vm["timeout"].as<unsigned>();
-
-        WexTradeApi trade(key, secret);
-        trade.cancelCurrentOrders();
-        map<string, double> bs = trade.nonZeroBalances();
-        map<string, double> btcbs = trade.nonZeroBalancesInBTC();
-        double total = 0.0;
-        for (auto b : btcbs)
-        {
-            cout << b.first << ": " << bs[b.first] << " (" << b.second << "BTC)" << std::endl;
-            total += b.second;
-        }
-        double usd_price = trade.info("usd").lastPrice;
-        double usd_total = total / usd_price;
-        cout << "Total: " << total << "BTC (" << usd_total << "USD)" << std::endl;
-        if (vm.count("balancelog"))
-        {
-            string fname = vm["balancelog"].as<string>();
-            ofstream fout(fname, ofstream::app);
-            if (!fout.is_open())
-                throw runtime_error("Failed to open file " + fname);
-            time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
-            fout << ttp << "," << total << "," << usd_total << endl;
-        }
-        Portfolio p;
-        for (unsigned i = 0; i < coins.size(); ++i)
-            p.addCoin(coins[i], parts[i]);
-
-        vector<TradeApi::Order> orders = p.checkCurrentState(trade, threshold);
-        if (!orders.size())
-            return 0;
-
-        cout << "Execute " << orders.size() << " orders..." << endl;
-        if (vm.count("orderlog"))
-            trade.set_log(vm["orderlog"].as<string>());
-        trade.execute(orders, timeout);
-	}
-	catch (const exception& e)
-	{
-		cerr << e.what() << endl;
-		system("pause");
-	}
-	return 0;
-}
-
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+#include <string>
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <csignal>
+#include "WexTradeApi.h"
+#include "Portfolio.h"
+#include "Daemon.h"
+#include "Accounts.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "TraceEvents.h"
+#include "BalanceHistory.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+static RequestScheduler::Limit rate_limit(const po::variables_map& vm)
+{
+	double rate = vm["rate-limit"].as<double>();
+	return RequestScheduler::Limit(rate, max(1.0, rate * 2));
+}
+
+// Saves the queued log records, then lets the default action end the process
+static void on_crash(int sig)
+{
+	Log::flush_on_crash();
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+// Writes the metrics textfile and prints the latency summary of the run
+static void report_metrics()
+{
+	Metrics::flush();
+	cout << Metrics::summary();
+}
+
+// One run over the accounts of the --accounts file, public data is fetched once
+static int run_accounts(const po::variables_map& vm, const ConnectionPool::Endpoint& endpoint)
+{
+	double threshold = vm.count("threshold") ? vm["threshold"].as<double>() : 0.0;
+	vector<Accounts::Account> list = Accounts::read(vm["accounts"].as<string>(), threshold);
+	WexTradeApi market("", "", endpoint);
+	if (vm.count("metadata-cache"))
+		market.set_metadata_cache(vm["metadata-cache"].as<string>(),
+			chrono::hours(vm["metadata-ttl"].as<unsigned>()));
+	if (vm.count("rate-limit"))
+		market.set_rate_limits(rate_limit(vm), rate_limit(vm));
+	Accounts accounts(market, list, vm["threads"].as<unsigned>());
+	accounts.set_solver(make_solver(vm["solver"].as<string>()));
+	for (size_t i = 0; i < accounts.size(); ++i)
+	{
+		if (!accounts.account(i).journal.empty())
+			accounts.trade(i).set_journal(accounts.account(i).journal, vm["max-price-gap"].as<double>() / 100.0);
+		if (vm.count("nonce-file"))
+			accounts.trade(i).set_nonce_file(vm["nonce-file"].as<string>());
+		if (vm.count("parallel"))
+			accounts.trade(i).set_max_in_flight(vm["parallel"].as<unsigned>());
+		if (vm.count("check-each-order"))
+			accounts.trade(i).set_fill_check(WexTradeApi::EACH_ORDER);
+		if (vm.count("max-slippage"))
+			accounts.trade(i).set_depth_pricing(vm["max-slippage"].as<double>() / 100.0);
+	}
+
+	vector<Accounts::Outcome> outcomes = accounts.run(vm["timeout"].as<unsigned>());
+	unsigned failed = 0;
+	for (size_t i = 0; i < outcomes.size(); ++i)
+	{
+		const Accounts::Outcome& o = outcomes[i];
+		size_t executed = 0, errors = 0;
+		for (const TradeApi::OrderResult& r : o.orders)
+		{
+			executed += r.executed;
+			errors += !r.error.empty();
+		}
+		cout << accounts.account(i).name << ": " << o.total << "BTC, " << o.orders.size()
+			<< " orders, " << executed << " executed";
+		if (errors)
+			cout << ", " << errors << " with errors";
+		if (!o.error.empty())
+		{
+			cout << ", error [" << o.error << "]";
+			++failed;
+		}
+		cout << endl;
+	}
+	report_metrics();
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Log::init();
+		for (int sig : { SIGSEGV, SIGABRT, SIGFPE, SIGILL })
+			signal(sig, on_crash);
+#ifndef _WIN32
+		signal(SIGBUS, on_crash);
+#endif
+		po::options_description desc("Available options");
+		desc.add_options()
+			("help,h", "show options list")
+			("key,k", po::value<string>(), "Poloniex API key")
+			("secret,s", po::value<string>(), "Poloniex API secret")
+			("coins,c", po::value< vector<string> >()->multitoken(), "Poloniex currency symbols, several values")
+			("parts,p", po::value< vector<double> >()->multitoken(), "Currency parts, several values")
+			("threshold,t", po::value<double>(), "Threshold to align currency part, in percents")
+			("timeout", po::value<unsigned>(), "Order timeout in minutes")
+			("parallel", po::value<unsigned>(), "Maximum number of orders sent at once")
+			("check-each-order", "Poll every order with OrderInfo instead of one ActiveOrders list")
+			("balancelog,b", po::value<string>(), "File to log current balance")
+			("balance-history", po::value<string>(), "Binary file of per coin balances, prices and drift of every run, read by wex_query")
+			("orderlog,o", po::value<string>(), "File to log all orders operations")
+			("journal", po::value<string>(), "Write-ahead journal of the orders, lets a run keep the orders an earlier one left open")
+			("max-price-gap", po::value<double>()->default_value(1.0), "Orders of an earlier run further than this from the middle price are cancelled, in percents")
+			("host", po::value<string>(), "Exchange host, wex.nz by default")
+			("port", po::value<string>(), "Exchange port, 443 by default")
+			("no-tls", "Connect to the exchange without TLS")
+			("ca-file", po::value<string>(), "PEM bundle to verify the exchange certificate")
+			("daemon", "Keep running and rebalance whenever the threshold is exceeded")
+			("interval", po::value<unsigned>()->default_value(300), "Seconds between rebalance checks in daemon mode")
+			("metadata-cache", po::value<string>(), "File to keep exchange pair parameters between runs")
+			("metadata-ttl", po::value<unsigned>()->default_value(24), "Hours a pair parameters snapshot stays valid")
+			("log-sync", "Sync log files to disk after every write")
+			("log-max-size", po::value<unsigned>(), "Rotate log files larger than this, in megabytes")
+			("accounts", po::value<string>(), "JSON file of accounts to rebalance in one run instead of --key and --secret")
+			("threads", po::value<unsigned>()->default_value(16), "Accounts processed at the same time")
+			("solver", po::value<string>()->default_value("greedy"), "Order planning: greedy per coin or min-turnover in one step")
+			("max-slippage", po::value<double>(), "Price orders from the order book up to this distance from the middle price, in percents")
+			("nonce-file", po::value<string>(), "File keeping the last nonce of every API key, shared by all processes using it")
+			("rate-limit", po::value<double>(), "Requests per second per API key and for the public API, bursts of twice as many")
+			("metrics-file", po::value<string>(), "Prometheus textfile with request latencies, errors and drift, rewritten after every run or daemon cycle")
+			("trace-file", po::value<string>(), "Chrome trace-event JSON of the whole run, written at exit, for chrome://tracing or ui.perfetto.dev");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+
+		if (vm.count("help"))
+		{
+			cout << desc << endl;
+			return 0;
+		}
+		if (vm.count("metrics-file"))
+			Metrics::set_textfile(vm["metrics-file"].as<string>());
+		if (vm.count("trace-file"))
+			TraceEvents::enable(vm["trace-file"].as<string>());
+
+		Log::Config log_config;
+		log_config.sync = vm.count("log-sync") > 0;
+		if (vm.count("log-max-size"))
+			log_config.max_file_size = vm["log-max-size"].as<unsigned>() * 1024 * 1024;
+		Log::configure(log_config);
+
+        ConnectionPool::Endpoint endpoint;
+        if (vm.count("host"))
+            endpoint.host = vm["host"].as<string>();
+        if (vm.count("port"))
+            endpoint.port = vm["port"].as<string>();
+        if (vm.count("no-tls"))
+            endpoint.tls = false;
+        if (vm.count("ca-file"))
+            endpoint.ca_file = vm["ca-file"].as<string>();
+
+        if (vm.count("accounts"))
+            return run_accounts(vm, endpoint);
+
+		string key = vm["key"].as<string>();
+		string secret = vm["secret"].as<string>();
+		vector<string> coins = vm["coins"].as< vector<string> >();
+		vector<double> parts = vm["parts"].as< vector<double> >();
+		if (coins.size() != parts.size())
+			throw runtime_error("Coins number differs from parts number");
+		double threshold = vm["threshold"].as<double>();
+		unsigned timeout = vm["timeout"].as<unsigned>();
+
+        WexTradeApi trade(key, secret, endpoint);
+        if (vm.count("metadata-cache"))
+            trade.set_metadata_cache(vm["metadata-cache"].as<string>(),
+                chrono::hours(vm["metadata-ttl"].as<unsigned>()));
+        if (vm.count("orderlog"))
+            trade.set_log(vm["orderlog"].as<string>());
+        if (vm.count("journal"))
+            trade.set_journal(vm["journal"].as<string>(), vm["max-price-gap"].as<double>() / 100.0);
+        if (vm.count("nonce-file"))
+            trade.set_nonce_file(vm["nonce-file"].as<string>());
+        if (vm.count("parallel"))
+            trade.set_max_in_flight(vm["parallel"].as<unsigned>());
+        if (vm.count("check-each-order"))
+            trade.set_fill_check(WexTradeApi::EACH_ORDER);
+        if (vm.count("max-slippage"))
+            trade.set_depth_pricing(vm["max-slippage"].as<double>() / 100.0);
+        if (vm.count("rate-limit"))
+            trade.set_rate_limits(rate_limit(vm), rate_limit(vm));
+        Portfolio p;
+        for (unsigned i = 0; i < coins.size(); ++i)
+            p.addCoin(coins[i], parts[i]);
+        p.set_solver(make_solver(vm["solver"].as<string>()));
+
+        if (vm.count("daemon"))
+        {
+            Daemon daemon(trade, p, threshold, timeout,
+                chrono::seconds(vm["interval"].as<unsigned>()));
+            if (vm.count("balancelog"))
+                daemon.set_balance_log(vm["balancelog"].as<string>());
+            if (vm.count("balance-history"))
+                daemon.set_balance_history(vm["balance-history"].as<string>());
+            daemon.run();
+            report_metrics();
+            return 0;
+        }
+
+        // Orders an earlier run left open fill before the balances are read
+        vector<TradeApi::OrderResult> recovered = trade.recoverOrders(chrono::minutes(timeout));
+        if (!recovered.empty())
+        {
+            cout << "Wait for " << recovered.size() << " orders of an earlier run..." << endl;
+            trade.awaitOrders(recovered, chrono::minutes(timeout));
+            trade.refresh();
+        }
+        map<string, double> bs = trade.nonZeroBalances();
+        map<string, double> btcbs = trade.nonZeroBalancesInBTC();
+        double total = 0.0;
+        for (auto b : btcbs)
+        {
+            cout << b.first << ": " << bs[b.first] << " (" << b.second << "BTC)" << std::endl;
+            total += b.second;
+        }
+        double usd_price = trade.info("usd").lastPrice;
+        double usd_total = total / usd_price;
+        cout << "Total: " << total << "BTC (" << usd_total << "USD)" << std::endl;
+        if (vm.count("balancelog"))
+        {
+            string fname = vm["balancelog"].as<string>();
+            ofstream fout(fname, ofstream::app);
+            if (!fout.is_open())
+                throw runtime_error("Failed to open file " + fname);
+            time_t ttp = chrono::system_clock::to_time_t(chrono::system_clock::now());
+            fout << ttp << "," << total << "," << usd_total << endl;
+        }
+        vector<TradeApi::Order> orders = p.checkCurrentState(trade, threshold);
+        Metrics::gauge("wex_portfolio_drift", "", p.drift());
+        if (vm.count("balance-history"))
+            BalanceHistory::append(vm["balance-history"].as<string>(), BalanceHistory::snapshot(trade, p.drift()));
+        if (!orders.size())
+        {
+            report_metrics();
+            return 0;
+        }
+
+        cout << "Execute " << orders.size() << " orders..." << endl;
+        vector<TradeApi::OrderResult> results = trade.execute(orders, timeout);
+        for (const TradeApi::OrderResult& r : results)
+        {
+            cout << r.order.coin << ": ";
+            if (r.executed)
+                cout << "executed";
+            else if (r.cancelled)
+                cout << "cancelled";
+            if (!r.error.empty())
+                cout << "error [" << r.error << "]";
+            cout << endl;
+        }
+        report_metrics();
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		system("pause");
+	}
+	return 0;
+}
+
@@ -0,0 +1,584 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+//
+// Local stand-in for the Wex API used to load test the client. It serves
+// the public info and ticker methods and the private methods the client
+// uses, checks signatures and nonces, fills orders after a random delay and
+// can inject latency and errors.
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/ssl/stream.hpp>
+#include <boost/program_options.hpp>
+#include <openssl/hmac.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <random>
+#include <chrono>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <functional>
+
+using tcp = boost::asio::ip::tcp;
+namespace ssl = boost::asio::ssl;
+namespace http = boost::beast::http;
+namespace po = boost::program_options;
+using namespace std;
+
+typedef http::request<http::string_body> Request;
+typedef http::response<http::string_body> Response;
+
+struct Options
+{
+	string key;
+	string secret;
+	unsigned latency_ms;
+	unsigned jitter_ms;
+	double error_rate;
+	double drop_rate;
+	double fill_seconds;
+	double fee;
+	unsigned accounts;
+};
+
+class Exchange
+{
+public:
+	explicit Exchange(const Options& options) :
+		m_options(options), m_account(nullptr), m_next_id(100000000), m_rng(random_device()())
+	{
+		// coin, price in BTC, decimal places
+		struct { const char* coin; double price; unsigned decimals; } coins[] =
+		{
+			{ "ltc", 0.0165, 5 }, { "nmc", 0.00021, 5 }, { "nvc", 0.00032, 5 },
+			{ "ppc", 0.00024, 5 }, { "dsh", 0.061, 5 }, { "eth", 0.081, 5 },
+			{ "bch", 0.12, 5 }, { "zec", 0.031, 5 }
+		};
+		Account account;
+		for (auto& c : coins)
+		{
+			m_pairs[string(c.coin) + "_btc"] = Pair{ c.price, c.decimals, 0.01 };
+			account.funds[c.coin] = 0.1 / c.price;
+		}
+		m_pairs["btc_usd"] = Pair{ 9000.0, 3, 0.001 };
+		account.funds["usd"] = 0.0;
+		account.funds["btc"] = 1.0;
+		// The first account has the key itself, the others key-1, key-2...
+		m_accounts[m_options.key] = account;
+		for (unsigned i = 1; i < m_options.accounts; ++i)
+			m_accounts[m_options.key + "-" + to_string(i)] = account;
+	}
+
+	// drop tells to close the connection instead of sending the response
+	Response handle(const Request& req, bool& drop)
+	{
+		chrono::milliseconds delay(m_options.latency_ms);
+		bool fail;
+		{
+			lock_guard<mutex> lock(m_mutex);
+			if (m_options.jitter_ms)
+				delay += chrono::milliseconds(uniform_int_distribution<unsigned>(0, m_options.jitter_ms)(m_rng));
+			fail = bernoulli_distribution(m_options.error_rate)(m_rng);
+			drop = bernoulli_distribution(m_options.drop_rate)(m_rng);
+		}
+		if (delay.count())
+			this_thread::sleep_for(delay);
+
+		Response res{ http::status::ok, req.version() };
+		res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+		res.set(http::field::content_type, "application/json");
+		string target(req.target());
+		if (req.method() == http::verb::post && target == "/tapi")
+			res.body() = privateCall(req, fail);
+		else if (req.method() == http::verb::get && target == "/api/3/info" && !fail)
+			res.body() = info();
+		else if (req.method() == http::verb::get && target.compare(0, 14, "/api/3/ticker/") == 0 && !fail)
+			res.body() = ticker(target.substr(14));
+		else if (req.method() == http::verb::get && target.compare(0, 13, "/api/3/depth/") == 0 && !fail)
+			res.body() = depth(target.substr(13));
+		else
+		{
+			res.result(fail ? http::status::service_unavailable : http::status::not_found);
+			res.body() = fail ? "simulated failure" : "not found";
+		}
+		res.keep_alive(req.keep_alive());
+		res.prepare_payload();
+		return res;
+	}
+
+	void report()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		unsigned long long total = 0;
+		for (auto& c : m_calls)
+		{
+			cout << setw(16) << left << c.first << c.second << endl;
+			total += c.second;
+		}
+		cout << setw(16) << left << "total" << total << endl;
+	}
+
+private:
+	struct Pair
+	{
+		double price;
+		unsigned decimals;
+		double min_amount;
+	};
+
+	struct Order
+	{
+		string pair;
+		string type;
+		double rate;
+		double start_amount;
+		double amount;
+		time_t created;
+		chrono::steady_clock::time_point fill_at;
+		int status;     // 0 active, 1 executed, 2 cancelled
+	};
+
+	// Funds, orders and nonce of one API key
+	struct Account
+	{
+		map<string, double> funds;
+		map<long long, Order> orders;
+		unsigned long long nonce;
+
+		Account() : nonce(0) {}
+	};
+
+	static string number(double v)
+	{
+		ostringstream os;
+		os << setprecision(12) << v;
+		return os.str();
+	}
+
+	static string error(const string& text)
+	{
+		return "{\"success\":0,\"error\":\"" + text + "\"}";
+	}
+
+	string info()
+	{
+		lock_guard<mutex> lock(m_mutex);
+		++m_calls["info"];
+		ostringstream os;
+		os << "{\"server_time\":" << time(0) << ",\"pairs\":{";
+		bool first = true;
+		for (auto& p : m_pairs)
+		{
+			os << (first ? "" : ",") << "\"" << p.first << "\":{\"decimal_places\":" << p.second.decimals
+				<< ",\"min_price\":" << number(p.second.price / 100) << ",\"max_price\":" << number(p.second.price * 100)
+				<< ",\"min_amount\":" << number(p.second.min_amount) << ",\"hidden\":0,\"fee\":"
+				<< number(m_options.fee * 100) << "}";
+			first = false;
+		}
+		os << "}}";
+		return os.str();
+	}
+
+	string ticker(const string& names)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		++m_calls["ticker"];
+		ostringstream os;
+		os << "{";
+		bool first = true;
+		istringstream is(names);
+		string name;
+		while (getline(is, name, '-'))
+		{
+			auto it = m_pairs.find(name);
+			if (it == m_pairs.end())
+				return error("Invalid pair name: " + name);
+			double p = it->second.price;
+			os << (first ? "" : ",") << "\"" << name << "\":{\"high\":" << number(p * 1.02) << ",\"low\":"
+				<< number(p * 0.98) << ",\"avg\":" << number(p) << ",\"vol\":1000,\"vol_cur\":10,\"last\":"
+				<< number(p) << ",\"buy\":" << number(p * 1.001) << ",\"sell\":" << number(p * 0.999)
+				<< ",\"updated\":" << time(0) << "}";
+			first = false;
+		}
+		os << "}";
+		return os.str();
+	}
+
+	// Levels every 0.2% from the ticker buy and sell prices, each one larger
+	// than the one before
+	string depth(const string& query)
+	{
+		lock_guard<mutex> lock(m_mutex);
+		++m_calls["depth"];
+		size_t q = query.find('?');
+		unsigned limit = 150;
+		if (q != string::npos && query.compare(q, 7, "?limit=") == 0)
+			limit = min(5000u, (unsigned)strtoul(query.c_str() + q + 7, nullptr, 10));
+		ostringstream os;
+		os << "{";
+		bool first = true;
+		istringstream is(query.substr(0, q));
+		string name;
+		while (getline(is, name, '-'))
+		{
+			auto it = m_pairs.find(name);
+			if (it == m_pairs.end())
+				return error("Invalid pair name: " + name);
+			double p = it->second.price;
+			os << (first ? "" : ",") << "\"" << name << "\":{";
+			for (int side = 0; side < 2; ++side)
+			{
+				os << (side ? "],\"bids\":[" : "\"asks\":[");
+				for (unsigned i = 0; i < limit; ++i)
+				{
+					double step = 0.001 + 0.002 * i;
+					double price = side ? p * (1.0 - step) : p * (1.0 + step);
+					os << (i ? "," : "") << "[" << number(price) << "," << number(depth_amount(p, i)) << "]";
+				}
+			}
+			os << "]}";
+			first = false;
+		}
+		os << "}";
+		return os.str();
+	}
+
+	// Amount at the level, about 0.05 BTC worth growing with the distance
+	static double depth_amount(double price, unsigned level)
+	{
+		return 0.05 * (1 + level) / price;
+	}
+
+	string sign(const string& body) const
+	{
+		unsigned char* digest = HMAC(EVP_sha512(), m_options.secret.data(), (int)m_options.secret.size(),
+			(const unsigned char*)body.data(), body.size(), nullptr, nullptr);
+		static const char hex[] = "0123456789abcdef";
+		string res;
+		for (int i = 0; i < 64; ++i)
+		{
+			res += hex[digest[i] >> 4];
+			res += hex[digest[i] & 0xf];
+		}
+		return res;
+	}
+
+	string privateCall(const Request& req, bool fail)
+	{
+		map<string, string> params;
+		istringstream is(req.body());
+		string item;
+		while (getline(is, item, '&'))
+		{
+			size_t eq = item.find('=');
+			if (eq != string::npos)
+				params[item.substr(0, eq)] = item.substr(eq + 1);
+		}
+		string method = params["method"];
+
+		lock_guard<mutex> lock(m_mutex);
+		++m_calls[method.empty() ? "unknown" : method];
+		auto account = m_accounts.find(string(req["Key"]));
+		if (account == m_accounts.end())
+			return error("invalid api key");
+		m_account = &account->second;
+		if (string(req["Sign"]) != sign(req.body()))
+			return error("invalid sign");
+		unsigned long long nonce = strtoull(params["nonce"].c_str(), nullptr, 10);
+		if (nonce <= m_account->nonce)
+		{
+			++m_calls["rejected nonce"];
+			ostringstream os;
+			os << "invalid nonce parameter; on key:" << m_account->nonce << ", you sent:'" << nonce
+				<< "', you should send:" << m_account->nonce + 1;
+			return error(os.str());
+		}
+		m_account->nonce = nonce;
+		if (fail)
+			return error("simulated error");
+
+		settle();
+		if (method == "getInfo")
+			return getInfo();
+		if (method == "Trade")
+			return trade(params);
+		if (method == "OrderInfo")
+			return orderInfo(strtoll(params["order_id"].c_str(), nullptr, 10));
+		if (method == "ActiveOrders")
+			return activeOrders(params["pair"]);
+		if (method == "CancelOrder")
+			return cancelOrder(strtoll(params["order_id"].c_str(), nullptr, 10));
+		return error("invalid method");
+	}
+
+	static void split(const string& pair, string& base, string& quote)
+	{
+		base = pair.substr(0, pair.find('_'));
+		quote = pair.substr(pair.find('_') + 1);
+	}
+
+	// Executes orders whose simulated fill time has passed
+	void settle()
+	{
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		for (auto& o : m_account->orders)
+			if (o.second.status == 0 && o.second.fill_at <= now)
+				fill(o.second);
+	}
+
+	void fill(Order& o)
+	{
+		string base, quote;
+		split(o.pair, base, quote);
+		if (o.type == "buy")
+			m_account->funds[base] += o.amount * (1.0 - m_options.fee);
+		else
+			m_account->funds[quote] += o.amount * o.rate * (1.0 - m_options.fee);
+		o.amount = 0.0;
+		o.status = 1;
+	}
+
+	string funds()
+	{
+		ostringstream os;
+		os << "{";
+		bool first = true;
+		for (auto& f : m_account->funds)
+		{
+			os << (first ? "" : ",") << "\"" << f.first << "\":" << number(f.second);
+			first = false;
+		}
+		os << "}";
+		return os.str();
+	}
+
+	string getInfo()
+	{
+		unsigned open = 0;
+		for (auto& o : m_account->orders)
+			open += o.second.status == 0;
+		ostringstream os;
+		os << "{\"success\":1,\"return\":{\"funds\":" << funds()
+			<< ",\"rights\":{\"info\":1,\"trade\":1,\"withdraw\":0},\"transaction_count\":0,\"open_orders\":"
+			<< open << ",\"server_time\":" << time(0) << "}}";
+		return os.str();
+	}
+
+	string trade(map<string, string>& params)
+	{
+		auto it = m_pairs.find(params["pair"]);
+		if (it == m_pairs.end())
+			return error("invalid pair");
+		string type = params["type"];
+		double rate = strtod(params["rate"].c_str(), nullptr);
+		double amount = strtod(params["amount"].c_str(), nullptr);
+		if (type != "buy" && type != "sell")
+			return error("invalid type");
+		if (amount < it->second.min_amount)
+			return error("Value " + params["pair"] + " must be greater than " + number(it->second.min_amount) + ".");
+		if (rate < it->second.price / 100 || rate > it->second.price * 100)
+			return error("Price per unit is out of range");
+		string base, quote;
+		split(params["pair"], base, quote);
+		string coin = (type == "buy") ? quote : base;
+		double cost = (type == "buy") ? amount * rate : amount;
+		if (m_account->funds[coin] < cost)
+			return error("It is not enough " + coin + " for " + type);
+		m_account->funds[coin] -= cost;
+
+		Order o;
+		o.pair = params["pair"];
+		o.type = type;
+		o.rate = rate;
+		o.start_amount = o.amount = amount;
+		o.created = time(0);
+		o.status = 0;
+		// An order crossing the best level of the book fills at once, the
+		// others wait for the market to come to them
+		double best = (type == "buy") ? it->second.price * 1.001 : it->second.price * 0.999;
+		bool crosses = (type == "buy") ? rate >= best : rate <= best;
+		double delay = (m_options.fill_seconds > 0 && !crosses) ?
+			exponential_distribution<double>(1.0 / m_options.fill_seconds)(m_rng) : 0.0;
+		o.fill_at = chrono::steady_clock::now() +
+			chrono::duration_cast<chrono::steady_clock::duration>(chrono::duration<double>(delay));
+		long long id = 0;
+		if (delay > 0)
+			id = m_next_id++;
+		else
+			fill(o);
+		m_account->orders[id ? id : m_next_id++] = o;
+
+		ostringstream os;
+		os << "{\"success\":1,\"return\":{\"received\":" << number(o.start_amount - o.amount) << ",\"remains\":"
+			<< number(o.amount) << ",\"order_id\":" << id << ",\"funds\":" << funds() << "}}";
+		return os.str();
+	}
+
+	string orderJson(long long id, const Order& o)
+	{
+		ostringstream os;
+		os << "\"" << id << "\":{\"pair\":\"" << o.pair << "\",\"type\":\"" << o.type << "\",\"start_amount\":"
+			<< number(o.start_amount) << ",\"amount\":" << number(o.amount) << ",\"rate\":" << number(o.rate)
+			<< ",\"timestamp_created\":" << o.created << ",\"status\":" << o.status << "}";
+		return os.str();
+	}
+
+	string orderInfo(long long id)
+	{
+		auto it = m_account->orders.find(id);
+		if (it == m_account->orders.end())
+			return error("invalid order");
+		return "{\"success\":1,\"return\":{" + orderJson(id, it->second) + "}}";
+	}
+
+	string activeOrders(const string& pair)
+	{
+		string list;
+		for (auto& o : m_account->orders)
+		{
+			if (o.second.status != 0 || (!pair.empty() && pair != o.second.pair))
+				continue;
+			list += (list.empty() ? "" : ",") + orderJson(o.first, o.second);
+		}
+		if (list.empty())
+			return error("no orders");
+		return "{\"success\":1,\"return\":{" + list + "}}";
+	}
+
+	string cancelOrder(long long id)
+	{
+		auto it = m_account->orders.find(id);
+		if (it == m_account->orders.end())
+			return error("invalid order");
+		Order& o = it->second;
+		if (o.status != 0)
+			return error("bad status");
+		string base, quote;
+		split(o.pair, base, quote);
+		if (o.type == "buy")
+			m_account->funds[quote] += o.amount * o.rate;
+		else
+			m_account->funds[base] += o.amount;
+		o.status = 2;
+		ostringstream os;
+		os << "{\"success\":1,\"return\":{\"order_id\":" << id << ",\"funds\":" << funds() << "}}";
+		return os.str();
+	}
+
+	Options m_options;
+	mutex m_mutex;
+	map<string, Pair> m_pairs;
+	map<string, Account> m_accounts;
+	Account* m_account;     // of the private call being handled
+	long long m_next_id;
+	mt19937 m_rng;
+	map<string, unsigned long long> m_calls;
+};
+
+template<class Stream>
+static void serve(Stream& stream, Exchange& exchange)
+{
+	boost::beast::flat_buffer buffer;
+	boost::system::error_code ec;
+	while (true)
+	{
+		Request req;
+		http::read(stream, buffer, req, ec);
+		if (ec)
+			break;
+		bool drop = false;
+		Response res = exchange.handle(req, drop);
+		if (drop)
+			break;
+		http::write(stream, res, ec);
+		if (ec || !req.keep_alive())
+			break;
+	}
+}
+
+static void session(tcp::socket socket, ssl::context* ctx, Exchange& exchange)
+{
+	socket.set_option(tcp::no_delay(true));
+	if (!ctx)
+	{
+		serve(socket, exchange);
+		return;
+	}
+	ssl::stream<tcp::socket> stream(std::move(socket), *ctx);
+	boost::system::error_code ec;
+	stream.handshake(ssl::stream_base::server, ec);
+	if (!ec)
+		serve(stream, exchange);
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Options options;
+		po::options_description desc("Available options");
+		desc.add_options()
+			("help,h", "show options list")
+			("port", po::value<unsigned short>()->default_value(8080), "Port to listen on")
+			("cert", po::value<string>(), "PEM certificate chain, enables TLS")
+			("private-key", po::value<string>(), "PEM private key of the certificate")
+			("key,k", po::value<string>(&options.key)->default_value("mock-key"), "Accepted API key")
+			("secret,s", po::value<string>(&options.secret)->default_value("mock-secret"), "API secret to verify signatures")
+			("latency", po::value<unsigned>(&options.latency_ms)->default_value(0), "Added response delay, milliseconds")
+			("jitter", po::value<unsigned>(&options.jitter_ms)->default_value(0), "Random extra delay up to this, milliseconds")
+			("error-rate", po::value<double>(&options.error_rate)->default_value(0.0), "Share of requests failing, 0..1")
+			("drop-rate", po::value<double>(&options.drop_rate)->default_value(0.0), "Share of requests executed without a reply, the connection is closed instead, 0..1")
+			("fill-time", po::value<double>(&options.fill_seconds)->default_value(5.0), "Mean seconds until an order fills, 0 fills at once")
+			("fee", po::value<double>(&options.fee)->default_value(0.002), "Trade fee share")
+			("accounts", po::value<unsigned>(&options.accounts)->default_value(1), "Number of API keys, the key followed by -1, -2... after the first");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+		if (vm.count("help"))
+		{
+			cout << desc << endl;
+			return 0;
+		}
+
+		unique_ptr<ssl::context> ctx;
+		if (vm.count("cert"))
+		{
+			ctx.reset(new ssl::context(ssl::context::tls_server));
+			ctx->use_certificate_chain_file(vm["cert"].as<string>());
+			ctx->use_private_key_file(vm.count("private-key") ? vm["private-key"].as<string>() :
+				vm["cert"].as<string>(), ssl::context::pem);
+		}
+
+		Exchange exchange(options);
+		boost::asio::io_context ios;
+		tcp::acceptor acceptor(ios, tcp::endpoint(tcp::v4(), vm["port"].as<unsigned short>()));
+		boost::asio::signal_set signals(ios, SIGINT, SIGTERM);
+		signals.async_wait([&](const boost::system::error_code&, int) { ios.stop(); });
+		function<void()> accept = [&]()
+		{
+			acceptor.async_accept([&](const boost::system::error_code& ec, tcp::socket socket)
+			{
+				if (ec)
+					return;
+				thread(session, std::move(socket), ctx.get(), std::ref(exchange)).detach();
+				accept();
+			});
+		};
+		accept();
+		cout << "Listening on port " << vm["port"].as<unsigned short>() << (ctx ? " (TLS)" : "") << endl;
+		ios.run();
+		exchange.report();
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}
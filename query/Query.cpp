@@ -0,0 +1,175 @@
+// Copyright (c) 2015 Scruffy Scruffington
+// Distributed under the Apache 2.0 software license, see the LICENSE file
+//
+// Answers time range questions about a balance history written by
+// wex_manager --balance-history: totals and drift over the range and the
+// weight of every coin, averaged over steps of the range.
+#include <string>
+#include <vector>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/program_options.hpp>
+#include "BalanceHistory.h"
+
+namespace po = boost::program_options;
+using namespace std;
+
+// Unix time, or a UTC date as "2018-01-31" or "2018-01-31 12:00"
+static int64_t parse_time(const string& text)
+{
+	if (text.find('-') == string::npos)
+		return stoll(text);
+	tm t = tm();
+	istringstream ss(text);
+	ss >> get_time(&t, "%Y-%m-%d");
+	if (ss.fail())
+		throw runtime_error("Failed to parse time " + text);
+	if (ss >> ws && !ss.eof())
+	{
+		ss >> get_time(&t, "%H:%M");
+		if (ss.fail())
+			throw runtime_error("Failed to parse time " + text);
+	}
+	return timegm(&t);
+}
+
+static string format_time(int64_t t)
+{
+	time_t tt = (time_t)t;
+	tm utc;
+	gmtime_r(&tt, &utc);
+	ostringstream ss;
+	ss << put_time(&utc, "%Y-%m-%d %H:%M");
+	return ss.str();
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		po::options_description desc("Available options");
+		desc.add_options()
+			("help,h", "show options list")
+			("history", po::value<string>(), "Balance history file")
+			("from", po::value<string>(), "Start of the range, unix time or UTC date as 2018-01-31 or \"2018-01-31 12:00\"")
+			("to", po::value<string>(), "End of the range, exclusive")
+			("weights", "Print the weight of every coin in the total value, as CSV")
+			("step", po::value<unsigned>()->default_value(86400), "Seconds the weights are averaged over")
+			("coins,c", po::value< vector<string> >()->multitoken(), "Coins of the weight series, all recorded by default");
+		po::variables_map vm;
+		po::store(po::parse_command_line(argc, argv, desc), vm);
+		po::notify(vm);
+		if (vm.count("help") || !vm.count("history"))
+		{
+			cout << desc << endl;
+			return 0;
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		BalanceHistory history(vm["history"].as<string>());
+		size_t from = vm.count("from") ? history.lower_bound(parse_time(vm["from"].as<string>())) : 0;
+		size_t to = vm.count("to") ? history.lower_bound(parse_time(vm["to"].as<string>())) : history.rows();
+		if (from >= to)
+		{
+			cout << "No records in the range" << endl;
+			return 0;
+		}
+
+		static const char* names[] = { "total BTC", "total USD", "drift" };
+		BalanceHistory::Stats stats[BalanceHistory::FIELDS];
+		for (size_t f = 0; f < BalanceHistory::FIELDS; ++f)
+			stats[f] = history.stats((BalanceHistory::Field)f, from, to);
+
+		vector<size_t> coins;
+		if (vm.count("coins"))
+		{
+			for (const string& coin : vm["coins"].as< vector<string> >())
+			{
+				size_t c = history.find(coin);
+				if (c == history.coins().size())
+					throw runtime_error("No history for " + coin);
+				coins.push_back(c);
+			}
+		}
+		else
+		{
+			for (size_t c = 0; c < history.coins().size(); ++c)
+				coins.push_back(c);
+		}
+		int64_t first = history.time(from);
+		int64_t step = max(1u, vm["step"].as<unsigned>());
+		// Weights summed per step, a column per coin
+		vector<int64_t> steps;
+		vector<size_t> counts;
+		vector<double> sums;
+		if (vm.count("weights"))
+		{
+			// Times are sorted, so the steps come in order
+			vector<size_t> slot(BalanceHistory::rows_per_block);
+			for (size_t row = from; row < to;)
+			{
+				size_t b = row / BalanceHistory::rows_per_block;
+				size_t i = row % BalanceHistory::rows_per_block;
+				size_t n = min(BalanceHistory::rows_per_block - i, to - row);
+				const int64_t* times = history.times(b) + i;
+				for (size_t j = 0; j < n; ++j)
+				{
+					int64_t bucket = first + (times[j] - first) / step * step;
+					if (steps.empty() || steps.back() != bucket)
+					{
+						steps.push_back(bucket);
+						counts.push_back(0);
+						sums.resize(steps.size() * coins.size(), 0.0);
+					}
+					slot[j] = steps.size() - 1;
+					++counts.back();
+				}
+				const double* totals = history.column(b, BalanceHistory::TOTAL_BTC) + i;
+				for (size_t k = 0; k < coins.size(); ++k)
+				{
+					const double* values = history.column(b, coins[k], BalanceHistory::VALUE) + i;
+					for (size_t j = 0; j < n; ++j)
+					{
+						if (totals[j] > 0.0)
+							sums[slot[j] * coins.size() + k] += values[j] / totals[j];
+					}
+				}
+				row += n;
+			}
+		}
+		chrono::steady_clock::time_point done = chrono::steady_clock::now();
+
+		cout << to - from << " records from " << format_time(history.time(from)) << " to "
+			<< format_time(history.time(to - 1)) << " UTC, queried in " << fixed << setprecision(2)
+			<< chrono::duration<double, milli>(done - start).count() << "ms" << endl;
+		cout << setprecision(8);
+		cout << "\tmin\tmax\tavg" << endl;
+		for (size_t f = 0; f < BalanceHistory::FIELDS; ++f)
+			cout << names[f] << "\t" << stats[f].min << "\t" << stats[f].max << "\t" << stats[f].avg() << endl;
+		if (vm.count("weights"))
+		{
+			cout << "time";
+			for (size_t c : coins)
+				cout << "," << history.coins()[c];
+			cout << endl << setprecision(6);
+			for (size_t s = 0; s < steps.size(); ++s)
+			{
+				cout << steps[s];
+				for (size_t k = 0; k < coins.size(); ++k)
+					cout << "," << sums[s * coins.size() + k] / counts[s];
+				cout << endl;
+			}
+		}
+	}
+	catch (const exception& e)
+	{
+		cerr << e.what() << endl;
+		return 1;
+	}
+	return 0;
+}